@@ -21,10 +21,17 @@
 #include "abstractsocialcachedatabase_p.h"
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
 #include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QEvent>
 #include <QtCore/QFile>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QRegExp>
 #include <QtCore/QStandardPaths>
+#include <QtCore/QTimerEvent>
 #include <QtCore/QThreadPool>
 #include <QtCore/QUuid>
 #include <QtSql/QSqlQuery>
@@ -33,6 +40,13 @@
 
 #include <QtDebug>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
 // AbstractSocialCacheDatabase
 // This class is the base class for all classes
 // that deals with database access.
@@ -44,6 +58,9 @@
 // into db very fast.
 
 QThreadStorage<QHash<QString, AbstractSocialCacheDatabasePrivate::ThreadData> > AbstractSocialCacheDatabasePrivate::globalThreadData;
+QThreadStorage<QHash<QString, AbstractSocialCacheDatabasePrivate::ThreadData *> > AbstractSocialCacheDatabasePrivate::activeThreadData;
+
+Q_LOGGING_CATEGORY(lcSocialCacheDatabase, "org.nemomobile.socialcache.database")
 
 namespace {
 class ProcessMutexCleanup
@@ -72,6 +89,275 @@ public:
 private:
     AbstractSocialCacheDatabasePrivate::ThreadData *threadData;
 };
+
+// Makes prepare() use the connection a read or write runs on, for as long as
+// it runs on the calling thread
+class ActiveConnection
+{
+public:
+    ActiveConnection(const QString &filePath, AbstractSocialCacheDatabasePrivate::ThreadData *threadData)
+        : connections(AbstractSocialCacheDatabasePrivate::activeThreadData.localData())
+        , filePath(filePath)
+        , previous(connections.value(filePath))
+    {
+        connections.insert(filePath, threadData);
+    }
+
+    ~ActiveConnection()
+    {
+        if (previous) {
+            connections.insert(filePath, previous);
+        } else {
+            connections.remove(filePath);
+        }
+    }
+
+private:
+    QHash<QString, AbstractSocialCacheDatabasePrivate::ThreadData *> &connections;
+    const QString filePath;
+    AbstractSocialCacheDatabasePrivate::ThreadData * const previous;
+};
+
+static const int DEFAULT_READER_THREAD_COUNT = 2;
+static const int LOCK_TIMEOUT = 30000;
+static const int FILE_REMOVAL_BATCH_SIZE = 500;
+static const int DEFAULT_PREPARED_QUERY_CACHE_SIZE = 64;
+static const int DEFAULT_MAINTENANCE_INTERVAL = 10000;
+static const int DEFAULT_MAINTENANCE_PAGE_LIMIT = 256;
+
+void recordLatency(AbstractSocialCacheDatabase::LatencyStatistics *statistics, qint64 latency)
+{
+    statistics->count += 1;
+    statistics->total += latency;
+    statistics->maximum = qMax(statistics->maximum, latency);
+
+    int bucket = 0;
+    for (qint64 limit = 100; latency >= limit && bucket < statistics->histogram.count() - 1; limit *= 10) {
+        ++bucket;
+    }
+    statistics->histogram[bucket] += 1;
+}
+
+void dumpLatency(const char *name, const AbstractSocialCacheDatabase::LatencyStatistics &statistics)
+{
+    QStringList buckets;
+    Q_FOREACH (int count, statistics.histogram) {
+        buckets.append(QString::number(count));
+    }
+
+    qCDebug(lcSocialCacheDatabase) << " " << name << "count" << statistics.count
+                                   << "average" << (statistics.count > 0 ? statistics.total / statistics.count : 0)
+                                   << "max" << statistics.maximum
+                                   << "histogram" << buckets.join(QLatin1String(" "));
+}
+
+int pragmaValue(QSqlQuery &query, const QString &pragma)
+{
+    int value = -1;
+    if (query.exec(pragma) && query.next()) {
+        value = query.value(0).toInt();
+    }
+    query.finish();
+    return value;
+}
+
+struct DatabaseThreads;
+
+// Commits the writes queued for group commit on the writer thread.
+class GroupWriter : public QRunnable
+{
+public:
+    explicit GroupWriter(DatabaseThreads *threads)
+        : threads(threads)
+    {
+        setAutoDelete(false);
+    }
+
+    void run();
+
+private:
+    DatabaseThreads * const threads;
+};
+
+// Threads dedicated to a database file. Threads never expire, so that the
+// connections they hold in globalThreadData stay open between operations.
+struct DatabaseThreads
+{
+    DatabaseThreads()
+        : groupWriter(this)
+        , groupCommitLatency(0)
+        , groupCommitBatchSize(1)
+        , groupWriterRunning(false)
+        , activeWrites(0)
+    {
+        writer.setMaxThreadCount(1);
+        writer.setExpiryTimeout(-1);
+        reader.setMaxThreadCount(DEFAULT_READER_THREAD_COUNT);
+        reader.setExpiryTimeout(-1);
+    }
+
+    void readStarted()
+    {
+        QMutexLocker locker(&mutex);
+        ++statistics.reads;
+        ++statistics.activeReads;
+        statistics.peakActiveReads = qMax(statistics.peakActiveReads, statistics.activeReads);
+        if (activeWrites > 0) {
+            ++statistics.readsDuringWrite;
+        }
+    }
+
+    void readFinished()
+    {
+        QMutexLocker locker(&mutex);
+        --statistics.activeReads;
+    }
+
+    void writeStarted()
+    {
+        QMutexLocker locker(&mutex);
+        ++activeWrites;
+    }
+
+    void writeFinished()
+    {
+        QMutexLocker locker(&mutex);
+        --activeWrites;
+    }
+
+    void connectionOpened()
+    {
+        QMutexLocker locker(&mutex);
+        ++statistics.connections;
+    }
+
+    bool groupCommitEnabled()
+    {
+        QMutexLocker locker(&mutex);
+        return groupCommitLatency > 0;
+    }
+
+    void queueGroupWrite(AbstractSocialCacheDatabasePrivate *d)
+    {
+        QMutexLocker locker(&mutex);
+
+        groupWrites.append(d);
+        if (!groupWriterRunning) {
+            groupWriterRunning = true;
+            writer.start(&groupWriter);
+        } else {
+            groupCondition.wakeOne();
+        }
+    }
+
+    QThreadPool writer;
+    QThreadPool reader;
+
+    GroupWriter groupWriter;
+    QWaitCondition groupCondition;
+    QList<AbstractSocialCacheDatabasePrivate *> groupWrites;
+    int groupCommitLatency;
+    int groupCommitBatchSize;
+    bool groupWriterRunning;
+
+    QMutex mutex;
+    AbstractSocialCacheDatabase::ReaderStatistics statistics;
+    int activeWrites;
+};
+
+class DatabaseThreadRegistry
+{
+public:
+    ~DatabaseThreadRegistry()
+    {
+        qDeleteAll(threads);
+    }
+
+    DatabaseThreads *threadsForFile(const QString &filePath)
+    {
+        QMutexLocker locker(&mutex);
+
+        DatabaseThreads *&fileThreads = threads[filePath];
+        if (!fileThreads) {
+            fileThreads = new DatabaseThreads;
+        }
+        return fileThreads;
+    }
+
+private:
+    QMutex mutex;
+    QHash<QString, DatabaseThreads *> threads;
+};
+
+Q_GLOBAL_STATIC(DatabaseThreadRegistry, databaseThreadRegistry)
+
+DatabaseThreads *threadsForFile(const QString &filePath)
+{
+    return databaseThreadRegistry()->threadsForFile(filePath);
+}
+
+void GroupWriter::run()
+{
+    QMutexLocker locker(&threads->mutex);
+
+    while (!threads->groupWrites.isEmpty()) {
+        // Give the writes queued shortly after the first one a chance to join it.
+        QElapsedTimer timer;
+        timer.start();
+        for (qint64 remaining = threads->groupCommitLatency;
+                remaining > 0 && threads->groupWrites.count() < threads->groupCommitBatchSize;
+                remaining = threads->groupCommitLatency - timer.elapsed()) {
+            threads->groupCondition.wait(&threads->mutex, static_cast<unsigned long>(remaining));
+        }
+
+        const QList<AbstractSocialCacheDatabasePrivate *> batch
+                = threads->groupWrites.mid(0, threads->groupCommitBatchSize);
+        threads->groupWrites = threads->groupWrites.mid(batch.count());
+
+        ++threads->activeWrites;
+        locker.unlock();
+
+        AbstractSocialCacheDatabasePrivate::commitGroup(batch);
+
+        locker.relock();
+        --threads->activeWrites;
+        locker.unlock();
+
+        Q_FOREACH (AbstractSocialCacheDatabasePrivate *d, batch) {
+            QMutexLocker databaseLocker(&d->mutex);
+
+            if (d->asyncWriteStatus == AbstractSocialCacheDatabasePrivate::Queued) {
+                // Written to again while committing, it joins the next group.
+                threads->queueGroupWrite(d);
+            } else if (d->maintenanceQueued) {
+                threads->writer.start(&d->writeTask);
+            } else {
+                d->writeRunning = false;
+            }
+            d->tasksFinished();
+        }
+
+        locker.relock();
+    }
+
+    threads->groupWriterRunning = false;
+}
+}
+
+AbstractSocialCacheDatabasePrivate::Task::Task(AbstractSocialCacheDatabasePrivate *d, Type type)
+    : d(d)
+    , type(type)
+{
+    setAutoDelete(false);
+}
+
+void AbstractSocialCacheDatabasePrivate::Task::run()
+{
+    if (type == Write) {
+        d->runWrites();
+    } else {
+        d->runReads();
+    }
 }
 
 AbstractSocialCacheDatabasePrivate::AbstractSocialCacheDatabasePrivate(
@@ -89,7 +375,19 @@ AbstractSocialCacheDatabasePrivate::AbstractSocialCacheDatabasePrivate(
     , writeStatus(AbstractSocialCacheDatabase::Null)
     , asyncReadStatus(Null)
     , asyncWriteStatus(Null)
+    , executionMode(AbstractSocialCacheDatabase::GlobalThreadPool)
+    , preparedQueryCacheSize(DEFAULT_PREPARED_QUERY_CACHE_SIZE)
+    , maintenanceInterval(DEFAULT_MAINTENANCE_INTERVAL)
+    , maintenancePageLimit(DEFAULT_MAINTENANCE_PAGE_LIMIT)
+    , maintenanceNeeded(false)
+    , maintenanceQueued(false)
+    , fileRemovalsPending(true)
+    , readTask(this, Task::Read)
+    , writeTask(this, Task::Write)
     , running(false)
+    , readRunning(false)
+    , writeRunning(false)
+    , pendingQueries(0)
 {
     setAutoDelete(false);
 }
@@ -108,8 +406,8 @@ bool AbstractSocialCacheDatabasePrivate::initializeThreadData(ThreadData *thread
     const QString connectionName = QString(QLatin1String("socialcache/%1/%2/%3")).arg(
                 serviceName, dataType, uuid.toString());
 
-    threadData->mutex = new ProcessMutex(connectionName);
-    if (!threadData->mutex->lock()) {
+    threadData->mutex = new ProcessMutex(filePath);
+    if (!threadData->mutex->lock(LOCK_TIMEOUT)) {
         qWarning() << Q_FUNC_INFO << "Error: unable to acquire mutex lock during database initialisation";
         delete threadData->mutex;
         threadData->mutex = 0;
@@ -140,6 +438,8 @@ bool AbstractSocialCacheDatabasePrivate::initializeThreadData(ThreadData *thread
     // open the database in which we store our synced image information
     threadData->database = QSqlDatabase::addDatabase("QSQLITE", connectionName);
     threadData->database.setDatabaseName(filePath);
+    threadData->database.setConnectOptions(QString(QLatin1String("QSQLITE_BUSY_TIMEOUT=%1")).arg(
+                tuningProfile.busyTimeout));
 
     if (!threadData->database.open()) {
         qWarning() << Q_FUNC_INFO << "Unable to open database" << filePath << "Service"
@@ -149,9 +449,36 @@ bool AbstractSocialCacheDatabasePrivate::initializeThreadData(ThreadData *thread
 
     QSqlQuery query(threadData->database);
 
+    // The page size of a WAL database can not be changed, and auto vacuum can
+    // only be enabled before the first table is created, so they are set first
+    if (createTables) {
+        if (tuningProfile.pageSize > 0) {
+            query.exec(QString(QLatin1String("PRAGMA page_size = %1")).arg(tuningProfile.pageSize));
+        }
+        query.exec(QStringLiteral("PRAGMA auto_vacuum = INCREMENTAL"));
+    }
+
     query.exec(QStringLiteral("PRAGMA temp_store = MEMORY;"));
     query.exec(QStringLiteral("PRAGMA journal_mode = WAL;"));
 
+    if (tuningProfile.cacheSize > 0) {
+        // Negative values are in KiB instead of pages
+        query.exec(QString(QLatin1String("PRAGMA cache_size = -%1")).arg(tuningProfile.cacheSize));
+    }
+    if (tuningProfile.mmapSize > 0) {
+        query.exec(QString(QLatin1String("PRAGMA mmap_size = %1")).arg(tuningProfile.mmapSize));
+    }
+    switch (tuningProfile.synchronous) {
+    case AbstractSocialCacheDatabase::SynchronousOff:
+        query.exec(QStringLiteral("PRAGMA synchronous = OFF"));
+        break;
+    case AbstractSocialCacheDatabase::SynchronousNormal:
+        query.exec(QStringLiteral("PRAGMA synchronous = NORMAL"));
+        break;
+    default:
+        break;
+    }
+
     if (!query.exec(QLatin1String("PRAGMA user_version")) || !query.next()) {
         qWarning() << Q_FUNC_INFO << "Failed to query pragma_user version. Service"
                    << serviceName << "with data type" << dataType << "will be inactive. Error"
@@ -163,7 +490,10 @@ bool AbstractSocialCacheDatabasePrivate::initializeThreadData(ThreadData *thread
     const int databaseVersion = query.value(0).toInt();
     query.finish();
 
-    if (databaseVersion < version) {
+    if (databaseVersion > 0 && databaseVersion < version
+            && upgradeTables(threadData->database, databaseVersion)) {
+        // Tables were upgraded in place
+    } else if (databaseVersion < version) {
         createTables = true;
         qWarning() << Q_FUNC_INFO << "Version required is" << version
                    << "while database is using" << databaseVersion;
@@ -177,102 +507,895 @@ bool AbstractSocialCacheDatabasePrivate::initializeThreadData(ThreadData *thread
         }
     }
 
-    if (createTables) {
-        if (!q->createTables(threadData->database)) {
-            qWarning() << Q_FUNC_INFO << "Failed to update database" << filePath
-                       << "It is probably broken and need to be removed manually";
-            threadData->database.close();
-            return false;
-        } else if (!query.exec(QString(QLatin1String("PRAGMA user_version=%1")).arg(version))) {
-            qWarning()
-                    << Q_FUNC_INFO
-                    << "Failed to set database version"
-                    << filePath
-                    << query.lastError();
-        }
+    if (createTables) {
+        if (!q->createTables(threadData->database)) {
+            qWarning() << Q_FUNC_INFO << "Failed to update database" << filePath
+                       << "It is probably broken and need to be removed manually";
+            threadData->database.close();
+            return false;
+        } else if (!query.exec(QString(QLatin1String("PRAGMA user_version=%1")).arg(version))) {
+            qWarning()
+                    << Q_FUNC_INFO
+                    << "Failed to set database version"
+                    << filePath
+                    << query.lastError();
+        }
+    }
+
+    // Read-only connections are used for reading while another connection
+    // writes, which WAL allows without any locking between them.
+    if (threadData->readOnly) {
+        if (!query.exec(QStringLiteral("PRAGMA query_only = 1"))) {
+            qWarning() << Q_FUNC_INFO << "Failed to make connection read-only" << filePath
+                       << query.lastError();
+        }
+        threadsForFile(filePath)->connectionOpened();
+    }
+
+    processMutexCleanup.finalize();
+
+    return true;
+}
+
+bool AbstractSocialCacheDatabasePrivate::upgradeTables(QSqlDatabase database, int fromVersion) const
+{
+    Q_Q(const AbstractSocialCacheDatabase);
+
+    if (!database.transaction()) {
+        qWarning() << Q_FUNC_INFO << "Failed to start a database transaction" << database.lastError();
+        return false;
+    }
+
+    QElapsedTimer timer;
+    for (int stepVersion = fromVersion; stepVersion < version; ++stepVersion) {
+        timer.start();
+
+        if (!q->upgradeTables(database, stepVersion)) {
+            qWarning() << Q_FUNC_INFO << "Unable to upgrade" << filePath << "from version"
+                       << stepVersion << "to" << stepVersion + 1;
+            database.rollback();
+            return false;
+        }
+
+        qCDebug(lcSocialCacheDatabase) << "Upgraded" << filePath << "from version" << stepVersion
+                                       << "to" << stepVersion + 1 << "in" << timer.elapsed() << "ms";
+    }
+
+    QSqlQuery query(database);
+    if (!query.exec(QString(QLatin1String("PRAGMA user_version=%1")).arg(version))) {
+        qWarning() << Q_FUNC_INFO << "Failed to set database version" << filePath << query.lastError();
+        database.rollback();
+        return false;
+    }
+    query.finish();
+
+    if (!database.commit()) {
+        qWarning() << Q_FUNC_INFO << "Failed to commit database upgrade" << filePath << database.lastError();
+        database.rollback();
+        return false;
+    }
+
+    return true;
+}
+
+// Returns the read-only or the writable connection of the calling thread.
+// A thread opens each of them the first time it uses it.
+AbstractSocialCacheDatabasePrivate::ThreadData *AbstractSocialCacheDatabasePrivate::localThreadData(bool readOnly) const
+{
+    ThreadData &threadData = globalThreadData.localData()[
+            readOnly ? filePath + QLatin1String("#readonly") : filePath];
+
+    if (!threadData.mutex) {
+        threadData.readOnly = readOnly;
+    }
+
+    if (!threadData.mutex && !initializeThreadData(&threadData)) {
+        return 0;
+    }
+    return &threadData;
+}
+
+bool AbstractSocialCacheDatabasePrivate::createSearchTable(
+        QSqlDatabase database, const QString &table, const QString &columns)
+{
+    QSqlQuery query(database);
+    if (!query.exec(QString(QLatin1String("CREATE VIRTUAL TABLE IF NOT EXISTS %1 USING fts5(%2)"))
+                    .arg(table, columns))) {
+        qCDebug(lcSocialCacheDatabase) << "Full text search is not available for" << table
+                                       << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+// Each word of the text has to match the start of a word, whatever the FTS5
+// query syntax would make of it.
+QString AbstractSocialCacheDatabasePrivate::searchExpression(const QString &text)
+{
+    QStringList terms;
+    Q_FOREACH (QString word, text.split(QRegExp(QLatin1String("\\s+")), QString::SkipEmptyParts)) {
+        word.replace(QLatin1Char('"'), QLatin1String("\"\""));
+        terms.append(QLatin1Char('"') + word + QLatin1String("\"*"));
+    }
+    return terms.join(QLatin1Char(' '));
+}
+
+bool AbstractSocialCacheDatabasePrivate::hasTable(const QString &table) const
+{
+    Q_Q(const AbstractSocialCacheDatabase);
+
+    QSqlQuery query = q->prepare(QStringLiteral(
+                "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = :table"));
+    query.bindValue(QStringLiteral(":table"), table);
+    const bool exists = query.exec() && query.next();
+    query.finish();
+    return exists;
+}
+
+bool AbstractSocialCacheDatabasePrivate::createFileRemovalTable(QSqlDatabase database)
+{
+    QSqlQuery query(database);
+    if (!query.exec(QStringLiteral(
+                "CREATE TABLE IF NOT EXISTS pending_file_removals ("
+                "path TEXT PRIMARY KEY)"))) {
+        qWarning() << Q_FUNC_INFO << "Unable to create pending_file_removals table:"
+                   << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+// The time a path was queued at, in milliseconds
+bool AbstractSocialCacheDatabasePrivate::addFileRemovalTimes(QSqlDatabase database)
+{
+    QSqlQuery query(database);
+    if (!query.exec(QStringLiteral(
+                "ALTER TABLE pending_file_removals ADD COLUMN queued INTEGER"))) {
+        qWarning() << Q_FUNC_INFO << "Unable to add queued column:"
+                   << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool AbstractSocialCacheDatabasePrivate::queueFileRemovals(QSqlQuery &query)
+{
+    QVariantList paths;
+    const int columns = query.record().count();
+    while (query.next()) {
+        for (int i = 0; i < columns; ++i) {
+            const QString path = query.value(i).toString();
+            if (!path.isEmpty()) {
+                paths.append(path);
+            }
+        }
+    }
+    query.finish();
+
+    return queueFileRemovals(paths);
+}
+
+bool AbstractSocialCacheDatabasePrivate::queueFileRemovals(const QVariantList &paths)
+{
+    Q_Q(AbstractSocialCacheDatabase);
+
+    if (paths.isEmpty()) {
+        return true;
+    }
+
+    QVariantList queueTimes;
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (int i = 0; i < paths.count(); ++i) {
+        queueTimes.append(now);
+    }
+
+    QSqlQuery insertQuery = q->prepare(QStringLiteral(
+                "INSERT OR REPLACE INTO pending_file_removals (path, queued) "
+                "VALUES (:path, :queued)"));
+    insertQuery.bindValue(QStringLiteral(":path"), paths);
+    insertQuery.bindValue(QStringLiteral(":queued"), queueTimes);
+    if (!insertQuery.execBatch()) {
+        qWarning() << Q_FUNC_INFO << "Failed to queue file removals:"
+                   << insertQuery.lastError().text();
+        return false;
+    }
+    insertQuery.finish();
+
+    QMutexLocker locker(&mutex);
+    fileRemovalsPending = true;
+    return true;
+}
+
+bool AbstractSocialCacheDatabasePrivate::cancelFileRemovals(const QVariantList &paths)
+{
+    Q_Q(AbstractSocialCacheDatabase);
+
+    if (paths.isEmpty()) {
+        return true;
+    }
+
+    QSqlQuery query = q->prepare(QStringLiteral(
+                "DELETE FROM pending_file_removals "
+                "WHERE path = :path"));
+    query.bindValue(QStringLiteral(":path"), paths);
+    if (!query.execBatch()) {
+        qWarning() << Q_FUNC_INFO << "Failed to cancel file removals:"
+                   << query.lastError().text();
+        return false;
+    }
+    query.finish();
+    return true;
+}
+
+// Removes the files queued by committed writes. A batch of paths is claimed
+// under the database lock, and the files are removed without it. The paths
+// are sorted so that the files of a directory are unlinked relative to a
+// single descriptor of it. The queued paths that are still referenced are
+// read with the first batch, so that the referencedFiles query runs once.
+void AbstractSocialCacheDatabasePrivate::removePendingFiles(ThreadData *threadData)
+{
+    QString referencedFilesQuery;
+    {
+        QMutexLocker locker(&mutex);
+        if (!fileRemovalsPending) {
+            return;
+        }
+        fileRemovalsPending = false;
+        referencedFilesQuery = referencedFiles;
+    }
+
+    if (!threadData || threadData->readOnly) {
+        return;
+    }
+
+    QSqlQuery query(threadData->database);
+    if (!query.exec(QStringLiteral(
+                "SELECT 1 FROM sqlite_master "
+                "WHERE type = 'table' AND name = 'pending_file_removals'")) || !query.next()) {
+        return;
+    }
+    query.finish();
+
+    int removedFiles = 0;
+    qint64 reclaimedBytes = 0;
+
+    // Batches start after the last path claimed, as the files written again
+    // are queued back
+    QString lastPath;
+    QSet<QString> referencedPaths;
+    bool referencedPathsRead = referencedFilesQuery.isEmpty();
+
+    for (;;) {
+        if (!threadData->mutex->lock(LOCK_TIMEOUT)) {
+            qWarning() << Q_FUNC_INFO << "Failed to acquire a lock on the database";
+            break;
+        }
+
+        QStringList paths;
+        QList<qint64> queueTimes;
+
+        bool success = threadData->database.transaction();
+        if (success) {
+            query.prepare(QStringLiteral(
+                        "SELECT path, queued FROM pending_file_removals "
+                        "WHERE path > :after "
+                        "ORDER BY path "
+                        "LIMIT :limit"));
+            query.bindValue(QStringLiteral(":after"), lastPath);
+            query.bindValue(QStringLiteral(":limit"), FILE_REMOVAL_BATCH_SIZE);
+            success = query.exec();
+            while (success && query.next()) {
+                paths.append(query.value(0).toString());
+                queueTimes.append(query.value(1).toLongLong());
+            }
+            query.finish();
+        }
+
+        if (success && !paths.isEmpty() && !referencedPathsRead) {
+            query.prepare(QString(QLatin1String(
+                        "SELECT path FROM pending_file_removals "
+                        "WHERE path IN (%1)")).arg(referencedFilesQuery));
+            success = query.exec();
+            while (success && query.next()) {
+                referencedPaths.insert(query.value(0).toString());
+            }
+            query.finish();
+            referencedPathsRead = success;
+        }
+
+        if (success && !paths.isEmpty()) {
+            query.prepare(QStringLiteral(
+                        "DELETE FROM pending_file_removals "
+                        "WHERE path BETWEEN :first AND :last"));
+            query.bindValue(QStringLiteral(":first"), paths.first());
+            query.bindValue(QStringLiteral(":last"), paths.last());
+            success = query.exec();
+            query.finish();
+        }
+
+        if (success && !threadData->database.commit()) {
+            success = false;
+        }
+        if (!success) {
+            qWarning() << Q_FUNC_INFO << "Failed to claim pending file removals:"
+                       << query.lastError().text() << threadData->database.lastError().text();
+            threadData->database.rollback();
+        }
+
+        threadData->mutex->unlock();
+
+        if (!success || paths.isEmpty()) {
+            break;
+        }
+
+        // Files that can not be removed are dropped from the queue too, as
+        // they would be retried after every write otherwise
+        QVariantList rewrittenPaths;
+        QVariantList rewriteTimes;
+        QString directoryPath;
+        int directory = -1;
+        for (int i = 0; i < paths.count(); ++i) {
+            const QString &path = paths.at(i);
+            if (referencedPaths.contains(path)) {
+                continue;
+            }
+
+            const int separator = path.lastIndexOf(QLatin1Char('/'));
+            const QString parent = separator >= 0 ? path.left(separator + 1) : QString();
+            if (parent != directoryPath || directory < 0) {
+                if (directory >= 0) {
+                    ::close(directory);
+                }
+                directoryPath = parent;
+                directory = ::open(QFile::encodeName(parent.isEmpty() ? QStringLiteral(".") : parent)
+                                   .constData(), O_RDONLY | O_DIRECTORY);
+            }
+            if (directory < 0) {
+                continue;
+            }
+
+            const QByteArray name = QFile::encodeName(path.mid(separator + 1));
+            struct stat status;
+            if (::fstatat(directory, name.constData(), &status, AT_SYMLINK_NOFOLLOW) != 0) {
+                continue;
+            }
+
+            // Written again after it was queued, by a download that is not
+            // committed yet. Paths queued without a time are always removed.
+            const qint64 modified = qint64(status.st_mtim.tv_sec) * 1000
+                    + status.st_mtim.tv_nsec / 1000000;
+            if (queueTimes.at(i) > 0 && modified > queueTimes.at(i)) {
+                rewrittenPaths.append(path);
+                rewriteTimes.append(modified);
+                continue;
+            }
+
+            if (::unlinkat(directory, name.constData(), 0) == 0) {
+                ++removedFiles;
+                reclaimedBytes += status.st_size;
+            } else {
+                qWarning() << Q_FUNC_INFO << "Failed to remove" << path << strerror(errno);
+            }
+        }
+        if (directory >= 0) {
+            ::close(directory);
+        }
+
+        // The files written again are queued back as of their last write,
+        // unless the write that wrote them committed a reference to them
+        if (!rewrittenPaths.isEmpty()) {
+            if (!threadData->mutex->lock(LOCK_TIMEOUT)) {
+                qWarning() << Q_FUNC_INFO << "Failed to acquire a lock on the database";
+                break;
+            }
+
+            query.prepare(referencedFilesQuery.isEmpty()
+                    ? QStringLiteral(
+                        "INSERT OR IGNORE INTO pending_file_removals (path, queued) "
+                        "VALUES (:path, :queued)")
+                    : QString(QLatin1String(
+                        "INSERT OR IGNORE INTO pending_file_removals (path, queued) "
+                        "SELECT path, :queued FROM (SELECT :path AS path) "
+                        "WHERE path NOT IN (%1)")).arg(referencedFilesQuery));
+            query.bindValue(QStringLiteral(":queued"), rewriteTimes);
+            query.bindValue(QStringLiteral(":path"), rewrittenPaths);
+            if (!query.execBatch()) {
+                qWarning() << Q_FUNC_INFO << "Failed to queue rewritten files again:"
+                           << query.lastError().text();
+            }
+            query.finish();
+
+            threadData->mutex->unlock();
+        }
+
+        lastPath = paths.last();
+        if (paths.count() < FILE_REMOVAL_BATCH_SIZE) {
+            break;
+        }
+    }
+
+    QMutexLocker locker(&mutex);
+    fileRemovalStatistics.removedFiles += removedFiles;
+    fileRemovalStatistics.reclaimedBytes += reclaimedBytes;
+}
+
+QByteArray AbstractSocialCacheDatabasePrivate::contentHash(const QVariantList &values)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << values;
+    return QCryptographicHash::hash(data, QCryptographicHash::Md5);
+}
+
+QSet<QString> AbstractSocialCacheDatabasePrivate::unchangedRows(
+        const QString &table, const QString &keyColumn, const QHash<QString, QByteArray> &hashes)
+{
+    Q_Q(AbstractSocialCacheDatabase);
+
+    QSet<QString> unchanged;
+    if (hashes.isEmpty()) {
+        return unchanged;
+    }
+
+    QSqlQuery query = q->prepare(QString(QLatin1String(
+                "SELECT contentHash FROM %1 WHERE %2 = :key")).arg(table, keyColumn));
+    for (QHash<QString, QByteArray>::const_iterator it = hashes.begin(); it != hashes.end(); ++it) {
+        query.bindValue(QStringLiteral(":key"), it.key());
+        if (query.exec() && query.next() && query.value(0).toByteArray() == it.value()) {
+            unchanged.insert(it.key());
+        }
+        query.finish();
+    }
+
+    QMutexLocker locker(&mutex);
+    transactionStatistics.unchangedRows += unchanged.count();
+    return unchanged;
+}
+
+QList<AbstractSocialCacheDatabase::SearchResult> AbstractSocialCacheDatabasePrivate::search(
+        const QString &table, const QString &text, int limit) const
+{
+    Q_Q(const AbstractSocialCacheDatabase);
+
+    QList<AbstractSocialCacheDatabase::SearchResult> results;
+    const QString expression = searchExpression(text);
+    if (expression.isEmpty() || !hasTable(table)) {
+        return results;
+    }
+
+    // rank is the bm25() of the match, which is lower for better matches
+    QSqlQuery query = q->prepare(QString(QLatin1String(
+                "SELECT identifier, snippet(%1, -1, '<b>', '</b>', '...', 12), rank "
+                "FROM %1 WHERE %1 MATCH :expression "
+                "ORDER BY rank LIMIT :limit")).arg(table));
+    query.bindValue(QStringLiteral(":expression"), expression);
+    query.bindValue(QStringLiteral(":limit"), limit > 0 ? limit : -1);
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to search" << table << query.lastError();
+        return results;
+    }
+
+    while (query.next()) {
+        AbstractSocialCacheDatabase::SearchResult result;
+        result.identifier = query.value(0).toString();
+        result.snippet = query.value(1).toString();
+        result.score = -query.value(2).toDouble();
+        results.append(result);
+    }
+    query.finish();
+    return results;
+}
+
+QThreadPool *AbstractSocialCacheDatabasePrivate::writerThreadPool() const
+{
+    return &threadsForFile(filePath)->writer;
+}
+
+QThreadPool *AbstractSocialCacheDatabasePrivate::readerThreadPool() const
+{
+    return &threadsForFile(filePath)->reader;
+}
+
+// Runs the write() of each database in a single transaction. With several
+// databases each write runs in its own savepoint, so that a failing write
+// is rolled back without affecting the other ones.
+QList<bool> AbstractSocialCacheDatabasePrivate::executeWrites(
+        ThreadData *threadData, const QList<AbstractSocialCacheDatabasePrivate *> &writers,
+        WriteTimings *timings)
+{
+    QList<bool> results;
+
+    if (!threadData) {
+        qWarning() << Q_FUNC_INFO << "No database connection available";
+        return results;
+    } else if (threadData->readOnly) {
+        qWarning() << Q_FUNC_INFO << "Cannot write using a read-only connection";
+        return results;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const int contentionCount = threadData->mutex->contentionCount();
+    const bool locked = threadData->mutex->lock(LOCK_TIMEOUT);
+
+    timings->lockWait = timer.nsecsElapsed() / 1000;
+    timings->contended = threadData->mutex->contentionCount() != contentionCount;
+
+    if (!locked) {
+        qWarning() << Q_FUNC_INFO << "Failed to acquire a lock on the database";
+        return results;
+    }
+
+    timer.restart();
+
+    if (!threadData->database.transaction()) {
+        qWarning() << Q_FUNC_INFO << "Failed to start a database transaction";
+    } else if (writers.count() == 1) {
+        const bool success = writers.first()->q_func()->write();
+
+        timings->transaction = timer.nsecsElapsed() / 1000;
+        timer.restart();
+
+        if (!success) {
+            threadData->database.rollback();
+            results.append(false);
+        } else if (!threadData->database.commit()) {
+            qWarning() << Q_FUNC_INFO << "Failed to commit a database transaction";
+            qWarning() << threadData->database.lastError();
+            threadData->database.rollback();
+            results.append(false);
+        } else {
+            results.append(true);
+        }
+
+        timings->commit = timer.nsecsElapsed() / 1000;
+    } else {
+        QSqlQuery query(threadData->database);
+
+        timings->grouped = true;
+
+        Q_FOREACH (AbstractSocialCacheDatabasePrivate *d, writers) {
+            bool success = query.exec(QStringLiteral("SAVEPOINT group_write"));
+            if (!success) {
+                qWarning() << Q_FUNC_INFO << "Failed to create a savepoint" << query.lastError();
+            } else {
+                success = d->q_func()->write();
+                if (!success) {
+                    query.exec(QStringLiteral("ROLLBACK TO group_write"));
+                }
+                query.exec(QStringLiteral("RELEASE group_write"));
+            }
+            results.append(success);
+        }
+        query.finish();
+
+        timings->transaction = timer.nsecsElapsed() / 1000;
+        timer.restart();
+
+        if (!threadData->database.commit()) {
+            qWarning() << Q_FUNC_INFO << "Failed to commit a database transaction";
+            qWarning() << threadData->database.lastError();
+            threadData->database.rollback();
+            results.clear();
+        }
+
+        timings->commit = timer.nsecsElapsed() / 1000;
+    }
+
+    threadData->mutex->unlock();
+
+    return results;
+}
+
+// Records the timings of a write. Called with the mutex locked.
+void AbstractSocialCacheDatabasePrivate::recordWrite(qint64 queueDelay, const WriteTimings &timings)
+{
+    recordLatency(&transactionStatistics.queueDelay, queueDelay);
+    recordLatency(&transactionStatistics.lockWait, timings.lockWait);
+    recordLatency(&transactionStatistics.transaction, timings.transaction);
+    recordLatency(&transactionStatistics.commit, timings.commit);
+    if (timings.contended) {
+        ++transactionStatistics.lockContentions;
+    }
+    if (timings.grouped) {
+        ++transactionStatistics.groupedWrites;
+    }
+}
+
+// Executes the queued writes of databases using the same file in a single transaction.
+void AbstractSocialCacheDatabasePrivate::commitGroup(const QList<AbstractSocialCacheDatabasePrivate *> &batch)
+{
+    QList<AbstractSocialCacheDatabasePrivate *> writers;
+    QList<qint64> queueDelays;
+    Q_FOREACH (AbstractSocialCacheDatabasePrivate *d, batch) {
+        QMutexLocker locker(&d->mutex);
+
+        if (d->asyncWriteStatus != Queued) {
+            continue;
+        } else if (d->writeStatus == AbstractSocialCacheDatabase::Null) {
+            d->asyncWriteStatus = Null;
+        } else {
+            d->asyncWriteStatus = Executing;
+            writers.append(d);
+            queueDelays.append(d->writeQueueTimer.nsecsElapsed() / 1000);
+        }
+    }
+
+    if (writers.isEmpty()) {
+        return;
+    }
+
+    WriteTimings timings;
+    ThreadData *threadData = writers.first()->localThreadData(false);
+    ActiveConnection activeConnection(writers.first()->filePath, threadData);
+    const QList<bool> results = executeWrites(threadData, writers, &timings);
+
+    for (int i = 0; i < writers.count(); ++i) {
+        if (results.value(i)) {
+            writers.at(i)->removePendingFiles(threadData);
+            writers.at(i)->q_func()->writeCommitted();
+        }
+    }
+
+    for (int i = 0; i < writers.count(); ++i) {
+        AbstractSocialCacheDatabasePrivate *d = writers.at(i);
+        QMutexLocker locker(&d->mutex);
+
+        d->recordWrite(queueDelays.at(i), timings);
+        d->maintenanceNeeded = true;
+        if (d->asyncWriteStatus == Executing) {
+            d->asyncWriteStatus = results.value(i) ? Finished : Error;
+        }
+    }
+}
+
+// Executes the queued write. The mutex is locked on entry and on return.
+void AbstractSocialCacheDatabasePrivate::performWrite(ThreadData *threadData, QMutexLocker &locker)
+{
+    asyncWriteStatus = Executing;
+
+    const qint64 queueDelay = writeQueueTimer.nsecsElapsed() / 1000;
+
+    locker.unlock();
+
+    WriteTimings timings;
+    const bool success = executeWrites(
+                threadData, QList<AbstractSocialCacheDatabasePrivate *>() << this, &timings).value(0);
+
+    if (success) {
+        removePendingFiles(threadData);
+        q_func()->writeCommitted();
     }
 
-    processMutexCleanup.finalize();
+    locker.relock();
 
-    return true;
+    recordWrite(queueDelay, timings);
+    maintenanceNeeded = true;
+
+    if (asyncWriteStatus == Executing) {
+        asyncWriteStatus = success ? Finished : Error;
+    }
 }
 
-void AbstractSocialCacheDatabasePrivate::run()
+// Executes the queued read. The mutex is locked on entry and on return.
+void AbstractSocialCacheDatabasePrivate::performRead(ThreadData *threadData, QMutexLocker &locker)
 {
     Q_Q(AbstractSocialCacheDatabase);
 
-    ThreadData &threadData = globalThreadData.localData()[filePath];
+    asyncReadStatus = Executing;
 
-    if (!threadData.mutex && !initializeThreadData(&threadData)) {
-        return;
+    locker.unlock();
+
+    bool success = false;
+
+    if (!threadData) {
+        qWarning() << Q_FUNC_INFO << "No database connection available";
+    } else {
+        success = q->read();
     }
 
-    QMutexLocker locker(&mutex);
-    for (;;) {
-        if (asyncWriteStatus == Queued) {
-            if (writeStatus == AbstractSocialCacheDatabase::Null) {
-                asyncWriteStatus = Null;
-                continue;
-            }
+    locker.relock();
 
-            asyncWriteStatus = Executing;
+    if (asyncReadStatus == Executing) {
+        asyncReadStatus = success ? Finished : Error;
+    }
+}
 
-            locker.unlock();
+// Reclaims free pages and checkpoints the WAL. The mutex is locked on entry and on return.
+void AbstractSocialCacheDatabasePrivate::performMaintenance(ThreadData *threadData, QMutexLocker &locker)
+{
+    maintenanceQueued = false;
+    maintenanceNeeded = false;
 
-            if (!threadData.mutex->lock()) {
-                // Warning
-                qWarning() << Q_FUNC_INFO << "Failed to acquire a lock on the database";
-                locker.relock();
-                break;
-            }
+    const int pageLimit = maintenancePageLimit;
 
-            if (!threadData.database.transaction()) {
-                qWarning() << Q_FUNC_INFO << "Failed to start a database transaction";
+    locker.unlock();
 
-                threadData.mutex->unlock();
-                locker.relock();
-                break;
-            }
+    QElapsedTimer timer;
+    timer.start();
+
+    int pagesReclaimed = 0;
+    int checkpointedFrames = 0;
+    bool truncated = false;
 
-            bool success = q->write();
+    if (!threadData) {
+        qWarning() << Q_FUNC_INFO << "No database connection available";
+    } else if (threadData->readOnly) {
+        qWarning() << Q_FUNC_INFO << "Cannot run maintenance using a read-only connection";
+    } else if (!threadData->mutex->lock(LOCK_TIMEOUT)) {
+        qWarning() << Q_FUNC_INFO << "Failed to acquire a lock on the database";
+    } else {
+        QSqlQuery query(threadData->database);
+
+        const int freePages = pragmaValue(query, QStringLiteral("PRAGMA freelist_count"));
+        if (freePages > 0 && pageLimit > 0 && threadData->database.transaction()) {
+            // Incremental vacuum frees a page per step, and QSqlQuery steps a
+            // statement without result columns only once.
+            QSqlQuery vacuumQuery(threadData->database);
+            vacuumQuery.prepare(QStringLiteral("PRAGMA incremental_vacuum(1)"));
+
+            bool success = true;
+            for (int i = 0; success && i < qMin(freePages, pageLimit); ++i) {
+                success = vacuumQuery.exec();
+                vacuumQuery.finish();
+            }
 
             if (!success) {
-                threadData.database.rollback();
-            } else if (!threadData.database.commit()) {
-                qWarning() << Q_FUNC_INFO << "Failed to commit a database transaction";
-                qWarning() << threadData.database.lastError();
-                success = false;
+                qWarning() << Q_FUNC_INFO << "Failed to vacuum" << filePath << vacuumQuery.lastError();
+                threadData->database.rollback();
+            } else if (!threadData->database.commit()) {
+                qWarning() << Q_FUNC_INFO << "Failed to commit vacuum" << filePath
+                           << threadData->database.lastError();
+                threadData->database.rollback();
+            }
+
+            const int remainingPages = pragmaValue(query, QStringLiteral("PRAGMA freelist_count"));
+            if (remainingPages >= 0) {
+                pagesReclaimed = freePages - remainingPages;
+            }
+        }
+
+        if (query.exec(QStringLiteral("PRAGMA wal_checkpoint(PASSIVE)")) && query.next()) {
+            const bool busy = query.value(0).toInt() != 0;
+            const int frames = query.value(1).toInt();
+            checkpointedFrames = qMax(0, query.value(2).toInt());
+            query.finish();
+
+            // Nothing is left in the WAL, so it can be reset. TRUNCATE waits
+            // for the readers still in the WAL with the busy handler, which
+            // would stall all writers, so it is disabled to fail instead.
+            if (!busy && frames > 0 && checkpointedFrames == frames) {
+                const int busyTimeout = pragmaValue(query, QStringLiteral("PRAGMA busy_timeout"));
+                query.exec(QStringLiteral("PRAGMA busy_timeout = 0"));
+                if (query.exec(QStringLiteral("PRAGMA wal_checkpoint(TRUNCATE)")) && query.next()) {
+                    truncated = query.value(0).toInt() == 0;
+                }
+                query.finish();
+                if (busyTimeout >= 0) {
+                    query.exec(QString(QLatin1String("PRAGMA busy_timeout = %1")).arg(busyTimeout));
+                }
             }
+        } else {
+            qWarning() << Q_FUNC_INFO << "Failed to checkpoint" << filePath << query.lastError();
+        }
+        query.finish();
+
+        threadData->mutex->unlock();
+    }
+
+    const qint64 time = timer.nsecsElapsed() / 1000;
 
-            threadData.mutex->unlock();
-            locker.relock();
+    locker.relock();
 
-            if (asyncWriteStatus == Executing) {
-                asyncWriteStatus = success ? Finished : Error;
+    maintenanceStatistics.runs += 1;
+    maintenanceStatistics.pagesReclaimed += pagesReclaimed;
+    maintenanceStatistics.checkpointedFrames += checkpointedFrames;
+    maintenanceStatistics.time += time;
+    if (truncated) {
+        maintenanceStatistics.truncations += 1;
+    }
+
+    qCDebug(lcSocialCacheDatabase) << "Maintenance of" << filePath << "reclaimed" << pagesReclaimed
+                                   << "pages and checkpointed" << checkpointedFrames << "frames in"
+                                   << time << "us";
+}
+
+// Notifies the database and any waiting thread. Called with the mutex locked.
+void AbstractSocialCacheDatabasePrivate::tasksFinished()
+{
+    Q_Q(AbstractSocialCacheDatabase);
+
+    QCoreApplication::postEvent(q, new QEvent(QEvent::UpdateRequest));
+    condition.wakeAll();
+}
+
+void AbstractSocialCacheDatabasePrivate::queryFinished() const
+{
+    QMutexLocker locker(&mutex);
+
+    --pendingQueries;
+    condition.wakeAll();
+}
+
+void AbstractSocialCacheDatabasePrivate::run()
+{
+    ThreadData *threadData = localThreadData(false);
+    ActiveConnection activeConnection(filePath, threadData);
+
+    QMutexLocker locker(&mutex);
+    for (;;) {
+        if (asyncWriteStatus == Queued) {
+            if (writeStatus == AbstractSocialCacheDatabase::Null) {
+                asyncWriteStatus = Null;
+            } else {
+                performWrite(threadData, locker);
             }
         } else if (asyncReadStatus == Queued) {
             if (readStatus == AbstractSocialCacheDatabase::Null) {
                 asyncReadStatus = Null;
-                continue;
+            } else {
+                performRead(threadData, locker);
             }
-            asyncReadStatus = Executing;
+        } else if (maintenanceQueued) {
+            performMaintenance(threadData, locker);
+        } else {
+            running = false;
+            tasksFinished();
+            return;
+        }
+    }
+}
+
+void AbstractSocialCacheDatabasePrivate::runWrites()
+{
+    DatabaseThreads *threads = threadsForFile(filePath);
+    ThreadData *threadData = localThreadData(false);
+    ActiveConnection activeConnection(filePath, threadData);
 
-            locker.unlock();
+    QMutexLocker locker(&mutex);
+    for (;;) {
+        if (asyncWriteStatus == Queued) {
+            if (writeStatus == AbstractSocialCacheDatabase::Null) {
+                asyncWriteStatus = Null;
+            } else {
+                threads->writeStarted();
+                performWrite(threadData, locker);
+                threads->writeFinished();
+            }
+        } else if (maintenanceQueued) {
+            threads->writeStarted();
+            performMaintenance(threadData, locker);
+            threads->writeFinished();
+        } else {
+            break;
+        }
+    }
 
-            bool success = q->read();
+    writeRunning = false;
+    tasksFinished();
+}
 
-            locker.relock();
+void AbstractSocialCacheDatabasePrivate::runReads()
+{
+    DatabaseThreads *threads = threadsForFile(filePath);
+    ThreadData *threadData = localThreadData(true);
+    ActiveConnection activeConnection(filePath, threadData);
 
-            if (asyncReadStatus == Executing) {
-                asyncReadStatus = success ? Finished : Error;
-            }
+    QMutexLocker locker(&mutex);
+    while (asyncReadStatus == Queued) {
+        if (readStatus == AbstractSocialCacheDatabase::Null) {
+            asyncReadStatus = Null;
         } else {
-            running = false;
-            QCoreApplication::postEvent(q, new QEvent(QEvent::UpdateRequest));
-            condition.wakeOne();
-            return;
+            threads->readStarted();
+            performRead(threadData, locker);
+            threads->readFinished();
         }
     }
+
+    readRunning = false;
+    tasksFinished();
 }
 
 AbstractSocialCacheDatabase::AbstractSocialCacheDatabase(
@@ -319,6 +1442,237 @@ AbstractSocialCacheDatabase::Status AbstractSocialCacheDatabase::writeStatus() c
     return d_func()->writeStatus;
 }
 
+AbstractSocialCacheDatabase::TuningProfile AbstractSocialCacheDatabase::TuningProfile::preset(
+        TuningPreset preset)
+{
+    TuningProfile profile;
+
+    switch (preset) {
+    case SmallTuning:
+        profile.cacheSize = 256;
+        profile.synchronous = SynchronousNormal;
+        profile.pageSize = 1024;
+        break;
+    case ReadMostlyTuning:
+        profile.cacheSize = 4096;
+        profile.mmapSize = 32 * 1024 * 1024;
+        profile.synchronous = SynchronousNormal;
+        profile.pageSize = 4096;
+        break;
+    default:
+        break;
+    }
+
+    return profile;
+}
+
+AbstractSocialCacheDatabase::TuningProfile AbstractSocialCacheDatabase::tuningProfile() const
+{
+    return d_func()->tuningProfile;
+}
+
+void AbstractSocialCacheDatabase::setTuningProfile(const TuningProfile &profile)
+{
+    Q_D(AbstractSocialCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->tuningProfile = profile;
+}
+
+AbstractSocialCacheDatabase::ExecutionMode AbstractSocialCacheDatabase::executionMode() const
+{
+    return d_func()->executionMode;
+}
+
+void AbstractSocialCacheDatabase::setExecutionMode(ExecutionMode mode)
+{
+    Q_D(AbstractSocialCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->executionMode = mode;
+}
+
+int AbstractSocialCacheDatabase::readerThreadCount() const
+{
+    return d_func()->readerThreadPool()->maxThreadCount();
+}
+
+void AbstractSocialCacheDatabase::setReaderThreadCount(int count)
+{
+    d_func()->readerThreadPool()->setMaxThreadCount(qMax(1, count));
+}
+
+int AbstractSocialCacheDatabase::groupCommitLatency() const
+{
+    DatabaseThreads *threads = threadsForFile(d_func()->filePath);
+    QMutexLocker locker(&threads->mutex);
+
+    return threads->groupCommitLatency;
+}
+
+int AbstractSocialCacheDatabase::groupCommitBatchSize() const
+{
+    DatabaseThreads *threads = threadsForFile(d_func()->filePath);
+    QMutexLocker locker(&threads->mutex);
+
+    return threads->groupCommitBatchSize;
+}
+
+void AbstractSocialCacheDatabase::setGroupCommit(int latency, int maximumBatchSize)
+{
+    DatabaseThreads *threads = threadsForFile(d_func()->filePath);
+    QMutexLocker locker(&threads->mutex);
+
+    threads->groupCommitLatency = qMax(0, latency);
+    threads->groupCommitBatchSize = qMax(1, maximumBatchSize);
+}
+
+int AbstractSocialCacheDatabase::preparedQueryCacheSize() const
+{
+    return d_func()->preparedQueryCacheSize;
+}
+
+void AbstractSocialCacheDatabase::setPreparedQueryCacheSize(int size)
+{
+    Q_D(AbstractSocialCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->preparedQueryCacheSize = qMax(1, size);
+}
+
+AbstractSocialCacheDatabase::PreparedQueryStatistics AbstractSocialCacheDatabase::preparedQueryStatistics() const
+{
+    Q_D(const AbstractSocialCacheDatabase);
+
+    PreparedQueryStatistics statistics;
+    statistics.hits = d->preparedQueryHits.load();
+    statistics.misses = d->preparedQueryMisses.load();
+    statistics.evictions = d->preparedQueryEvictions.load();
+    return statistics;
+}
+
+AbstractSocialCacheDatabase::TransactionStatistics AbstractSocialCacheDatabase::transactionStatistics() const
+{
+    Q_D(const AbstractSocialCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    return d->transactionStatistics;
+}
+
+void AbstractSocialCacheDatabase::resetTransactionStatistics()
+{
+    Q_D(AbstractSocialCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->transactionStatistics = TransactionStatistics();
+}
+
+void AbstractSocialCacheDatabase::dumpStatistics() const
+{
+    Q_D(const AbstractSocialCacheDatabase);
+
+    if (!lcSocialCacheDatabase().isDebugEnabled()) {
+        return;
+    }
+
+    const TransactionStatistics transactions = transactionStatistics();
+    const PreparedQueryStatistics preparedQueries = preparedQueryStatistics();
+    const ReaderStatistics readers = readerStatistics();
+    const MaintenanceStatistics maintenance = maintenanceStatistics();
+    const FileRemovalStatistics fileRemovals = fileRemovalStatistics();
+
+    qCDebug(lcSocialCacheDatabase) << "Statistics of" << d->serviceName << d->dataType << d->filePath;
+    qCDebug(lcSocialCacheDatabase) << "  writes, in microseconds, lock contentions"
+                                   << transactions.lockContentions
+                                   << "grouped writes" << transactions.groupedWrites
+                                   << "unchanged rows" << transactions.unchangedRows;
+    dumpLatency("queue delay", transactions.queueDelay);
+    dumpLatency("lock wait  ", transactions.lockWait);
+    dumpLatency("transaction", transactions.transaction);
+    dumpLatency("commit     ", transactions.commit);
+    qCDebug(lcSocialCacheDatabase) << "  prepared queries: hits" << preparedQueries.hits
+                                   << "misses" << preparedQueries.misses
+                                   << "evictions" << preparedQueries.evictions;
+    qCDebug(lcSocialCacheDatabase) << "  maintenance: runs" << maintenance.runs
+                                   << "pages reclaimed" << maintenance.pagesReclaimed
+                                   << "frames checkpointed" << maintenance.checkpointedFrames
+                                   << "truncations" << maintenance.truncations
+                                   << "time" << maintenance.time;
+    qCDebug(lcSocialCacheDatabase) << "  file removals: files" << fileRemovals.removedFiles
+                                   << "bytes" << fileRemovals.reclaimedBytes;
+    qCDebug(lcSocialCacheDatabase) << "  reader pool: connections" << readers.connections
+                                   << "reads" << readers.reads
+                                   << "peak" << readers.peakActiveReads
+                                   << "during write" << readers.readsDuringWrite;
+}
+
+int AbstractSocialCacheDatabase::maintenanceInterval() const
+{
+    return d_func()->maintenanceInterval;
+}
+
+int AbstractSocialCacheDatabase::maintenancePageLimit() const
+{
+    return d_func()->maintenancePageLimit;
+}
+
+void AbstractSocialCacheDatabase::setMaintenance(int idleInterval, int maximumPages)
+{
+    Q_D(AbstractSocialCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->maintenanceInterval = qMax(0, idleInterval);
+    d->maintenancePageLimit = qMax(0, maximumPages);
+
+    if (d->maintenanceInterval == 0) {
+        d->maintenanceTimer.stop();
+    }
+}
+
+void AbstractSocialCacheDatabase::runMaintenance()
+{
+    Q_D(AbstractSocialCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->maintenanceTimer.stop();
+    d->maintenanceQueued = true;
+
+    // Maintenance runs on the thread writing the database, after the queued writes
+    if (d->executionMode == DedicatedThreads) {
+        if (!d->writeRunning) {
+            d->writeRunning = true;
+            d->writerThreadPool()->start(&d->writeTask);
+        }
+    } else if (!d->running) {
+        d->running = true;
+        QThreadPool::globalInstance()->start(d);
+    }
+}
+
+AbstractSocialCacheDatabase::MaintenanceStatistics AbstractSocialCacheDatabase::maintenanceStatistics() const
+{
+    Q_D(const AbstractSocialCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    return d->maintenanceStatistics;
+}
+
+AbstractSocialCacheDatabase::FileRemovalStatistics AbstractSocialCacheDatabase::fileRemovalStatistics() const
+{
+    Q_D(const AbstractSocialCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    return d->fileRemovalStatistics;
+}
+
+AbstractSocialCacheDatabase::ReaderStatistics AbstractSocialCacheDatabase::readerStatistics() const
+{
+    DatabaseThreads *threads = threadsForFile(d_func()->filePath);
+    QMutexLocker locker(&threads->mutex);
+
+    return threads->statistics;
+}
+
 bool AbstractSocialCacheDatabase::event(QEvent *event)
 {
     if (event->type() == QEvent::UpdateRequest) {
@@ -352,6 +1706,11 @@ bool AbstractSocialCacheDatabase::event(QEvent *event)
             }
         }
 
+        // Any activity postpones the maintenance
+        if (d->maintenanceNeeded && d->maintenanceInterval > 0) {
+            d->maintenanceTimer.start(d->maintenanceInterval, this);
+        }
+
         locker.unlock();
 
         if (readDone) {
@@ -361,6 +1720,10 @@ bool AbstractSocialCacheDatabase::event(QEvent *event)
             writeFinished();
         }
 
+        return true;
+    } else if (event->type() == QEvent::Timer
+            && static_cast<QTimerEvent *>(event)->timerId() == d_func()->maintenanceTimer.timerId()) {
+        runMaintenance();
         return true;
     } else {
         return QObject::event(event);
@@ -375,7 +1738,12 @@ void AbstractSocialCacheDatabase::executeRead()
     d->readStatus = Executing;
     d->asyncReadStatus = AbstractSocialCacheDatabasePrivate::Queued;
 
-    if (!d->running) {
+    if (d->executionMode == DedicatedThreads) {
+        if (!d->readRunning) {
+            d->readRunning = true;
+            d->readerThreadPool()->start(&d->readTask);
+        }
+    } else if (!d->running) {
         d->running = true;
         QThreadPool::globalInstance()->start(d);
     }
@@ -395,9 +1763,23 @@ void AbstractSocialCacheDatabase::executeWrite()
     QMutexLocker locker(&d->mutex);
 
     d->writeStatus = Executing;
+    if (d->asyncWriteStatus != AbstractSocialCacheDatabasePrivate::Queued) {
+        d->writeQueueTimer.start();
+    }
     d->asyncWriteStatus = AbstractSocialCacheDatabasePrivate::Queued;
 
-    if (!d->running) {
+    if (d->executionMode == DedicatedThreads) {
+        if (!d->writeRunning) {
+            d->writeRunning = true;
+
+            DatabaseThreads *threads = threadsForFile(d->filePath);
+            if (threads->groupCommitEnabled()) {
+                threads->queueGroupWrite(d);
+            } else {
+                threads->writer.start(&d->writeTask);
+            }
+        }
+    } else if (!d->running) {
         d->running = true;
         QThreadPool::globalInstance()->start(d);
     }
@@ -411,6 +1793,14 @@ void AbstractSocialCacheDatabase::cancelWrite()
     d->writeStatus = Null;
 }
 
+bool AbstractSocialCacheDatabase::upgradeTables(QSqlDatabase database, int fromVersion) const
+{
+    Q_UNUSED(database);
+    Q_UNUSED(fromVersion);
+
+    return false;
+}
+
 bool AbstractSocialCacheDatabase::read()
 {
     return false;
@@ -429,6 +1819,10 @@ void AbstractSocialCacheDatabase::writeFinished()
 {
 }
 
+void AbstractSocialCacheDatabase::writeCommitted()
+{
+}
+
 void AbstractSocialCacheDatabase::wait()
 {
     Q_D(AbstractSocialCacheDatabase);
@@ -438,7 +1832,7 @@ void AbstractSocialCacheDatabase::wait()
 
     QMutexLocker locker(&d->mutex);
 
-    while (d->running) {
+    while (d->running || d->readRunning || d->writeRunning || d->pendingQueries > 0) {
         d->condition.wait(&d->mutex);
     }
 
@@ -471,26 +1865,53 @@ QSqlQuery AbstractSocialCacheDatabase::prepare(const QString &query) const
 {
     Q_D(const AbstractSocialCacheDatabase);
 
-    AbstractSocialCacheDatabasePrivate::ThreadData &threadData = AbstractSocialCacheDatabasePrivate::globalThreadData.localData()[d->filePath];
-
-    if (!threadData.mutex && ! d_func()->initializeThreadData(&threadData)) {
+    // Reads and writes use the connection they run on. Outside of them this is
+    // used by synchronous getters, which only read and get a read-only
+    // connection in DedicatedThreads mode.
+    AbstractSocialCacheDatabasePrivate::ThreadData *threadData
+            = AbstractSocialCacheDatabasePrivate::activeThreadData.localData().value(d->filePath);
+    if (!threadData) {
+        threadData = d->localThreadData(d->executionMode == DedicatedThreads);
+    }
+    if (!threadData) {
         return QSqlQuery();
     }
 
-    QHash<QString, QSqlQuery>::const_iterator it = threadData.preparedQueries.constFind(query);
-    if (it != threadData.preparedQueries.constEnd()) {
-        return *it;
+    QHash<QString, AbstractSocialCacheDatabasePrivate::PreparedQuery>::iterator it
+            = threadData->preparedQueries.find(query);
+    if (it != threadData->preparedQueries.end()) {
+        d->preparedQueryHits.ref();
+        it->lastUsed = ++threadData->preparedQueryUses;
+        return it->query;
     }
 
-    QSqlQuery preparedQuery(threadData.database);
+    d->preparedQueryMisses.ref();
+
+    QSqlQuery preparedQuery(threadData->database);
     if (!preparedQuery.prepare(query)) {
         qWarning() << Q_FUNC_INFO << "Failed to prepare query";
         qWarning() << query;
         qWarning() << preparedQuery.lastError();
         return QSqlQuery();
-    } else {
-        threadData.preparedQueries.insert(query, preparedQuery);
-        return preparedQuery;
     }
+
+    // Drop the least recently used statements to make room. Copies of an
+    // evicted query that are still in use stay valid.
+    while (threadData->preparedQueries.count() >= d->preparedQueryCacheSize) {
+        QHash<QString, AbstractSocialCacheDatabasePrivate::PreparedQuery>::iterator oldest
+                = threadData->preparedQueries.begin();
+        for (it = oldest; it != threadData->preparedQueries.end(); ++it) {
+            if (it->lastUsed < oldest->lastUsed) {
+                oldest = it;
+            }
+        }
+        threadData->preparedQueries.erase(oldest);
+        d->preparedQueryEvictions.ref();
+    }
+
+    AbstractSocialCacheDatabasePrivate::PreparedQuery &cachedQuery = threadData->preparedQueries[query];
+    cachedQuery.query = preparedQuery;
+    cachedQuery.lastUsed = ++threadData->preparedQueryUses;
+    return preparedQuery;
 }
 
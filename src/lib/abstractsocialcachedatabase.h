@@ -22,6 +22,7 @@
 
 #include <QtCore/QMap>
 #include <QtCore/QVariantList>
+#include <QtCore/QVector>
 
 QT_BEGIN_NAMESPACE
 class QSqlDatabase;
@@ -41,6 +42,123 @@ public:
         Error
     };
 
+    // GlobalThreadPool runs reads and writes on QThreadPool::globalInstance().
+    // DedicatedThreads runs all writes for a database file on a single thread
+    // owned by that file, and reads on a separate bounded pool, so that database
+    // work does not compete with unrelated users of the global pool.
+    enum ExecutionMode
+    {
+        GlobalThreadPool,
+        DedicatedThreads
+    };
+
+    enum TuningPreset
+    {
+        DefaultTuning,      // SQLite defaults
+        SmallTuning,        // Small databases with few, small writes
+        ReadMostlyTuning    // Large caches that are read a lot more than written
+    };
+
+    enum Synchronous
+    {
+        SynchronousOff,
+        SynchronousNormal,  // Durable with WAL, except for the last commits on power loss
+        SynchronousFull
+    };
+
+    // Applied to every connection. Sizes of 0 keep the SQLite defaults, and
+    // the page size is only used when the database file is created.
+    struct TuningProfile
+    {
+        TuningProfile()
+            : cacheSize(0), mmapSize(0), synchronous(SynchronousFull), pageSize(0), busyTimeout(5000) {}
+
+        static TuningProfile preset(TuningPreset preset);
+
+        int cacheSize;          // Page cache size, in KiB
+        qint64 mmapSize;        // Bytes of the file accessed through memory mapping
+        Synchronous synchronous;
+        int pageSize;           // Page size, in bytes
+        int busyTimeout;        // Milliseconds to wait for another connection's lock
+    };
+
+    struct ReaderStatistics
+    {
+        ReaderStatistics()
+            : connections(0), reads(0), activeReads(0), peakActiveReads(0), readsDuringWrite(0) {}
+
+        int connections;        // Read-only connections opened on the database file
+        int reads;              // Reads executed by the reader pool
+        int activeReads;        // Reads currently executing in the reader pool
+        int peakActiveReads;    // Highest number of reads executing at the same time
+        int readsDuringWrite;   // Reads started while a write transaction was open
+    };
+
+    struct PreparedQueryStatistics
+    {
+        PreparedQueryStatistics() : hits(0), misses(0), evictions(0) {}
+
+        int hits;               // Queries served from the statement cache
+        int misses;             // Queries that had to be prepared
+        int evictions;          // Least recently used statements dropped from a full cache
+    };
+
+    // Latencies are in microseconds. histogram[i] counts the samples below
+    // 100 * 10^i microseconds, and the last bucket counts all the longer ones.
+    struct LatencyStatistics
+    {
+        LatencyStatistics() : count(0), total(0), maximum(0), histogram(7, 0) {}
+
+        int count;
+        qint64 total;
+        qint64 maximum;
+        QVector<int> histogram;
+    };
+
+    struct TransactionStatistics
+    {
+        TransactionStatistics() : lockContentions(0), groupedWrites(0), unchangedRows(0) {}
+
+        int lockContentions;            // Writes that had to wait for another writer
+        int groupedWrites;              // Writes that shared a transaction with other writes
+        int unchangedRows;              // Rows not written again as their content was the same
+        LatencyStatistics queueDelay;   // From executeWrite() to the start of the write
+        LatencyStatistics lockWait;     // Waiting for the lock shared by all processes
+        LatencyStatistics transaction;  // BEGIN and write()
+        LatencyStatistics commit;       // COMMIT, including the sync to disk
+    };
+
+    struct MaintenanceStatistics
+    {
+        MaintenanceStatistics()
+            : runs(0), pagesReclaimed(0), checkpointedFrames(0), truncations(0), time(0) {}
+
+        int runs;
+        int pagesReclaimed;     // Free pages given back to the file system by incremental vacuum
+        int checkpointedFrames; // WAL frames copied to the database file
+        int truncations;        // Checkpoints that reset the WAL to zero size
+        qint64 time;            // Time spent in maintenance, in microseconds
+    };
+
+    struct FileRemovalStatistics
+    {
+        FileRemovalStatistics() : removedFiles(0), reclaimedBytes(0) {}
+
+        int removedFiles;       // Cached files removed after the writes that dropped them
+        qint64 reclaimedBytes;
+    };
+
+    // A match of a full text search. Higher scores are better matches, and
+    // the matched terms of the snippet are wrapped in <b> and </b>.
+    struct SearchResult
+    {
+        SearchResult() : score(0) {}
+
+        QString identifier;
+        QString snippet;
+        qreal score;
+    };
+
     explicit AbstractSocialCacheDatabase(
             const QString &serviceName,
             const QString &dataType,
@@ -53,6 +171,53 @@ public:
     Status readStatus() const;
     Status writeStatus() const;
 
+    // The execution mode should be set before any read or write is executed.
+    ExecutionMode executionMode() const;
+    void setExecutionMode(ExecutionMode mode);
+
+    // Number of threads reading the database file in DedicatedThreads mode.
+    // The reader pool is shared by all databases using the same file, and its
+    // connections, like the ones used by synchronous getters in that mode, are
+    // read-only so that they never block or get blocked by the writer.
+    int readerThreadCount() const;
+    void setReaderThreadCount(int count);
+    ReaderStatistics readerStatistics() const;
+
+    TuningProfile tuningProfile() const;
+
+    // With group commit the writes queued within latency milliseconds by the
+    // databases using the same file share a single transaction, up to
+    // maximumBatchSize writes. Each write keeps its own status. Group commit
+    // only applies to DedicatedThreads mode, and a latency of 0 disables it.
+    int groupCommitLatency() const;
+    int groupCommitBatchSize() const;
+    void setGroupCommit(int latency, int maximumBatchSize);
+
+    // Maximum number of prepared statements kept by each connection.
+    int preparedQueryCacheSize() const;
+    void setPreparedQueryCacheSize(int size);
+    PreparedQueryStatistics preparedQueryStatistics() const;
+
+    TransactionStatistics transactionStatistics() const;
+    void resetTransactionStatistics();
+
+    // Maintenance runs once no write has finished for idleInterval
+    // milliseconds, after the queued writes. It reclaims up to maximumPages
+    // free pages with incremental vacuum and checkpoints the WAL, truncating
+    // it when all of it was copied to the database file. Incremental vacuum
+    // only applies to database files created by this version of the library.
+    // An interval of 0 disables the scheduler, but not runMaintenance().
+    int maintenanceInterval() const;
+    int maintenancePageLimit() const;
+    void setMaintenance(int idleInterval, int maximumPages);
+    void runMaintenance();
+    MaintenanceStatistics maintenanceStatistics() const;
+
+    FileRemovalStatistics fileRemovalStatistics() const;
+
+    // Logs all statistics to the org.nemomobile.socialcache.database category
+    void dumpStatistics() const;
+
     bool event(QEvent *event);
 
     void wait();
@@ -72,10 +237,19 @@ protected:
     virtual bool write();
     virtual bool createTables(QSqlDatabase database) const = 0;
     virtual bool dropTables(QSqlDatabase database) const = 0;
+    // Upgrades the tables from fromVersion to fromVersion + 1. All the steps
+    // needed to reach the current version run in a single transaction, and
+    // returning false makes the tables get dropped and created again.
+    virtual bool upgradeTables(QSqlDatabase database, int fromVersion) const;
 
     virtual void readFinished();
     virtual void writeFinished();
+    // Called on the thread of a write once it is committed, without holding
+    // the database lock, for work that should not delay other writers
+    virtual void writeCommitted();
 
+    // Should be called from the constructor, before any connection is opened
+    void setTuningProfile(const TuningProfile &profile);
 
     QSqlQuery prepare(const QString &query) const;
 
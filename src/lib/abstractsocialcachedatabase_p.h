@@ -21,8 +21,15 @@
 #define ABSTRACTSOCIALCACHEDATABASE_P_H
 
 #include <QtCore/QtGlobal>
-#include <QtCore/QWaitCondition>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QBasicTimer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFuture>
+#include <QtCore/QFutureInterface>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
 #include <QtCore/QRunnable>
+#include <QtCore/QThreadPool>
 #include <QtCore/QThreadStorage>
 #include <QtCore/QWaitCondition>
 #include <QtSql/QSqlDatabase>
@@ -31,6 +38,8 @@
 #include "abstractsocialcachedatabase.h"
 
 class AbstractSocialCacheDatabase;
+template <typename T> class AsyncQuery;
+
 class AbstractSocialCacheDatabasePrivate : public QRunnable
 {
 protected:
@@ -46,15 +55,55 @@ public:
         Error
     };
 
+    struct PreparedQuery
+    {
+        PreparedQuery() : lastUsed(0) {}
+
+        QSqlQuery query;
+        quint64 lastUsed;
+    };
+
     struct ThreadData
     {
-        ThreadData() : mutex(0) {}
+        ThreadData() : preparedQueryUses(0), mutex(0), readOnly(false) {}
         ~ThreadData() { database.close(); delete mutex; }
 
         QSqlDatabase database;
-        QHash<QString, QSqlQuery> preparedQueries;
+        QHash<QString, PreparedQuery> preparedQueries;
+        quint64 preparedQueryUses;
         QString threadId;
         ProcessMutex *mutex; // Process (and thread) mutex to prevent concurrent write
+        bool readOnly;
+    };
+
+    struct WriteTimings
+    {
+        WriteTimings() : lockWait(0), transaction(0), commit(0), contended(false), grouped(false) {}
+
+        qint64 lockWait;
+        qint64 transaction;
+        qint64 commit;
+        bool contended;
+        bool grouped;
+    };
+
+    // Runs the queued reads or writes of a database on its dedicated threads.
+    class Task : public QRunnable
+    {
+    public:
+        enum Type
+        {
+            Read,
+            Write
+        };
+
+        Task(AbstractSocialCacheDatabasePrivate *d, Type type);
+
+        void run();
+
+    private:
+        AbstractSocialCacheDatabasePrivate * const d;
+        const Type type;
     };
 
     explicit AbstractSocialCacheDatabasePrivate(
@@ -66,11 +115,80 @@ public:
     virtual ~AbstractSocialCacheDatabasePrivate();
 
     bool initializeThreadData(ThreadData *threadData) const;
+    bool upgradeTables(QSqlDatabase database, int fromVersion) const;
+    ThreadData *localThreadData(bool readOnly) const;
+
+    QThreadPool *writerThreadPool() const;
+    QThreadPool *readerThreadPool() const;
+
+    // Runs a getter of object with the given arguments on a worker thread of
+    // this database, and reports its result to the returned future.
+    template <typename T, typename Class, typename Function>
+    QFuture<T> startQuery(Class *object, Function function) const;
+    template <typename T, typename Class, typename Function, typename A1>
+    QFuture<T> startQuery(Class *object, Function function, const A1 &a1) const;
+    template <typename T, typename Class, typename Function, typename A1, typename A2>
+    QFuture<T> startQuery(Class *object, Function function, const A1 &a1, const A2 &a2) const;
+    template <typename T, typename Class, typename Function, typename A1, typename A2, typename A3>
+    QFuture<T> startQuery(Class *object, Function function, const A1 &a1, const A2 &a2, const A3 &a3) const;
+
+    template <typename T> QFuture<T> start(AsyncQuery<T> *query) const;
+    template <typename T> static QFuture<T> finishedQuery(const T &result);
+    void queryFinished() const;
+
+    static QList<bool> executeWrites(
+            ThreadData *threadData, const QList<AbstractSocialCacheDatabasePrivate *> &writers,
+            WriteTimings *timings);
+    static void commitGroup(const QList<AbstractSocialCacheDatabasePrivate *> &batch);
+    void recordWrite(qint64 queueDelay, const WriteTimings &timings);
+
+    // Full text search tables need the FTS5 module of SQLite, so they are
+    // optional. Their first column is the identifier of the matched row.
+    static bool createSearchTable(QSqlDatabase database, const QString &table,
+                                  const QString &columns);
+    static QString searchExpression(const QString &text);
+    bool hasTable(const QString &table) const;
+
+    // Rows keep a hash of their content in a contentHash column, so that
+    // writes can skip the rows that would not change. unchangedRows() returns
+    // the keys whose stored hash is the given one, and counts them in the
+    // transaction statistics.
+    static QByteArray contentHash(const QVariantList &values);
+    QSet<QString> unchangedRows(const QString &table, const QString &keyColumn,
+                                const QHash<QString, QByteArray> &hashes);
+    QList<AbstractSocialCacheDatabase::SearchResult> search(
+            const QString &table, const QString &text, int limit) const;
+
+    // Cached files are not removed by write(), which holds the database lock,
+    // but queued in the pending_file_removals table by queueFileRemovals(),
+    // with the paths in all the columns of the selected rows. The files are
+    // removed once the write is committed. The queue is kept in the database,
+    // so the files queued by a process that crashed are removed by the next
+    // write. cancelFileRemovals() keeps the files that are used again.
+    // The paths still returned by the referencedFiles query are not removed.
+    // Files written after they were queued, like a download to the same path
+    // that is not committed yet, stay queued until the next removal, unless
+    // they are referenced by then.
+    static bool createFileRemovalTable(QSqlDatabase database);
+    static bool addFileRemovalTimes(QSqlDatabase database);
+    bool queueFileRemovals(QSqlQuery &query);
+    bool queueFileRemovals(const QVariantList &paths);
+    bool cancelFileRemovals(const QVariantList &paths);
+    void removePendingFiles(ThreadData *threadData);
+
+    void performWrite(ThreadData *threadData, QMutexLocker &locker);
+    void performRead(ThreadData *threadData, QMutexLocker &locker);
+    void performMaintenance(ThreadData *threadData, QMutexLocker &locker);
+    void runWrites();
+    void runReads();
+    void tasksFinished();
 
     static QThreadStorage<QHash<QString, ThreadData> > globalThreadData;
+    // The connection of each file that a read or write runs on, per thread
+    static QThreadStorage<QHash<QString, ThreadData *> > activeThreadData;
 
-    QMutex mutex;
-    QWaitCondition condition;
+    mutable QMutex mutex;
+    mutable QWaitCondition condition;
 
     const QString serviceName;
     const QString dataType;
@@ -83,7 +201,35 @@ public:
     Status asyncReadStatus;
     Status asyncWriteStatus;
 
+    AbstractSocialCacheDatabase::ExecutionMode executionMode;
+    AbstractSocialCacheDatabase::TuningProfile tuningProfile;
+
+    int preparedQueryCacheSize;
+    mutable QAtomicInt preparedQueryHits;
+    mutable QAtomicInt preparedQueryMisses;
+    mutable QAtomicInt preparedQueryEvictions;
+
+    AbstractSocialCacheDatabase::TransactionStatistics transactionStatistics;
+    QElapsedTimer writeQueueTimer;
+
+    AbstractSocialCacheDatabase::MaintenanceStatistics maintenanceStatistics;
+
+    AbstractSocialCacheDatabase::FileRemovalStatistics fileRemovalStatistics;
+    bool fileRemovalsPending;
+    QString referencedFiles;
+    QBasicTimer maintenanceTimer;
+    int maintenanceInterval;
+    int maintenancePageLimit;
+    bool maintenanceNeeded;     // A write finished since the last maintenance
+    bool maintenanceQueued;
+
+    Task readTask;
+    Task writeTask;
+
     bool running;
+    bool readRunning;
+    bool writeRunning;
+    mutable int pendingQueries;
 
     void run();
 
@@ -92,6 +238,154 @@ private:
     Q_DECLARE_PUBLIC(AbstractSocialCacheDatabase)
 };
 
+template <typename T>
+class AsyncQuery : public QRunnable
+{
+public:
+    explicit AsyncQuery(const AbstractSocialCacheDatabasePrivate *d) : d(d) {}
+
+    QFutureInterface<T> futureInterface;
+
+    void run()
+    {
+        if (!futureInterface.isCanceled()) {
+            futureInterface.reportResult(call());
+        }
+        futureInterface.reportFinished();
+        d->queryFinished();
+    }
+
+protected:
+    virtual T call() = 0;
+
+private:
+    const AbstractSocialCacheDatabasePrivate * const d;
+};
+
+template <typename T, typename Class, typename Function>
+class AsyncQuery0 : public AsyncQuery<T>
+{
+public:
+    AsyncQuery0(const AbstractSocialCacheDatabasePrivate *d, Class *object, Function function)
+        : AsyncQuery<T>(d), object(object), function(function) {}
+
+protected:
+    T call() { return (object->*function)(); }
+
+private:
+    Class * const object;
+    const Function function;
+};
+
+template <typename T, typename Class, typename Function, typename A1>
+class AsyncQuery1 : public AsyncQuery<T>
+{
+public:
+    AsyncQuery1(const AbstractSocialCacheDatabasePrivate *d, Class *object, Function function,
+                const A1 &a1)
+        : AsyncQuery<T>(d), object(object), function(function), a1(a1) {}
+
+protected:
+    T call() { return (object->*function)(a1); }
+
+private:
+    Class * const object;
+    const Function function;
+    const A1 a1;
+};
+
+template <typename T, typename Class, typename Function, typename A1, typename A2>
+class AsyncQuery2 : public AsyncQuery<T>
+{
+public:
+    AsyncQuery2(const AbstractSocialCacheDatabasePrivate *d, Class *object, Function function,
+                const A1 &a1, const A2 &a2)
+        : AsyncQuery<T>(d), object(object), function(function), a1(a1), a2(a2) {}
+
+protected:
+    T call() { return (object->*function)(a1, a2); }
+
+private:
+    Class * const object;
+    const Function function;
+    const A1 a1;
+    const A2 a2;
+};
+
+template <typename T, typename Class, typename Function, typename A1, typename A2, typename A3>
+class AsyncQuery3 : public AsyncQuery<T>
+{
+public:
+    AsyncQuery3(const AbstractSocialCacheDatabasePrivate *d, Class *object, Function function,
+                const A1 &a1, const A2 &a2, const A3 &a3)
+        : AsyncQuery<T>(d), object(object), function(function), a1(a1), a2(a2), a3(a3) {}
+
+protected:
+    T call() { return (object->*function)(a1, a2, a3); }
+
+private:
+    Class * const object;
+    const Function function;
+    const A1 a1;
+    const A2 a2;
+    const A3 a3;
+};
+
+template <typename T>
+QFuture<T> AbstractSocialCacheDatabasePrivate::start(AsyncQuery<T> *query) const
+{
+    QFuture<T> future = query->futureInterface.future();
+    query->futureInterface.reportStarted();
+
+    QMutexLocker locker(&mutex);
+    ++pendingQueries;
+    // Queries only read, so they use the reader pool when there is one
+    if (executionMode == AbstractSocialCacheDatabase::DedicatedThreads) {
+        readerThreadPool()->start(query);
+    } else {
+        QThreadPool::globalInstance()->start(query);
+    }
+    return future;
+}
+
+template <typename T>
+QFuture<T> AbstractSocialCacheDatabasePrivate::finishedQuery(const T &result)
+{
+    QFutureInterface<T> futureInterface;
+    futureInterface.reportStarted();
+    futureInterface.reportResult(result);
+    futureInterface.reportFinished();
+    return futureInterface.future();
+}
+
+template <typename T, typename Class, typename Function>
+QFuture<T> AbstractSocialCacheDatabasePrivate::startQuery(Class *object, Function function) const
+{
+    return start<T>(new AsyncQuery0<T, Class, Function>(this, object, function));
+}
+
+template <typename T, typename Class, typename Function, typename A1>
+QFuture<T> AbstractSocialCacheDatabasePrivate::startQuery(
+        Class *object, Function function, const A1 &a1) const
+{
+    return start<T>(new AsyncQuery1<T, Class, Function, A1>(this, object, function, a1));
+}
+
+template <typename T, typename Class, typename Function, typename A1, typename A2>
+QFuture<T> AbstractSocialCacheDatabasePrivate::startQuery(
+        Class *object, Function function, const A1 &a1, const A2 &a2) const
+{
+    return start<T>(new AsyncQuery2<T, Class, Function, A1, A2>(this, object, function, a1, a2));
+}
+
+template <typename T, typename Class, typename Function, typename A1, typename A2, typename A3>
+QFuture<T> AbstractSocialCacheDatabasePrivate::startQuery(
+        Class *object, Function function, const A1 &a1, const A2 &a2, const A3 &a3) const
+{
+    return start<T>(new AsyncQuery3<T, Class, Function, A1, A2, A3>(
+                this, object, function, a1, a2, a3));
+}
+
 #define executeSocialCacheQuery(query) \
     if (!query.exec()) { \
         qWarning() << Q_FUNC_INFO << "Failed to execute query"; \
@@ -19,17 +19,106 @@
 #include "abstractsocialpostcachedatabase.h"
 #include "abstractsocialcachedatabase_p.h"
 #include "socialsyncinterface.h"
+#include <QtCore/QDataStream>
 #include <QtCore/QDebug>
+#include <QtCore/QHash>
 #include <QtCore/QRunnable>
+#include <QtCore/QSet>
 #include <QtCore/QStringList>
 #include <QtSql/QSqlQuery>
 #include <QtSql/QSqlError>
 
+#include <limits>
+
 static const char *INVALID = "invalid";
 static const char *PHOTO = "photo";
 static const char *VIDEO = "video";
 
-static const int POST_DB_VERSION = 1;
+static const int POST_DB_VERSION = 7;
+
+// Number of writes for which removed posts are remembered
+static const int REMOVED_POST_HISTORY = 1000;
+
+// Most posts evicted by each retention rule in a single write
+static const int RETENTION_BATCH_SIZE = 500;
+
+// Posts older than the last post that was read, newest first. The first
+// window starts after the newest possible post, and a limit of -1 reads all
+// the posts.
+static const char *POST_WINDOW =
+        "FROM posts "
+        "WHERE timestamp <= :timestamp AND (timestamp < :sameTimestamp OR identifier < :identifier) "
+        "ORDER BY timestamp DESC, identifier DESC "
+        "LIMIT :limit";
+
+// Posts inserted or updated after the token
+static const char *CHANGED_POSTS =
+        "FROM posts "
+        "WHERE sequence > :token "
+        "ORDER BY timestamp DESC, identifier DESC";
+
+static const char *ALL_POSTS =
+        "FROM posts "
+        "ORDER BY timestamp DESC, identifier DESC";
+
+// The extra fields of a post are stored as a single serialized map, which
+// keeps the type of the values.
+static QByteArray packExtra(const QVariantMap &extra)
+{
+    QByteArray data;
+    if (!extra.isEmpty()) {
+        QDataStream stream(&data, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_0);
+        stream << extra;
+    }
+    return data;
+}
+
+static QVariantMap unpackExtra(const QByteArray &data)
+{
+    QVariantMap extra;
+    if (!data.isEmpty()) {
+        QDataStream stream(data);
+        stream.setVersion(QDataStream::Qt_5_0);
+        stream >> extra;
+    }
+    return extra;
+}
+
+// Executes a query and adds the number of rows it changed to count
+static bool executeCounted(QSqlQuery &query, int *count)
+{
+    bool success = true;
+    if (query.exec()) {
+        *count += qMax(0, query.numRowsAffected());
+    } else {
+        qWarning() << Q_FUNC_INFO << "Failed to execute query";
+        qWarning() << query.lastQuery();
+        qWarning() << query.lastError();
+        success = false;
+    }
+    query.finish();
+    return success;
+}
+
+static QByteArray postContentHash(const SocialPost::ConstPtr &post)
+{
+    QVariantList values;
+    values << post->name() << post->body() << post->timestamp().toTime_t() << post->extra();
+
+    Q_FOREACH (const SocialPost::Image &image, post->imageList()) {
+        values << image.position << image.url << int(image.type);
+    }
+    return AbstractSocialCacheDatabasePrivate::contentHash(values);
+}
+
+// Whether a comes before b in posts()
+static bool isNewer(const SocialPost::ConstPtr &a, const SocialPost::ConstPtr &b)
+{
+    const QDateTime aTimestamp = a->timestamp();
+    const QDateTime bTimestamp = b->timestamp();
+    return aTimestamp > bTimestamp || (aTimestamp == bTimestamp && a->identifier() > b->identifier());
+}
 
 struct SocialPostImagePrivate
 {
@@ -83,7 +172,7 @@ struct SocialPostPrivate
     QString name;
     QString body;
     QDateTime timestamp;
-    QMap<int, SocialPostImage::ConstPtr> images;
+    QVector<SocialPost::Image> images;
     QVariantMap extra;
     QList<int> accounts;
 };
@@ -146,20 +235,38 @@ QDateTime SocialPost::timestamp() const
 QString SocialPost::icon() const
 {
     Q_D(const SocialPost);
-    if (d->images.isEmpty()) {
+    if (d->images.isEmpty() || d->images.first().position != 0) {
         return QString();
     }
 
-    return d->images.value(0)->url();
+    return d->images.first().url;
+}
+
+const QVector<SocialPost::Image> &SocialPost::imageList() const
+{
+    Q_D(const SocialPost);
+    return d->images;
+}
+
+static bool imagePositionLessThan(const SocialPost::Image &a, const SocialPost::Image &b)
+{
+    return a.position < b.position;
+}
+
+void SocialPost::setImageList(const QVector<Image> &images)
+{
+    Q_D(SocialPost);
+    d->images = images;
+    qStableSort(d->images.begin(), d->images.end(), imagePositionLessThan);
 }
 
 QList<SocialPostImage::ConstPtr> SocialPost::images() const
 {
     Q_D(const SocialPost);
     QList<SocialPostImage::ConstPtr> images;
-    Q_FOREACH (int key, d->images.keys()) {
-        if (key > 0) {
-            images.append(d->images.value(key));
+    Q_FOREACH (const Image &image, d->images) {
+        if (image.position > 0) {
+            images.append(SocialPostImage::create(image.url, image.type));
         }
     }
 
@@ -169,16 +276,26 @@ QList<SocialPostImage::ConstPtr> SocialPost::images() const
 QMap<int, SocialPostImage::ConstPtr> SocialPost::allImages() const
 {
     Q_D(const SocialPost);
-    return d->images;
+    QMap<int, SocialPostImage::ConstPtr> images;
+    Q_FOREACH (const Image &image, d->images) {
+        images.insert(image.position, SocialPostImage::create(image.url, image.type));
+    }
+
+    return images;
 }
 
 void SocialPost::setImages(const QMap<int, SocialPostImage::ConstPtr> &images)
 {
     Q_D(SocialPost);
-    d->images = images;
+    d->images.clear();
+    d->images.reserve(images.count());
+    for (QMap<int, SocialPostImage::ConstPtr>::const_iterator it = images.begin();
+            it != images.end(); ++it) {
+        d->images.append(Image(it.key(), it.value()->url(), it.value()->type()));
+    }
 }
 
-QVariantMap SocialPost::extra() const
+const QVariantMap &SocialPost::extra() const
 {
     Q_D(const SocialPost);
     return d->extra;
@@ -190,7 +307,7 @@ void SocialPost::setExtra(const QVariantMap &extra)
     d->extra = extra;
 }
 
-QList<int> SocialPost::accounts() const
+const QList<int> &SocialPost::accounts() const
 {
     Q_D(const SocialPost);
     return d->accounts;
@@ -207,6 +324,15 @@ class AbstractSocialPostCacheDatabasePrivate: public AbstractSocialCacheDatabase
 public:
     AbstractSocialPostCacheDatabasePrivate(
             AbstractSocialPostCacheDatabase *q, const QString &serviceName, const QString &databaseFile);
+
+    bool readPosts(QList<SocialPost::ConstPtr> *posts, const QString &filter,
+                   const QVariantMap &bindings, bool filterChildren) const;
+    bool removeUnlinkedPosts(qint64 sequence, bool searchIndex,
+                             AbstractSocialPostCacheDatabase::RetentionStatistics *statistics) const;
+    bool applyRetentionPolicy(const AbstractSocialPostCacheDatabase::RetentionPolicy &policy,
+                              const QList<int> &accounts, qint64 sequence, bool searchIndex,
+                              AbstractSocialPostCacheDatabase::RetentionStatistics *statistics) const;
+
 private:
     struct {
         QMap<QString, SocialPost::ConstPtr> insertPosts;
@@ -214,8 +340,32 @@ private:
         QList<int> removePostsForAccount;
     } queue;
 
+    struct {
+        int limit;
+        bool append;
+        qint64 timestamp;
+        QString identifier;
+        bool changes;
+        qint64 token;
+    } readWindow;
+
     QList<SocialPost::ConstPtr> asyncPosts;
+    QStringList asyncRemovedPosts;
+    bool asyncAppend;
+    bool asyncIncremental;
+    bool asyncHasMore;
+    qint64 asyncSequence;
+
     QList<SocialPost::ConstPtr> posts;
+    QList<SocialPost::ConstPtr> changedPosts;
+    QStringList removedPosts;
+    int pageSize;
+    bool hasMore;
+    bool incremental;
+    qint64 changeToken;
+
+    AbstractSocialPostCacheDatabase::RetentionPolicy retentionPolicy;
+    AbstractSocialPostCacheDatabase::RetentionStatistics retentionStatistics;
 
     Q_DECLARE_PUBLIC(AbstractSocialPostCacheDatabase)
 };
@@ -228,7 +378,279 @@ AbstractSocialPostCacheDatabasePrivate::AbstractSocialPostCacheDatabasePrivate(
             SocialSyncInterface::dataType(SocialSyncInterface::Posts),
             databaseFile,
             POST_DB_VERSION)
+    , asyncAppend(false)
+    , asyncIncremental(false)
+    , asyncHasMore(false)
+    , asyncSequence(-1)
+    , pageSize(0)
+    , hasMore(false)
+    , incremental(false)
+    , changeToken(-1)
 {
+    readWindow.limit = -1;
+    readWindow.append = false;
+    readWindow.timestamp = 0;
+    readWindow.changes = false;
+    readWindow.token = -1;
+}
+
+// Reads the posts selected by filter, which follows the column list of a
+// SELECT, and with filterChildren only reads the children of these posts.
+// Each table is read in a single pass, and the images and accounts are
+// matched to their posts by identifier afterwards.
+bool AbstractSocialPostCacheDatabasePrivate::readPosts(
+        QList<SocialPost::ConstPtr> *posts, const QString &filter,
+        const QVariantMap &bindings, bool filterChildren) const
+{
+    Q_Q(const AbstractSocialPostCacheDatabase);
+
+    const QString childFilter = filterChildren
+            ? QString(QLatin1String(" WHERE postId IN (SELECT identifier %1)")).arg(filter)
+            : QString();
+
+    QSqlQuery postQuery = q->prepare(QString(QLatin1String(
+                "SELECT identifier, name, body, timestamp, extra %1")).arg(filter));
+    QSqlQuery imageQuery = q->prepare(QLatin1String(
+                "SELECT postId, position, url, type "
+                "FROM images") + childFilter);
+    QSqlQuery accountQuery = q->prepare(QLatin1String(
+                "SELECT postId, account "
+                "FROM link_post_account") + childFilter + QLatin1String(
+                " ORDER BY postId, account"));
+
+    for (QVariantMap::const_iterator it = bindings.begin(); it != bindings.end(); ++it) {
+        postQuery.bindValue(it.key(), it.value());
+        if (filterChildren) {
+            imageQuery.bindValue(it.key(), it.value());
+            accountQuery.bindValue(it.key(), it.value());
+        }
+    }
+
+    if (!postQuery.exec()) {
+        qWarning() << Q_FUNC_INFO << "Error reading from posts table:" << postQuery.lastError();
+        return false;
+    }
+
+    QList<SocialPost::Ptr> postList;
+    while (postQuery.next()) {
+        QString identifier = postQuery.value(0).toString();
+
+        QString name = postQuery.value(1).toString();
+        QString body = postQuery.value(2).toString();
+        int timestamp = postQuery.value(3).toInt();
+        postList.append(SocialPost::create(identifier, name, body, QDateTime::fromTime_t(timestamp),
+                                           QMap<int, SocialPostImage::ConstPtr>(),
+                                           unpackExtra(postQuery.value(4).toByteArray())));
+    }
+    postQuery.finish();
+
+    QHash<QString, QVector<SocialPost::Image> > images;
+    if (imageQuery.exec()) {
+        const QString photo = QLatin1String(PHOTO);
+        const QString video = QLatin1String(VIDEO);
+
+        while (imageQuery.next()) {
+            SocialPostImage::ImageType type = SocialPostImage::Invalid;
+            QString typeString = imageQuery.value(3).toString();
+            if (typeString == photo) {
+                type = SocialPostImage::Photo;
+            } else if (typeString == video) {
+                type = SocialPostImage::Video;
+            }
+
+            images[imageQuery.value(0).toString()].append(SocialPost::Image(
+                        imageQuery.value(1).toInt(), imageQuery.value(2).toString(), type));
+        }
+        imageQuery.finish();
+    } else {
+        qWarning() << Q_FUNC_INFO << "Error reading from images table:"
+                   << imageQuery.lastError();
+    }
+
+    QHash<QString, QList<int> > accounts;
+    if (accountQuery.exec()) {
+        while (accountQuery.next()) {
+            accounts[accountQuery.value(0).toString()].append(accountQuery.value(1).toInt());
+        }
+        accountQuery.finish();
+    } else {
+        qWarning() << Q_FUNC_INFO << "Error reading from link_post_account table:"
+                   << accountQuery.lastError();
+    }
+
+    posts->reserve(postList.count());
+    Q_FOREACH (const SocialPost::Ptr &post, postList) {
+        const QString identifier = post->identifier();
+        post->setImageList(images.value(identifier));
+        post->setAccounts(accounts.value(identifier));
+        posts->append(post);
+    }
+
+    return true;
+}
+
+// Removes the posts of affected_posts that have no account left, with their
+// images and search rows, and leaves a tombstone for the incremental refresh.
+bool AbstractSocialPostCacheDatabasePrivate::removeUnlinkedPosts(
+        qint64 sequence, bool searchIndex,
+        AbstractSocialPostCacheDatabase::RetentionStatistics *statistics) const
+{
+    Q_Q(const AbstractSocialPostCacheDatabase);
+
+    bool success = true;
+    int removedPosts = 0;
+    int removedImages = 0;
+
+    QSqlQuery query = q->prepare(QStringLiteral(
+                "DELETE FROM affected_posts "
+                "WHERE identifier IN ("
+                "SELECT postId FROM link_post_account)"));
+    executeSocialCacheQuery(query);
+
+    query = q->prepare(QStringLiteral(
+                "DELETE FROM images "
+                "WHERE postId IN ("
+                "SELECT identifier FROM affected_posts)"));
+    success &= executeCounted(query, &removedImages);
+
+    query = q->prepare(QStringLiteral(
+                "INSERT OR REPLACE INTO removed_posts ("
+                " identifier, sequence) "
+                "SELECT identifier, :sequence FROM affected_posts"));
+    query.bindValue(QStringLiteral(":sequence"), sequence);
+    executeSocialCacheQuery(query);
+
+    if (searchIndex) {
+        query = q->prepare(QStringLiteral(
+                    "DELETE FROM posts_search "
+                    "WHERE rowid IN ("
+                    "SELECT rowid FROM posts WHERE identifier IN ("
+                    "SELECT identifier FROM affected_posts))"));
+        executeSocialCacheQuery(query);
+    }
+
+    query = q->prepare(QStringLiteral(
+                "DELETE FROM posts "
+                "WHERE identifier IN ("
+                "SELECT identifier FROM affected_posts)"));
+    success &= executeCounted(query, &removedPosts);
+
+    query = q->prepare(QStringLiteral("DELETE FROM affected_posts"));
+    executeSocialCacheQuery(query);
+
+    if (statistics) {
+        statistics->evictedPosts += removedPosts;
+        statistics->evictedImages += removedImages;
+    }
+    return success;
+}
+
+// Each rule evicts at most RETENTION_BATCH_SIZE posts, so that a write never
+// turns into a long cleanup. What is left over goes with the next writes.
+bool AbstractSocialPostCacheDatabasePrivate::applyRetentionPolicy(
+        const AbstractSocialPostCacheDatabase::RetentionPolicy &policy,
+        const QList<int> &accounts, qint64 sequence, bool searchIndex,
+        AbstractSocialPostCacheDatabase::RetentionStatistics *statistics) const
+{
+    Q_Q(const AbstractSocialPostCacheDatabase);
+
+    bool success = true;
+    QSqlQuery query;
+
+    // Posts too old, or the oldest posts over the size budget, lose all
+    // their accounts
+    if (policy.maximumAge > 0) {
+        const QDateTime oldest = QDateTime::currentDateTime().addDays(-policy.maximumAge);
+        query = q->prepare(QStringLiteral(
+                    "INSERT OR IGNORE INTO affected_posts (identifier) "
+                    "SELECT identifier FROM posts "
+                    "WHERE timestamp < :timestamp "
+                    "ORDER BY timestamp LIMIT :limit"));
+        query.bindValue(QStringLiteral(":timestamp"), oldest.toTime_t());
+        query.bindValue(QStringLiteral(":limit"), RETENTION_BATCH_SIZE);
+        executeSocialCacheQuery(query);
+    }
+
+    if (policy.maximumSize > 0) {
+        qint64 values[3] = { 0, 0, 0 };
+        const char * const pragmas[3] = { "page_count", "freelist_count", "page_size" };
+        for (int i = 0; i < 3; ++i) {
+            query = q->prepare(QString(QLatin1String("PRAGMA %1")).arg(QLatin1String(pragmas[i])));
+            if (query.exec() && query.next()) {
+                values[i] = query.value(0).toLongLong();
+            }
+            query.finish();
+        }
+
+        // The posts are assumed to take the same space each
+        const qint64 used = (values[0] - values[1]) * values[2];
+        if (used > policy.maximumSize) {
+            query = q->prepare(QStringLiteral("SELECT COUNT(*) FROM posts"));
+            const qint64 postCount = query.exec() && query.next() ? query.value(0).toLongLong() : 0;
+            query.finish();
+
+            const qint64 excess = (postCount * (used - policy.maximumSize) + used - 1) / used;
+            query = q->prepare(QStringLiteral(
+                        "INSERT OR IGNORE INTO affected_posts (identifier) "
+                        "SELECT identifier FROM posts "
+                        "ORDER BY timestamp, identifier LIMIT :limit"));
+            query.bindValue(QStringLiteral(":limit"), qMin<qint64>(excess, RETENTION_BATCH_SIZE));
+            executeSocialCacheQuery(query);
+        }
+    }
+
+    int evictedLinks = 0;
+    if (policy.maximumAge > 0 || policy.maximumSize > 0) {
+        query = q->prepare(QStringLiteral(
+                    "DELETE FROM link_post_account "
+                    "WHERE postId IN ("
+                    "SELECT identifier FROM affected_posts)"));
+        success &= executeCounted(query, &evictedLinks);
+    }
+
+    // Only the accounts written to can have grown over their limit. Their
+    // oldest posts lose that account, and the posts without another account
+    // are removed.
+    if (policy.maximumPostsPerAccount > 0) {
+        Q_FOREACH (int account, accounts) {
+            query = q->prepare(QStringLiteral(
+                        "INSERT OR IGNORE INTO affected_posts (identifier) "
+                        "SELECT postId FROM link_post_account "
+                        "INNER JOIN posts ON posts.identifier = link_post_account.postId "
+                        "WHERE account = :account "
+                        "ORDER BY posts.timestamp DESC, posts.identifier DESC "
+                        "LIMIT :limit OFFSET :maximum"));
+            query.bindValue(QStringLiteral(":account"), account);
+            query.bindValue(QStringLiteral(":limit"), RETENTION_BATCH_SIZE);
+            query.bindValue(QStringLiteral(":maximum"), policy.maximumPostsPerAccount);
+            executeSocialCacheQuery(query);
+
+            query = q->prepare(QStringLiteral(
+                        "DELETE FROM link_post_account "
+                        "WHERE rowid IN ("
+                        "SELECT link_post_account.rowid FROM link_post_account "
+                        "INNER JOIN posts ON posts.identifier = link_post_account.postId "
+                        "WHERE account = :account "
+                        "ORDER BY posts.timestamp DESC, posts.identifier DESC "
+                        "LIMIT :limit OFFSET :maximum)"));
+            query.bindValue(QStringLiteral(":account"), account);
+            query.bindValue(QStringLiteral(":limit"), RETENTION_BATCH_SIZE);
+            query.bindValue(QStringLiteral(":maximum"), policy.maximumPostsPerAccount);
+            success &= executeCounted(query, &evictedLinks);
+        }
+    }
+
+    // The posts that keep another account change too
+    query = q->prepare(QStringLiteral(
+                "UPDATE posts "
+                "SET sequence = :sequence "
+                "WHERE identifier IN ("
+                "SELECT identifier FROM affected_posts)"));
+    query.bindValue(QStringLiteral(":sequence"), sequence);
+    executeSocialCacheQuery(query);
+
+    statistics->evictedLinks += evictedLinks;
+    return removeUnlinkedPosts(sequence, searchIndex, statistics) && success;
 }
 
 AbstractSocialPostCacheDatabase::~AbstractSocialPostCacheDatabase()
@@ -242,6 +664,7 @@ AbstractSocialPostCacheDatabase::AbstractSocialPostCacheDatabase(
     : AbstractSocialCacheDatabase(
             *(new AbstractSocialPostCacheDatabasePrivate(this, serviceName, databaseFile)))
 {
+    setTuningProfile(TuningProfile::preset(ReadMostlyTuning));
 }
 
 QList<SocialPost::ConstPtr> AbstractSocialPostCacheDatabase::posts() const
@@ -249,6 +672,49 @@ QList<SocialPost::ConstPtr> AbstractSocialPostCacheDatabase::posts() const
     return d_func()->posts;
 }
 
+int AbstractSocialPostCacheDatabase::pageSize() const
+{
+    return d_func()->pageSize;
+}
+
+void AbstractSocialPostCacheDatabase::setPageSize(int pageSize)
+{
+    Q_D(AbstractSocialPostCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->pageSize = qMax(0, pageSize);
+}
+
+bool AbstractSocialPostCacheDatabase::canFetchMore() const
+{
+    Q_D(const AbstractSocialPostCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    return d->hasMore && !d->posts.isEmpty();
+}
+
+void AbstractSocialPostCacheDatabase::fetchMore()
+{
+    Q_D(AbstractSocialPostCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    // A read in progress would replace the window
+    if (!d->hasMore || d->posts.isEmpty() || d->readStatus == Executing) {
+        return;
+    }
+
+    const SocialPost::ConstPtr &last = d->posts.last();
+    d->readWindow.limit = d->pageSize;
+    d->readWindow.append = true;
+    d->readWindow.changes = false;
+    d->readWindow.timestamp = last->timestamp().toTime_t();
+    d->readWindow.identifier = last->identifier();
+
+    locker.unlock();
+
+    executeRead();
+}
+
 void AbstractSocialPostCacheDatabase::addPost(const QString &identifier, const QString &name,
                                               const QString &body, const QDateTime &timestamp,
                                               const QString &icon,
@@ -257,18 +723,21 @@ void AbstractSocialPostCacheDatabase::addPost(const QString &identifier, const Q
 {
     Q_D(AbstractSocialPostCacheDatabase);
     QMutexLocker locker(&d->mutex);
-    QMap<int, SocialPostImage::ConstPtr> formattedImages;
+    QVector<SocialPost::Image> formattedImages;
+    formattedImages.reserve(images.count() + 1);
     if (!icon.isEmpty()) {
-        formattedImages.insert(0, SocialPostImage::create(icon, SocialPostImage::Photo));
+        formattedImages.append(SocialPost::Image(0, icon, SocialPostImage::Photo));
     }
 
     for (int i = 0; i < images.count(); i++) {
         const QPair<QString, SocialPostImage::ImageType> &imagePair = images.at(i);
-        formattedImages.insert(i + 1, SocialPostImage::create(imagePair.first, imagePair.second));
+        formattedImages.append(SocialPost::Image(i + 1, imagePair.first, imagePair.second));
     }
 
-    d->queue.insertPosts.insert(identifier, SocialPost::create(identifier, name, body, timestamp,
-                                                         formattedImages, extra));
+    SocialPost::Ptr post = SocialPost::create(identifier, name, body, timestamp,
+                                              QMap<int, SocialPostImage::ConstPtr>(), extra);
+    post->setImageList(formattedImages);
+    d->queue.insertPosts.insert(identifier, post);
     d->queue.mapPostsToAccounts.insert(identifier, account);
 }
 
@@ -289,103 +758,175 @@ void AbstractSocialPostCacheDatabase::commit()
 
 void AbstractSocialPostCacheDatabase::refresh()
 {
+    Q_D(AbstractSocialPostCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->readWindow.limit = d->pageSize > 0 ? qMax(d->pageSize, d->posts.count()) : -1;
+    d->readWindow.append = false;
+    d->readWindow.changes = false;
+
+    locker.unlock();
+
     executeRead();
 }
 
-bool AbstractSocialPostCacheDatabase::read()
+void AbstractSocialPostCacheDatabase::refreshChanges(qint64 token)
 {
     Q_D(AbstractSocialPostCacheDatabase);
-    // This might be slow
-
-    QSqlQuery postQuery = prepare(QLatin1String(
-                "SELECT identifier, name, body, timestamp "
-                "FROM posts "
-                "ORDER BY timestamp DESC"));
-    QSqlQuery imageQuery = prepare(QLatin1String(
-                "SELECT position, url, type "
-                "FROM images "
-                "WHERE postId = :postId "
-                "ORDER BY position"));
-    QSqlQuery extraQuery = prepare(QLatin1String(
-                "SELECT key, value "
-                "FROM extra "
-                "WHERE postId = :postId"));
-    QSqlQuery accountQuery = prepare(QLatin1String(
-                "SELECT account "
-                "FROM link_post_account "
-                "WHERE postId = :postId"));
+    QMutexLocker locker(&d->mutex);
 
-    if (!postQuery.exec()) {
-        qWarning() << Q_FUNC_INFO << "Error reading from posts table:" << postQuery.lastError();
-        return false;
-    }
+    d->readWindow.limit = d->pageSize > 0 ? qMax(d->pageSize, d->posts.count()) : -1;
+    d->readWindow.append = false;
+    d->readWindow.changes = token >= 0;
+    d->readWindow.token = token;
 
-    QList<SocialPost::ConstPtr> posts;
-    while (postQuery.next()) {
-        QString identifier = postQuery.value(0).toString();
+    locker.unlock();
 
-        QString name = postQuery.value(1).toString();
-        QString body = postQuery.value(2).toString();
-        int timestamp = postQuery.value(3).toInt();
-        SocialPost::Ptr post = SocialPost::create(identifier, name, body,
-                                                  QDateTime::fromTime_t(timestamp));
-
-        imageQuery.bindValue(":postId", identifier);
-
-        QMap<int, SocialPostImage::ConstPtr> images;
-        if (imageQuery.exec()) {
-            while (imageQuery.next()) {
-                SocialPostImage::ImageType type = SocialPostImage::Invalid;
-                QString typeString = imageQuery.value(2).toString();
-                if (typeString == QLatin1String(PHOTO)) {
-                    type = SocialPostImage::Photo;
-                } else if (typeString == QLatin1String(VIDEO)) {
-                    type = SocialPostImage::Video;
-                }
+    executeRead();
+}
 
-                int position = imageQuery.value(0).toInt();
-                SocialPostImage::Ptr image  = SocialPostImage::create(imageQuery.value(1).toString(),
-                                                                      type);
-                images.insert(position, image);
-            }
-            post->setImages(images);
-        } else {
-            qWarning() << Q_FUNC_INFO << "Error reading from images table:"
-                       << imageQuery.lastError();
-        }
+qint64 AbstractSocialPostCacheDatabase::changeToken() const
+{
+    return d_func()->changeToken;
+}
 
-        extraQuery.bindValue(":postId", identifier);
+bool AbstractSocialPostCacheDatabase::incrementalRefresh() const
+{
+    return d_func()->incremental;
+}
 
-        QVariantMap extra;
-        if (extraQuery.exec()) {
-            while (extraQuery.next()) {
-                QString key = extraQuery.value(0).toString();
-                QVariant value = extraQuery.value(1);
-                extra.insert(key, value);
-            }
-        } else {
-            qWarning() << Q_FUNC_INFO << "Error reading from extra table:"
-                       << extraQuery.lastError();
-        }
+QList<SocialPost::ConstPtr> AbstractSocialPostCacheDatabase::changedPosts() const
+{
+    return d_func()->changedPosts;
+}
+
+QStringList AbstractSocialPostCacheDatabase::removedPosts() const
+{
+    return d_func()->removedPosts;
+}
+
+AbstractSocialPostCacheDatabase::RetentionPolicy AbstractSocialPostCacheDatabase::retentionPolicy() const
+{
+    Q_D(const AbstractSocialPostCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    return d->retentionPolicy;
+}
 
-        post->setExtra(extra);
+void AbstractSocialPostCacheDatabase::setRetentionPolicy(const RetentionPolicy &policy)
+{
+    Q_D(AbstractSocialPostCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->retentionPolicy = policy;
+}
+
+AbstractSocialPostCacheDatabase::RetentionStatistics AbstractSocialPostCacheDatabase::retentionStatistics() const
+{
+    Q_D(const AbstractSocialPostCacheDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    return d->retentionStatistics;
+}
+
+bool AbstractSocialPostCacheDatabase::searchAvailable() const
+{
+    return d_func()->hasTable(QStringLiteral("posts_search"));
+}
+
+QList<AbstractSocialCacheDatabase::SearchResult> AbstractSocialPostCacheDatabase::search(
+        const QString &text, int limit) const
+{
+    return d_func()->search(QStringLiteral("posts_search"), text, limit);
+}
+
+QFuture<QList<AbstractSocialCacheDatabase::SearchResult> > AbstractSocialPostCacheDatabase::searchAsync(
+        const QString &text, int limit) const
+{
+    Q_D(const AbstractSocialPostCacheDatabase);
 
-        accountQuery.bindValue(":postId", identifier);
+    return d->startQuery<QList<SearchResult> >(
+                this, &AbstractSocialPostCacheDatabase::search, text, limit);
+}
+
+bool AbstractSocialPostCacheDatabase::read()
+{
+    Q_D(AbstractSocialPostCacheDatabase);
 
-        QList<int> accounts;
-        if (accountQuery.exec()) {
-            while (accountQuery.next()) {
-                accounts.append(accountQuery.value(0).toInt());
+    QMutexLocker locker(&d->mutex);
+
+    const int limit = d->readWindow.limit;
+    const bool append = d->readWindow.append;
+    const bool changes = d->readWindow.changes;
+    const qint64 token = d->readWindow.token;
+    const qint64 timestamp = append ? d->readWindow.timestamp : std::numeric_limits<qint64>::max();
+    const QString identifier = append ? d->readWindow.identifier : QString();
+
+    locker.unlock();
+
+    // The sequence is read first, so that changes committed while reading
+    // are read again with the next token instead of being missed.
+    QSqlQuery sequenceQuery = prepare(QStringLiteral(
+                "SELECT sequence, pruned "
+                "FROM post_changes"));
+    if (!sequenceQuery.exec() || !sequenceQuery.next()) {
+        qWarning() << Q_FUNC_INFO << "Error reading from post_changes table:"
+                   << sequenceQuery.lastError();
+        return false;
+    }
+    const qint64 sequence = sequenceQuery.value(0).toLongLong();
+    const qint64 pruned = sequenceQuery.value(1).toLongLong();
+    sequenceQuery.finish();
+
+    // Removals older than the pruned sequence are forgotten, and a token newer
+    // than the sequence comes from before the tables were created again.
+    const bool incremental = changes && token >= pruned && token <= sequence;
+
+    QList<SocialPost::ConstPtr> posts;
+    QStringList removedPosts;
+    QVariantMap bindings;
+    bool success = false;
+
+    if (incremental) {
+        bindings.insert(QStringLiteral(":token"), token);
+        success = d->readPosts(&posts, QLatin1String(CHANGED_POSTS), bindings, true);
+
+        QSqlQuery removedQuery = prepare(QStringLiteral(
+                    "SELECT identifier "
+                    "FROM removed_posts "
+                    "WHERE sequence > :token"));
+        removedQuery.bindValue(QStringLiteral(":token"), token);
+        if (removedQuery.exec()) {
+            while (removedQuery.next()) {
+                removedPosts.append(removedQuery.value(0).toString());
             }
+            removedQuery.finish();
+        } else {
+            qWarning() << Q_FUNC_INFO << "Error reading from removed_posts table:"
+                       << removedQuery.lastError();
+            success = false;
         }
+    } else if (limit >= 0) {
+        bindings.insert(QStringLiteral(":timestamp"), timestamp);
+        bindings.insert(QStringLiteral(":sameTimestamp"), timestamp);
+        bindings.insert(QStringLiteral(":identifier"), identifier);
+        bindings.insert(QStringLiteral(":limit"), limit);
+        success = d->readPosts(&posts, QLatin1String(POST_WINDOW), bindings, true);
+    } else {
+        success = d->readPosts(&posts, QLatin1String(ALL_POSTS), bindings, false);
+    }
 
-        post->setAccounts(accounts);
-
-        posts.append(post);
+    if (!success) {
+        return false;
     }
 
-    QMutexLocker locker(&d->mutex);
+    locker.relock();
     d->asyncPosts = posts;
+    d->asyncRemovedPosts = removedPosts;
+    d->asyncAppend = append && !incremental;
+    d->asyncIncremental = incremental;
+    d->asyncHasMore = limit >= 0 && posts.count() == limit;
+    d->asyncSequence = sequence;
 
     return true;
 }
@@ -399,6 +940,7 @@ bool AbstractSocialPostCacheDatabase::write()
     const QMap<QString, SocialPost::ConstPtr> insertPosts = d->queue.insertPosts;
     const QMultiMap<QString, int> mapPostsToAccounts = d->queue.mapPostsToAccounts;
     const QList<int> removePostsForAccount = d->queue.removePostsForAccount;
+    const RetentionPolicy retentionPolicy = d->retentionPolicy;
 
     d->queue.insertPosts.clear();
     d->queue.mapPostsToAccounts.clear();
@@ -410,37 +952,126 @@ bool AbstractSocialPostCacheDatabase::write()
 
     QSqlQuery query;
 
+    // The posts added again without a change in their content are not
+    // written, and only get linked to the accounts they were not linked to
+    // yet. A post keeps the accounts it is linked to whether it changed or
+    // not, and only loses them to removals and retention. Removals can
+    // change the accounts of a post, so all posts are written along with
+    // them.
+    QHash<QString, QByteArray> contentHashes;
+    Q_FOREACH (const SocialPost::ConstPtr &post, insertPosts) {
+        contentHashes.insert(post->identifier(), postContentHash(post));
+    }
+    QSet<QString> unchangedPosts;
+    if (removePostsForAccount.isEmpty()) {
+        unchangedPosts = d->unchangedRows(
+                    QStringLiteral("posts"), QStringLiteral("identifier"), contentHashes);
+    }
+
+    struct {
+        QVariantList postIds;
+        QVariantList accountIds;
+    } newLinks;
+
+    if (!unchangedPosts.isEmpty()) {
+        query = prepare(QStringLiteral(
+                    "SELECT account "
+                    "FROM link_post_account "
+                    "WHERE postId = :postId"));
+        Q_FOREACH (const QString &postId, unchangedPosts) {
+            query.bindValue(QStringLiteral(":postId"), postId);
+            if (!query.exec()) {
+                qWarning() << Q_FUNC_INFO << "Error reading from link_post_account table:"
+                           << query.lastError();
+                return false;
+            }
+            QSet<int> linkedAccounts;
+            while (query.next()) {
+                linkedAccounts.insert(query.value(0).toInt());
+            }
+            query.finish();
+
+            Q_FOREACH (int accountId, mapPostsToAccounts.values(postId)) {
+                if (!linkedAccounts.contains(accountId)) {
+                    linkedAccounts.insert(accountId);
+                    newLinks.postIds.append(postId);
+                    newLinks.accountIds.append(accountId);
+                }
+            }
+        }
+    }
+
+    const bool retention = retentionPolicy.maximumAge > 0
+            || retentionPolicy.maximumPostsPerAccount > 0
+            || retentionPolicy.maximumSize > 0;
+
+    bool changed = unchangedPosts.count() < insertPosts.count() || !newLinks.postIds.isEmpty();
+
+    // The retention policy still applies when no post changed
+    if (!changed && removePostsForAccount.isEmpty() && !retention) {
+        return success;
+    }
+
+    // All the changes made by a write share the next sequence number, which
+    // is only stored once something was written
+    query = prepare(QStringLiteral(
+                "SELECT sequence, pruned "
+                "FROM post_changes"));
+    if (!query.exec() || !query.next()) {
+        qWarning() << Q_FUNC_INFO << "Failed to read the post sequence" << query.lastError();
+        return false;
+    }
+    const qint64 sequence = query.value(0).toLongLong() + 1;
+    const qint64 pruned = query.value(1).toLongLong();
+    query.finish();
+
+    const bool searchIndex = d->hasTable(QStringLiteral("posts_search"));
+
+    // The posts looked at by removals and retention, so that their cost does
+    // not depend on the size of the whole cache
+    query = prepare(QStringLiteral(
+                "CREATE TEMP TABLE IF NOT EXISTS affected_posts ("
+                "identifier TEXT PRIMARY KEY)"));
+    executeSocialCacheQuery(query);
+
     // perform removals first.
     if (!removePostsForAccount.isEmpty()) {
         QVariantList accountIds;
-
         Q_FOREACH (int accountId, removePostsForAccount) {
             accountIds.append(accountId);
         }
 
         query = prepare(QStringLiteral(
-                    "DELETE FROM link_post_account "
-                    "WHERE account = :accountId"));
+                    "INSERT OR IGNORE INTO affected_posts (identifier) "
+                    "SELECT postId FROM link_post_account WHERE account = :accountId"));
         query.bindValue(QStringLiteral(":accountId"), accountIds);
         executeBatchSocialCacheQuery(query);
 
         query = prepare(QStringLiteral(
-                    "DELETE FROM extra "
-                    "WHERE postId NOT IN ("
-                    "SELECT postId FROM link_post_account)"));
-        executeSocialCacheQuery(query);
+                    "SELECT EXISTS (SELECT 1 FROM affected_posts)"));
+        if (query.exec() && query.next() && query.value(0).toBool()) {
+            changed = true;
+        }
+        query.finish();
 
+        // The posts of the accounts change, as they lose an account
         query = prepare(QStringLiteral(
-                    "DELETE FROM images "
-                    "WHERE postId NOT IN ("
-                    "SELECT postId FROM link_post_account)"));
+                    "UPDATE posts "
+                    "SET sequence = :sequence "
+                    "WHERE identifier IN ("
+                    "SELECT identifier FROM affected_posts)"));
+        query.bindValue(QStringLiteral(":sequence"), sequence);
         executeSocialCacheQuery(query);
 
         query = prepare(QStringLiteral(
-                    "DELETE FROM posts "
-                    "WHERE identifier NOT IN ("
-                    "SELECT postId FROM link_post_account)"));
-        executeSocialCacheQuery(query);
+                    "DELETE FROM link_post_account "
+                    "WHERE account = :accountId"));
+        query.bindValue(QStringLiteral(":accountId"), accountIds);
+        executeBatchSocialCacheQuery(query);
+
+        if (!d->removeUnlinkedPosts(sequence, searchIndex, 0)) {
+            success = false;
+        }
     }
 
     struct {
@@ -448,6 +1079,9 @@ bool AbstractSocialPostCacheDatabase::write()
         QVariantList names;
         QVariantList bodies;
         QVariantList timestamps;
+        QVariantList sequences;
+        QVariantList extras;
+        QVariantList contentHashes;
     } posts;
 
     struct {
@@ -457,12 +1091,6 @@ bool AbstractSocialPostCacheDatabase::write()
         QVariantList types;
     } images;
 
-    struct {
-        QVariantList postIds;
-        QVariantList keys;
-        QVariantList values;
-    } extras;
-
     struct {
         QVariantList postIds;
         QVariantList accountIds;
@@ -473,21 +1101,26 @@ bool AbstractSocialPostCacheDatabase::write()
     const QVariant videoImageType = QLatin1String(VIDEO);
 
     Q_FOREACH (const SocialPost::ConstPtr &post, insertPosts) {
+        if (unchangedPosts.contains(post->identifier())) {
+            continue;
+        }
+
         const QVariant postId = post->identifier();
 
         posts.postIds.append(postId);
         posts.names.append(post->name());
         posts.bodies.append(post->body());
         posts.timestamps.append(post->timestamp().toTime_t());
+        posts.sequences.append(sequence);
+        posts.extras.append(packExtra(post->extra()));
+        posts.contentHashes.append(contentHashes.value(post->identifier()));
 
-        const QMap<int, SocialPostImage::ConstPtr> postImages = post->allImages();
-        typedef QMap<int, SocialPostImage::ConstPtr>::const_iterator iterator;
-        for (iterator it = postImages.begin(); it != postImages.end(); ++it) {
+        Q_FOREACH (const SocialPost::Image &image, post->imageList()) {
             images.postIds.append(postId);
-            images.positions.append(it.key());
-            images.urls.append(it.value()->url());
+            images.positions.append(image.position);
+            images.urls.append(image.url);
 
-            switch (it.value()->type()) {
+            switch (image.type) {
             case SocialPostImage::Photo:
                 images.types.append(photoImageType);
                 break;
@@ -499,18 +1132,14 @@ bool AbstractSocialPostCacheDatabase::write()
                 break;
             }
         }
-
-        const QVariantMap extra = post->extra();
-        for (QVariantMap::const_iterator it = extra.begin(); it != extra.end(); ++it) {
-            extras.postIds.append(postId);
-            extras.keys.append(it.key());
-            extras.values.append(it.value());
-        }
     }
 
     for (QMultiMap<QString, int>::const_iterator it = mapPostsToAccounts.begin();
             it != mapPostsToAccounts.end();
             ++it) {
+        if (unchangedPosts.contains(it.key())) {
+            continue;
+        }
         accounts.postIds.append(it.key());
         accounts.accountIds.append(it.value());
     }
@@ -522,27 +1151,44 @@ bool AbstractSocialPostCacheDatabase::write()
         query.bindValue(QStringLiteral(":postId"), posts.postIds);
         executeBatchSocialCacheQuery(query);
 
-        query = prepare(QStringLiteral(
-                    "DELETE FROM extra "
-                    "WHERE postId = :postId"));
-        query.bindValue(QStringLiteral(":postId"), posts.postIds);
-        executeBatchSocialCacheQuery(query);
-
-        query = prepare(QStringLiteral(
-                    "DELETE FROM link_post_account "
-                    "WHERE postId = :postId"));
-        query.bindValue(QStringLiteral(":postId"), posts.postIds);
-        executeBatchSocialCacheQuery(query);
+        // Replacing a post gives it a new rowid
+        if (searchIndex) {
+            query = prepare(QStringLiteral(
+                        "DELETE FROM posts_search "
+                        "WHERE rowid IN ("
+                        "SELECT rowid FROM posts WHERE identifier = :postId)"));
+            query.bindValue(QStringLiteral(":postId"), posts.postIds);
+            executeBatchSocialCacheQuery(query);
+        }
 
         query = prepare(QStringLiteral(
                     "INSERT OR REPLACE INTO posts ("
-                    " identifier, name, body, timestamp) "
+                    " identifier, name, body, timestamp, sequence, extra, contentHash) "
                     "VALUES ("
-                    " :postId, :name, :body, :timestamp)"));
+                    " :postId, :name, :body, :timestamp, :sequence, :extra, :contentHash)"));
         query.bindValue(QStringLiteral(":postId"), posts.postIds);
         query.bindValue(QStringLiteral(":name"), posts.names);
         query.bindValue(QStringLiteral(":body"), posts.bodies);
         query.bindValue(QStringLiteral(":timestamp"), posts.timestamps);
+        query.bindValue(QStringLiteral(":sequence"), posts.sequences);
+        query.bindValue(QStringLiteral(":extra"), posts.extras);
+        query.bindValue(QStringLiteral(":contentHash"), posts.contentHashes);
+        executeBatchSocialCacheQuery(query);
+
+        if (searchIndex) {
+            query = prepare(QStringLiteral(
+                        "INSERT INTO posts_search ("
+                        " rowid, identifier, name, body) "
+                        "SELECT rowid, identifier, name, body FROM posts "
+                        "WHERE identifier = :postId"));
+            query.bindValue(QStringLiteral(":postId"), posts.postIds);
+            executeBatchSocialCacheQuery(query);
+        }
+
+        query = prepare(QStringLiteral(
+                    "DELETE FROM removed_posts "
+                    "WHERE identifier = :postId"));
+        query.bindValue(QStringLiteral(":postId"), posts.postIds);
         executeBatchSocialCacheQuery(query);
     }
 
@@ -559,29 +1205,88 @@ bool AbstractSocialPostCacheDatabase::write()
         executeBatchSocialCacheQuery(query);
     }
 
-    if (!extras.postIds.isEmpty()) {
+    if (!accounts.postIds.isEmpty()) {
         query = prepare(QStringLiteral(
-                    "INSERT INTO extra ("
-                    " postId, key, value) "
+                    "INSERT OR IGNORE INTO link_post_account ("
+                    " postId, account) "
                     "VALUES ("
-                    " :postId, :key, :value)"));
-        query.bindValue(QStringLiteral(":postId"), extras.postIds);
-        query.bindValue(QStringLiteral(":key"), extras.keys);
-        query.bindValue(QStringLiteral(":value"), extras.values);
+                    " :postId, :account)"));
+        query.bindValue(QStringLiteral(":postId"), accounts.postIds);
+        query.bindValue(QStringLiteral(":account"), accounts.accountIds);
         executeBatchSocialCacheQuery(query);
     }
 
-    if (!accounts.postIds.isEmpty()) {
+    // An unchanged post linked to a new account changes too
+    if (!newLinks.postIds.isEmpty()) {
         query = prepare(QStringLiteral(
                     "INSERT INTO link_post_account ("
                     " postId, account) "
                     "VALUES ("
                     " :postId, :account)"));
-        query.bindValue(QStringLiteral(":postId"), accounts.postIds);
-        query.bindValue(QStringLiteral(":account"), accounts.accountIds);
+        query.bindValue(QStringLiteral(":postId"), newLinks.postIds);
+        query.bindValue(QStringLiteral(":account"), newLinks.accountIds);
+        executeBatchSocialCacheQuery(query);
+
+        QVariantList sequences;
+        for (int i = 0; i < newLinks.postIds.count(); ++i) {
+            sequences.append(sequence);
+        }
+
+        query = prepare(QStringLiteral(
+                    "UPDATE posts "
+                    "SET sequence = :sequence "
+                    "WHERE identifier = :postId"));
+        query.bindValue(QStringLiteral(":sequence"), sequences);
+        query.bindValue(QStringLiteral(":postId"), newLinks.postIds);
         executeBatchSocialCacheQuery(query);
     }
 
+    if (retention) {
+        RetentionStatistics statistics;
+        if (!d->applyRetentionPolicy(retentionPolicy, mapPostsToAccounts.values().toSet().toList(),
+                                     sequence, searchIndex, &statistics)) {
+            success = false;
+        }
+
+        if (statistics.evictedPosts > 0 || statistics.evictedLinks > 0) {
+            changed = true;
+        }
+
+        if (success) {
+            locker.relock();
+            d->retentionStatistics.evictedPosts += statistics.evictedPosts;
+            d->retentionStatistics.evictedImages += statistics.evictedImages;
+            d->retentionStatistics.evictedLinks += statistics.evictedLinks;
+            locker.unlock();
+        }
+    }
+
+    if (!changed) {
+        return success;
+    }
+
+    query = prepare(QStringLiteral(
+                "UPDATE post_changes "
+                "SET sequence = :sequence"));
+    query.bindValue(QStringLiteral(":sequence"), sequence);
+    executeSocialCacheQuery(query);
+
+    // Old removals are forgotten in batches. Tokens older than the pruned
+    // sequence make the next incremental refresh read all the posts again.
+    if (sequence - pruned > 2 * REMOVED_POST_HISTORY) {
+        query = prepare(QStringLiteral(
+                    "DELETE FROM removed_posts "
+                    "WHERE sequence <= :pruned"));
+        query.bindValue(QStringLiteral(":pruned"), sequence - REMOVED_POST_HISTORY);
+        executeSocialCacheQuery(query);
+
+        query = prepare(QStringLiteral(
+                    "UPDATE post_changes "
+                    "SET pruned = :pruned"));
+        query.bindValue(QStringLiteral(":pruned"), sequence - REMOVED_POST_HISTORY);
+        executeSocialCacheQuery(query);
+    }
+
     return success;
 }
 
@@ -595,7 +1300,7 @@ bool AbstractSocialPostCacheDatabase::createTables(QSqlDatabase database) const
     //    network, like the facebook id)
     // * name is the displayed name of the poster. Twitter, that
     //   requires both the name and "screen name" of the poster,
-    //   uses an extra field, passed to the extra table.
+    //   uses an extra field, stored in the extra column.
     // * body is the content of the entry.
     // * timestamp is the timestamp, converted to milliseconds
     //   from epoch (makes sorting easier).
@@ -638,9 +1343,141 @@ bool AbstractSocialPostCacheDatabase::createTables(QSqlDatabase database) const
         return false;
     }
 
+    // The tables above are the first version of the schema
+    for (int version = 1; version < POST_DB_VERSION; ++version) {
+        if (!upgradeTables(database, version)) {
+            return false;
+        }
+    }
+
     return true;
 }
 
+bool AbstractSocialPostCacheDatabase::upgradeTables(QSqlDatabase database, int fromVersion) const
+{
+    QSqlQuery query(database);
+
+    switch (fromVersion) {
+    case 1:
+        // Keyset pagination of posts
+        if (!query.exec(QStringLiteral(
+                    "CREATE INDEX IF NOT EXISTS posts_timestamp ON posts (timestamp, identifier)"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to create posts_timestamp index"
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    case 2:
+        // Incremental refresh. sequence is the post_changes sequence of the
+        // last write that changed a post, and removed_posts keeps the recent
+        // removals.
+        if (!query.exec(QStringLiteral(
+                    "ALTER TABLE posts ADD COLUMN sequence INTEGER DEFAULT 0"))
+                || !query.exec(QStringLiteral(
+                    "CREATE INDEX IF NOT EXISTS posts_sequence ON posts (sequence)"))
+                || !query.exec(QStringLiteral(
+                    "CREATE TABLE IF NOT EXISTS removed_posts ("
+                    "identifier TEXT PRIMARY KEY, "
+                    "sequence INTEGER)"))
+                || !query.exec(QStringLiteral(
+                    "CREATE INDEX IF NOT EXISTS removed_posts_sequence ON removed_posts (sequence)"))
+                || !query.exec(QStringLiteral(
+                    "CREATE TABLE IF NOT EXISTS post_changes ("
+                    "sequence INTEGER, "
+                    "pruned INTEGER)"))
+                || !query.exec(QStringLiteral(
+                    "INSERT INTO post_changes (sequence, pruned) VALUES (0, 0)"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to add post change tracking"
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    case 3: {
+        // The extra fields of each post move from the extra table to a
+        // packed column of posts
+        if (!query.exec(QStringLiteral("ALTER TABLE posts ADD COLUMN extra BLOB"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to add extra column"
+                       << query.lastError().text();
+            return false;
+        }
+
+        QMap<QString, QVariantMap> extras;
+        if (!query.exec(QStringLiteral("SELECT postId, key, value FROM extra"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to read extra table"
+                       << query.lastError().text();
+            return false;
+        }
+        while (query.next()) {
+            extras[query.value(0).toString()].insert(query.value(1).toString(), query.value(2));
+        }
+        query.finish();
+
+        if (!extras.isEmpty()) {
+            QVariantList postIds;
+            QVariantList packedExtras;
+            for (QMap<QString, QVariantMap>::const_iterator it = extras.begin();
+                    it != extras.end(); ++it) {
+                postIds.append(it.key());
+                packedExtras.append(packExtra(it.value()));
+            }
+
+            query.prepare(QStringLiteral("UPDATE posts SET extra = :extra WHERE identifier = :postId"));
+            query.bindValue(QStringLiteral(":extra"), packedExtras);
+            query.bindValue(QStringLiteral(":postId"), postIds);
+            if (!query.execBatch()) {
+                qWarning() << Q_FUNC_INFO << "Unable to move extra fields to posts"
+                           << query.lastError().text();
+                return false;
+            }
+        }
+
+        if (!query.exec(QStringLiteral("DROP TABLE extra"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to delete extra table"
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    }
+    case 4:
+        // Lookups of the images of a post, and of the posts of an account,
+        // which the (postId, account) primary key can not serve
+        if (!query.exec(QStringLiteral(
+                    "CREATE INDEX IF NOT EXISTS images_postId ON images (postId, position)"))
+                || !query.exec(QStringLiteral(
+                    "CREATE INDEX IF NOT EXISTS link_post_account_account "
+                    "ON link_post_account (account)"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to create post child indexes"
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    case 5:
+        // Full text search of the names and bodies. The rows share the rowid
+        // of their post, and the table is not created without FTS5.
+        if (AbstractSocialCacheDatabasePrivate::createSearchTable(
+                    database, QStringLiteral("posts_search"),
+                    QStringLiteral("identifier UNINDEXED, name, body"))
+                && !query.exec(QStringLiteral(
+                    "INSERT INTO posts_search (rowid, identifier, name, body) "
+                    "SELECT rowid, identifier, name, body FROM posts"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to index posts for search"
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    case 6:
+        // Posts without a hash are written again the next time they are added
+        if (!query.exec(QStringLiteral("ALTER TABLE posts ADD COLUMN contentHash BLOB"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to add contentHash column"
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
 bool AbstractSocialPostCacheDatabase::dropTables(QSqlDatabase database) const
 {
     QSqlQuery query(database);
@@ -672,6 +1509,27 @@ bool AbstractSocialPostCacheDatabase::dropTables(QSqlDatabase database) const
         return false;
     }
 
+    query.prepare("DROP TABLE IF EXISTS removed_posts");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to delete removed_posts table"
+                   << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("DROP TABLE IF EXISTS posts_search");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to delete posts_search table"
+                   << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("DROP TABLE IF EXISTS post_changes");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to delete post_changes table"
+                   << query.lastError().text();
+        return false;
+    }
+
     return true;
 }
 
@@ -680,8 +1538,48 @@ void AbstractSocialPostCacheDatabase::readFinished()
     Q_D(AbstractSocialPostCacheDatabase);
     QMutexLocker locker(&d->mutex);
 
-    d->posts = d->asyncPosts;
+    d->incremental = d->asyncIncremental;
+    d->changeToken = d->asyncSequence;
+    d->changedPosts.clear();
+    d->removedPosts.clear();
+
+    if (d->asyncIncremental) {
+        QSet<QString> replacedPosts = d->asyncRemovedPosts.toSet();
+        Q_FOREACH (const SocialPost::ConstPtr &post, d->asyncPosts) {
+            replacedPosts.insert(post->identifier());
+        }
+
+        for (int i = d->posts.count() - 1; i >= 0; --i) {
+            const QString identifier = d->posts.at(i)->identifier();
+            if (replacedPosts.contains(identifier)) {
+                d->removedPosts.append(identifier);
+                d->posts.removeAt(i);
+            }
+        }
+
+        // The changed posts are sorted like posts(), and the ones older than
+        // the last post read are left for fetchMore()
+        int index = 0;
+        Q_FOREACH (const SocialPost::ConstPtr &post, d->asyncPosts) {
+            while (index < d->posts.count() && isNewer(d->posts.at(index), post)) {
+                ++index;
+            }
+            if (index == d->posts.count() && d->hasMore && !d->posts.isEmpty()) {
+                break;
+            }
+            d->posts.insert(index, post);
+            d->changedPosts.append(post);
+        }
+    } else {
+        if (d->asyncAppend) {
+            d->posts += d->asyncPosts;
+        } else {
+            d->posts = d->asyncPosts;
+        }
+        d->hasMore = d->asyncHasMore;
+    }
     d->asyncPosts.clear();
+    d->asyncRemovedPosts.clear();
 
     locker.unlock();
 
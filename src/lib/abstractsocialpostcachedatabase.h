@@ -22,7 +22,10 @@
 #include "abstractsocialcachedatabase.h"
 #include <QtCore/QSharedPointer>
 #include <QtCore/QDateTime>
+#include <QtCore/QFuture>
+#include <QtCore/QStringList>
 #include <QtCore/QVariantMap>
+#include <QtCore/QVector>
 
 class SocialPostImagePrivate;
 class SocialPostImage
@@ -61,6 +64,18 @@ public:
     typedef QSharedPointer<SocialPost> Ptr;
     typedef QSharedPointer<const SocialPost> ConstPtr;
 
+    // Images are stored inline in the post. Position 0 is the icon.
+    struct Image
+    {
+        Image() : position(0), type(SocialPostImage::Invalid) {}
+        Image(int position, const QString &url, SocialPostImage::ImageType type)
+            : position(position), url(url), type(type) {}
+
+        int position;
+        QString url;
+        SocialPostImage::ImageType type;
+    };
+
     virtual ~SocialPost();
 
     static SocialPost::Ptr create(const QString &identifier, const QString &name,
@@ -74,12 +89,20 @@ public:
     QString body() const;
     QDateTime timestamp() const;
     QString icon() const;
+
+    // All the images, the icon included, sorted by position
+    const QVector<Image> &imageList() const;
+    void setImageList(const QVector<Image> &images);
+
+    // These create an image object for each image on every call, imageList()
+    // should be preferred.
     QList<SocialPostImage::ConstPtr> images() const;
     QMap<int, SocialPostImage::ConstPtr> allImages() const;
     void setImages(const QMap<int, SocialPostImage::ConstPtr> &images);
-    QVariantMap extra() const;
+
+    const QVariantMap &extra() const;
     void setExtra(const QVariantMap &extra);
-    QList<int> accounts() const;
+    const QList<int> &accounts() const;
     void setAccounts(const QList<int> &accounts);
 
 protected:
@@ -94,17 +117,67 @@ private:
                         const QList<int> &accounts = QList<int>());
 };
 
+Q_DECLARE_TYPEINFO(SocialPost::Image, Q_MOVABLE_TYPE);
+
 class AbstractSocialPostCacheDatabasePrivate;
 class AbstractSocialPostCacheDatabase: public AbstractSocialCacheDatabase
 {
     Q_OBJECT
 public:
+    // Limits of 0 are not enforced. The size is the space used in the
+    // database file, which only shrinks once the maintenance reclaims it.
+    struct RetentionPolicy
+    {
+        RetentionPolicy() : maximumAge(0), maximumPostsPerAccount(0), maximumSize(0) {}
+
+        int maximumAge;                 // Days since the timestamp of a post
+        int maximumPostsPerAccount;     // Newest posts kept for each account
+        qint64 maximumSize;             // Bytes
+    };
+
+    struct RetentionStatistics
+    {
+        RetentionStatistics() : evictedPosts(0), evictedImages(0), evictedLinks(0) {}
+
+        int evictedPosts;
+        int evictedImages;
+        int evictedLinks;       // Accounts removed from posts, including the evicted ones
+    };
+
     explicit AbstractSocialPostCacheDatabase(
             const QString &serviceName, const QString &databaseFile);
     ~AbstractSocialPostCacheDatabase();
 
     QList<SocialPost::ConstPtr> posts() const;
 
+    // With a page size, refresh() reads the newest pageSize posts, or as many
+    // posts as were already read if that is more, and fetchMore() appends the
+    // next pageSize older posts to posts(). A page size of 0 reads all posts.
+    int pageSize() const;
+    void setPageSize(int pageSize);
+    bool canFetchMore() const;
+    void fetchMore();
+
+    // Identifies the state of the cache read by the last refresh. Passing it
+    // to refreshChanges() reads only the posts inserted, updated or removed
+    // since then, and applies them to posts(). changedPosts() then holds the
+    // posts inserted in posts(), and removedPosts() the identifiers of the
+    // posts removed from it, including the previous version of changed ones.
+    // When the changes since the token are no longer known, all the posts are
+    // read again as with refresh(), and incrementalRefresh() returns false.
+    qint64 changeToken() const;
+    void refreshChanges(qint64 token);
+    bool incrementalRefresh() const;
+    QList<SocialPost::ConstPtr> changedPosts() const;
+    QStringList removedPosts() const;
+
+    // Searches the names and bodies of the posts, best matches first. Each
+    // word of text matches the words starting with it. Search needs the FTS5
+    // module of SQLite, and returns no results without it.
+    bool searchAvailable() const;
+    QList<SearchResult> search(const QString &text, int limit = 20) const;
+    QFuture<QList<SearchResult> > searchAsync(const QString &text, int limit = 20) const;
+
     void addPost(const QString &identifier, const QString &name,
                  const QString &body, const QDateTime &timestamp,
                  const QString &icon,
@@ -113,6 +186,12 @@ public:
 
     void removePosts(int accountId);
 
+    // The retention policy is enforced by each write, after its changes, so
+    // that the cache stays bounded without explicit removals.
+    RetentionPolicy retentionPolicy() const;
+    void setRetentionPolicy(const RetentionPolicy &policy);
+    RetentionStatistics retentionStatistics() const;
+
     void commit();
     void refresh();
 
@@ -124,6 +203,7 @@ protected:
     bool write();
     bool createTables(QSqlDatabase database) const;
     bool dropTables(QSqlDatabase database) const;
+    bool upgradeTables(QSqlDatabase database, int fromVersion) const;
 
     void readFinished();
 
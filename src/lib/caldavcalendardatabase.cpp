@@ -90,8 +90,8 @@ CalDavCalendarDatabase::~CalDavCalendarDatabase()
 
 QStringList CalDavCalendarDatabase::additions(const QString &notebookUid, bool *ok)
 {
-    static const QString queryString = QStringLiteral("SELECT incidenceUid FROM Additions WHERE notebookUid = '%1'");
-    QSqlQuery query = prepare(queryString.arg(notebookUid));
+    QSqlQuery query = prepare(QStringLiteral("SELECT incidenceUid FROM Additions WHERE notebookUid = :notebookUid"));
+    query.bindValue(QStringLiteral(":notebookUid"), notebookUid);
     if (!query.exec()) {
         qWarning() << "SQL query failed:" << query.executedQuery() << "Error:" << query.lastError().text();
         *ok = false;
@@ -107,8 +107,8 @@ QStringList CalDavCalendarDatabase::additions(const QString &notebookUid, bool *
 
 QHash<QString, QString> CalDavCalendarDatabase::modifications(const QString &notebookUid, bool *ok)
 {
-    static const QString queryString = QStringLiteral("SELECT incidenceUid,iCalData FROM Modifications WHERE notebookUid = '%1'");
-    QSqlQuery query = prepare(queryString.arg(notebookUid));
+    QSqlQuery query = prepare(QStringLiteral("SELECT incidenceUid,iCalData FROM Modifications WHERE notebookUid = :notebookUid"));
+    query.bindValue(QStringLiteral(":notebookUid"), notebookUid);
     if (!query.exec()) {
         qWarning() << "SQL query failed:" << query.executedQuery() << "Error:" << query.lastError().text();
         return QHash<QString, QString>();
@@ -123,8 +123,8 @@ QHash<QString, QString> CalDavCalendarDatabase::modifications(const QString &not
 
 QStringList CalDavCalendarDatabase::deletions(const QString &notebookUid, bool *ok)
 {
-    static const QString queryString = QStringLiteral("SELECT incidenceUid FROM Deletions WHERE notebookUid = '%1'");
-    QSqlQuery query = prepare(queryString.arg(notebookUid));
+    QSqlQuery query = prepare(QStringLiteral("SELECT incidenceUid FROM Deletions WHERE notebookUid = :notebookUid"));
+    query.bindValue(QStringLiteral(":notebookUid"), notebookUid);
     if (!query.exec()) {
         qWarning() << "SQL query failed:" << query.executedQuery() << "Error:" << query.lastError().text();
         *ok = false;
@@ -185,8 +185,8 @@ void CalDavCalendarDatabase::removeEntries(const QString &notebookUid)
 
 QHash<QString, QString> CalDavCalendarDatabase::eTags(const QString &notebookUid, bool *ok)
 {
-    static const QString queryString = QStringLiteral("SELECT incidenceUid,eTag FROM ETags WHERE notebookUid = '%1'");
-    QSqlQuery query = prepare(queryString.arg(notebookUid));
+    QSqlQuery query = prepare(QStringLiteral("SELECT incidenceUid,eTag FROM ETags WHERE notebookUid = :notebookUid"));
+    query.bindValue(QStringLiteral(":notebookUid"), notebookUid);
     if (!query.exec()) {
         qWarning() << "SQL query failed:" << query.executedQuery() << "Error:" << query.lastError().text();
         return QHash<QString, QString>();
@@ -290,15 +290,16 @@ bool CalDavCalendarDatabasePrivate::writeNotebookRemovals(const QString &table,
     if (notebookUids.isEmpty()) {
         return true;
     }
-    QStringList uids;
+    QVariantList notebookUidsVariants;
     Q_FOREACH (const QString &notebookUid, notebookUids) {
-        uids << ("'" + notebookUid + "'");
+        notebookUidsVariants << notebookUid;
     }
     bool success = true;
-    QString queryString = QStringLiteral("DELETE FROM %1 WHERE notebookUid IN (%2)");
-    queryString = queryString.arg(table).arg(uids.join(","));
-    QSqlQuery query = q->prepare(queryString);
-    executeSocialCacheQuery(query);
+    // table is one of the fixed table names, so this prepares one statement per table
+    QSqlQuery query = q->prepare(QString(QStringLiteral(
+                "DELETE FROM %1 WHERE notebookUid = :notebookUid")).arg(table));
+    query.bindValue(QStringLiteral(":notebookUid"), notebookUidsVariants);
+    executeBatchSocialCacheQuery(query);
 
     return success;
 }
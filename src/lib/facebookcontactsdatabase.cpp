@@ -22,14 +22,13 @@
 #include "socialsyncinterface.h"
 
 #include <QtCore/QStringList>
-#include <QtCore/QFile>
 #include <QtSql/QSqlQuery>
 #include <QtSql/QSqlError>
 
 #include <QtDebug>
 
 static const char *DB_NAME = "facebook.db";
-static const int VERSION = 3;
+static const int VERSION = 5;
 
 static const char *PICTURE_FILE_KEY = "pictureFile";
 static const char *COVER_FILE_KEY = "coverFile";
@@ -116,8 +115,6 @@ class FacebookContactsDatabasePrivate: public AbstractSocialCacheDatabasePrivate
 public:
     explicit FacebookContactsDatabasePrivate(FacebookContactsDatabase *q);
 
-    void clearCachedImages(QSqlQuery &query);
-
     struct {
         QList<int> removeAccounts;
         QStringList removeContacts;
@@ -135,33 +132,14 @@ FacebookContactsDatabasePrivate::FacebookContactsDatabasePrivate(FacebookContact
             QLatin1String(DB_NAME),
             VERSION)
 {
-}
-
-void FacebookContactsDatabasePrivate::clearCachedImages(QSqlQuery &query)
-{
-    while (query.next()) {
-        QString picture = query.value(0).toString();
-        QString cover = query.value(1).toString();
-
-        if (!picture.isEmpty()) {
-            QFile pictureFile (picture);
-            if (pictureFile.exists()) {
-                pictureFile.remove();
-            }
-        }
-
-        if (!cover.isEmpty()) {
-            QFile coverFile (cover);
-            if (coverFile.exists()) {
-                coverFile.remove();
-            }
-        }
-    }
+    referencedFiles = QStringLiteral(
+                "SELECT pictureFile FROM friends UNION ALL SELECT coverFile FROM friends");
 }
 
 FacebookContactsDatabase::FacebookContactsDatabase()
     : AbstractSocialCacheDatabase(*(new FacebookContactsDatabasePrivate(this)))
 {
+    setTuningProfile(TuningProfile::preset(ReadMostlyTuning));
 }
 
 FacebookContactsDatabase::~FacebookContactsDatabase()
@@ -267,6 +245,30 @@ QStringList FacebookContactsDatabase::contactIds(int accountId) const
     return data;
 }
 
+QFuture<FacebookContact::ConstPtr> FacebookContactsDatabase::contactAsync(const QString &fbFriendId,
+                                                                        int accountId) const
+{
+    Q_D(const FacebookContactsDatabase);
+
+    return d->startQuery<FacebookContact::ConstPtr>(
+                this, &FacebookContactsDatabase::contact, fbFriendId, accountId);
+}
+
+QFuture<QList<FacebookContact::ConstPtr> > FacebookContactsDatabase::contactsAsync(int accountId) const
+{
+    Q_D(const FacebookContactsDatabase);
+
+    return d->startQuery<QList<FacebookContact::ConstPtr> >(
+                this, &FacebookContactsDatabase::contacts, accountId);
+}
+
+QFuture<QStringList> FacebookContactsDatabase::contactIdsAsync(int accountId) const
+{
+    Q_D(const FacebookContactsDatabase);
+
+    return d->startQuery<QStringList>(this, &FacebookContactsDatabase::contactIds, accountId);
+}
+
 void FacebookContactsDatabase::addSyncedContact(const QString &fbFriendId, int accountId,
                                                 const QString &pictureUrl, const QString &coverUrl)
 {
@@ -339,8 +341,8 @@ bool FacebookContactsDatabase::write()
             if (!query.exec()) {
                 qWarning() << Q_FUNC_INFO << "Failed to exec cached contacts selection query:"
                            << query.lastError().text();
-            } else {
-                d->clearCachedImages(query);
+            } else if (!d->queueFileRemovals(query)) {
+                success = false;
             }
         }
 
@@ -365,8 +367,8 @@ bool FacebookContactsDatabase::write()
             if (!query.exec()) {
                 qWarning() << Q_FUNC_INFO << "Failed to exec cached contacts selection query:"
                            << query.lastError().text();
-            } else {
-                d->clearCachedImages(query);
+            } else if (!d->queueFileRemovals(query)) {
+                success = false;
             }
         }
 
@@ -416,6 +418,11 @@ bool FacebookContactsDatabase::write()
             pictureFiles.append(it.value());
         }
 
+        // Files downloaded again to a path queued for removal are kept
+        if (!d->cancelFileRemovals(pictureFiles)) {
+            success = false;
+        }
+
         query = prepare(QStringLiteral(
                     "UPDATE friends "
                     "SET pictureFile = :pictureFile "
@@ -436,6 +443,10 @@ bool FacebookContactsDatabase::write()
             coverFiles.append(it.value());
         }
 
+        if (!d->cancelFileRemovals(coverFiles)) {
+            success = false;
+        }
+
         query = prepare(QStringLiteral(
                     "UPDATE friends "
                     "SET coverFile = :coverFile "
@@ -464,9 +475,28 @@ bool FacebookContactsDatabase::createTables(QSqlDatabase database) const
         return false;
     }
 
+    // The table above is version 3 of the schema
+    for (int version = 3; version < VERSION; ++version) {
+        if (!upgradeTables(database, version)) {
+            return false;
+        }
+    }
+
     return true;
 }
 
+bool FacebookContactsDatabase::upgradeTables(QSqlDatabase database, int fromVersion) const
+{
+    switch (fromVersion) {
+    case 3:
+        return AbstractSocialCacheDatabasePrivate::createFileRemovalTable(database);
+    case 4:
+        return AbstractSocialCacheDatabasePrivate::addFileRemovalTimes(database);
+    default:
+        return false;
+    }
+}
+
 bool FacebookContactsDatabase::dropTables(QSqlDatabase database) const
 {
     QSqlQuery query(database);
@@ -22,6 +22,7 @@
 
 #include "abstractsocialcachedatabase.h"
 #include <QtCore/QSharedPointer>
+#include <QtCore/QFuture>
 
 class FacebookContactPrivate;
 class FacebookContact
@@ -62,6 +63,12 @@ public:
     FacebookContact::ConstPtr contact(const QString &fbFriendId, int accountId) const;
     QList<FacebookContact::ConstPtr> contacts(int accountId) const;
     QStringList contactIds(int accountId) const;
+
+    // Asynchronous variants, reading from a worker thread
+    QFuture<FacebookContact::ConstPtr> contactAsync(const QString &fbFriendId, int accountId) const;
+    QFuture<QList<FacebookContact::ConstPtr> > contactsAsync(int accountId) const;
+    QFuture<QStringList> contactIdsAsync(int accountId) const;
+
     void addSyncedContact(const QString &fbFriendId, int accountId, const QString &pictureUrl,
                           const QString &coverUrl);
     void updatePictureFile(const QString &fbFriendId, const QString &pictureFile);
@@ -73,6 +80,7 @@ protected:
     bool write();
     bool createTables(QSqlDatabase database) const;
     bool dropTables(QSqlDatabase database) const;
+    bool upgradeTables(QSqlDatabase database, int fromVersion) const;
 
 private:
     Q_DECLARE_PRIVATE(FacebookContactsDatabase)
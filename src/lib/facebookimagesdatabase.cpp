@@ -18,17 +18,19 @@
  */
 
 #include "facebookimagesdatabase.h"
+#include "facebookimagesdatabase_p.h"
 #include "abstractsocialcachedatabase.h"
 #include "socialsyncinterface.h"
 
+#include <QtCore/QFileInfo>
 #include <QtSql/QSqlQuery>
 #include <QtSql/QSqlError>
-#include <QtCore/QFile>
 
 #include <QtDebug>
 
 static const char *DB_NAME = "facebook.db";
-static const int VERSION = 3;
+static const int VERSION = 11;
+static const int FILE_SIZE_BATCH_SIZE = 100;
 
 struct FacebookUserPrivate
 {
@@ -325,12 +327,12 @@ public:
 private:
     Q_DECLARE_PUBLIC(FacebookImagesDatabase)
 
-    static void clearCachedImages(QSqlQuery &query);
-
     QList<FacebookUser::ConstPtr> queryUsers() const;
     QList<FacebookAlbum::ConstPtr> queryAlbums(const QString &fbUserId) const;
 
-    QList<FacebookImage::ConstPtr> queryImages(const QString &fbUserId, const QString &fbAlbumId);
+    QList<FacebookImage::ConstPtr> queryImages(const QString &fbUserId, const QString &fbAlbumId,
+                                               int limit, bool after, qint64 updatedTime,
+                                               const QString &fbImageId);
 
     struct {
         QList<int> purgeAccounts;
@@ -347,21 +349,53 @@ private:
 
         QMap<QString, QString> updateThumbnailFiles;
         QMap<QString, QString> updateImageFiles;
+
+        QHash<QString, qint64> accessedImages;
+        QHash<QString, QPair<qint64, qint64> > fileSizes;
     } queue;
 
     struct {
         QueryType type;
         QString id;
+        // Images are read after the (updatedTime, fbImageId) of the last
+        // image read when appending
+        int limit;
+        bool append;
+        qint64 updatedTime;
+        QString fbImageId;
+
+        QueryType readType;
+        QString readId;
         QList<FacebookUser::ConstPtr> users;
+        int totalImageCount;
         QList<FacebookAlbum::ConstPtr> albums;
         QList<FacebookImage::ConstPtr> images;
+        bool appended;
+        bool hasMore;
     } query;
 
     struct {
+        QueryType type;
+        QString id;
         QList<FacebookUser::ConstPtr> users;
+        int totalImageCount;
         QList<FacebookAlbum::ConstPtr> albums;
         QList<FacebookImage::ConstPtr> images;
+        bool appended;
+        bool hasMore;
     } result;
+
+    int pageSize;
+
+    qint64 diskBudget;
+    bool evictionNeeded;
+    bool fileSizesKnown;
+    QStringList evictedImages;
+
+    void setImageWindow(QueryType type, const QString &id);
+    bool updateFiles(const QString &fileColumn, const QString &sizeColumn,
+                     const QMap<QString, QString> &files);
+    bool evictFiles(qint64 budget);
 };
 
 FacebookImagesDatabasePrivate::FacebookImagesDatabasePrivate(FacebookImagesDatabase *q)
@@ -371,48 +405,166 @@ FacebookImagesDatabasePrivate::FacebookImagesDatabasePrivate(FacebookImagesDatab
             SocialSyncInterface::dataType(SocialSyncInterface::Images),
             QLatin1String(DB_NAME),
             VERSION)
+    , pageSize(0)
+    , diskBudget(0)
+    , evictionNeeded(false)
+    , fileSizesKnown(false)
 {
+    referencedFiles = QStringLiteral(
+                "SELECT thumbnailFile FROM images UNION ALL SELECT imageFile FROM images");
+
+    query.type = Users;
+    query.limit = -1;
+    query.append = false;
+    query.updatedTime = 0;
+    query.readType = Users;
+    query.totalImageCount = 0;
+    query.appended = false;
+    query.hasMore = false;
+
+    result.type = Users;
+    result.totalImageCount = 0;
+    result.appended = false;
+    result.hasMore = false;
 }
 
 FacebookImagesDatabasePrivate::~FacebookImagesDatabasePrivate()
 {
 }
 
-void FacebookImagesDatabasePrivate::clearCachedImages(QSqlQuery &query)
+// Should be called with the mutex locked
+void FacebookImagesDatabasePrivate::setImageWindow(QueryType type, const QString &id)
 {
-    while (query.next()) {
-        QString thumb = query.value(0).toString();
-        QString image = query.value(1).toString();
+    query.type = type;
+    query.id = id;
+    query.append = false;
 
-        if (!thumb.isEmpty()) {
-            QFile thumbFile (thumb);
-            if (thumbFile.exists()) {
-                thumbFile.remove();
-            }
-        }
+    // Refreshing the images read keeps as many images as were already read
+    if (pageSize <= 0) {
+        query.limit = -1;
+    } else if (result.type == type && result.id == id) {
+        query.limit = qMax(pageSize, result.images.count());
+    } else {
+        query.limit = pageSize;
+    }
+}
 
-        if (!image.isEmpty()) {
-            QFile imageFile (image);
-            if (imageFile.exists()) {
-                imageFile.remove();
-            }
-        }
+// Sets the files of images, with their size. Setting a file counts as an access.
+bool FacebookImagesDatabasePrivate::updateFiles(const QString &fileColumn, const QString &sizeColumn,
+                                                const QMap<QString, QString> &files)
+{
+    Q_Q(FacebookImagesDatabase);
+
+    QVariantList imageIds;
+    QVariantList paths;
+    QVariantList sizes;
+    QVariantList accessTimes;
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (QMap<QString, QString>::const_iterator it = files.begin(); it != files.end(); ++it) {
+        imageIds.append(it.key());
+        paths.append(it.value());
+        sizes.append(QFileInfo(it.value()).size());
+        accessTimes.append(now);
+    }
+
+    // Files downloaded again to a path queued for removal are kept
+    if (!cancelFileRemovals(paths)) {
+        return false;
     }
 
+    QSqlQuery query = q->prepare(QString(QLatin1String(
+                "UPDATE images "
+                "SET %1 = :file, %2 = :size, lastAccess = :lastAccess "
+                "WHERE fbImageId = :fbImageId")).arg(fileColumn, sizeColumn));
+    query.bindValue(QStringLiteral(":file"), paths);
+    query.bindValue(QStringLiteral(":size"), sizes);
+    query.bindValue(QStringLiteral(":lastAccess"), accessTimes);
+    query.bindValue(QStringLiteral(":fbImageId"), imageIds);
+    if (!query.execBatch()) {
+        qWarning() << Q_FUNC_INFO << "Failed to update" << fileColumn << query.lastError().text();
+        return false;
+    }
+    query.finish();
+    return true;
 }
 
-QList<FacebookImage::ConstPtr> FacebookImagesDatabasePrivate::queryImages(const QString &fbUserId,
-                                                                          const QString &fbAlbumId)
+// Evicts the files of the least recently accessed images until the files of
+// all images fit in the budget. The files are removed after the write.
+// Images with a file which size is not known yet (-1) are left out until
+// writeCommitted() has measured it, so that they neither count toward the
+// excess nor get evicted for it.
+bool FacebookImagesDatabasePrivate::evictFiles(qint64 budget)
 {
     Q_Q(FacebookImagesDatabase);
 
-    QList<FacebookImage::ConstPtr> data;
+    QSqlQuery query = q->prepare(QStringLiteral(
+                "SELECT COALESCE(SUM(thumbnailSize + imageSize), 0) "
+                "FROM images "
+                "WHERE thumbnailSize >= 0 AND imageSize >= 0"));
+    if (!query.exec() || !query.next()) {
+        qWarning() << Q_FUNC_INFO << "Failed to read the size of cached files:"
+                   << query.lastError().text();
+        return false;
+    }
+    qint64 excess = query.value(0).toLongLong() - budget;
+    query.finish();
 
-    if (!fbUserId.isEmpty() && !fbAlbumId.isEmpty()) {
-        qWarning() << Q_FUNC_INFO << "Cannot select images in both an album and for an user";
-        return data;
+    if (excess <= 0) {
+        return true;
+    }
+
+    QVariantList imageIds;
+    QVariantList paths;
+
+    query = q->prepare(QStringLiteral(
+                "SELECT fbImageId, thumbnailFile, imageFile, thumbnailSize + imageSize "
+                "FROM images "
+                "WHERE thumbnailSize >= 0 AND imageSize >= 0 "
+                "AND thumbnailSize + imageSize > 0 "
+                "ORDER BY lastAccess"));
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to select files to evict:"
+                   << query.lastError().text();
+        return false;
+    }
+    while (excess > 0 && query.next()) {
+        imageIds.append(query.value(0));
+        for (int i = 1; i <= 2; ++i) {
+            const QString path = query.value(i).toString();
+            if (!path.isEmpty()) {
+                paths.append(path);
+            }
+        }
+        excess -= query.value(3).toLongLong();
+    }
+    query.finish();
+
+    if (imageIds.isEmpty() || !queueFileRemovals(paths)) {
+        return imageIds.isEmpty();
+    }
+
+    // The images are downloaded again when they are needed
+    query = q->prepare(QStringLiteral(
+                "UPDATE images "
+                "SET thumbnailFile = NULL, imageFile = NULL, thumbnailSize = 0, imageSize = 0 "
+                "WHERE fbImageId = :fbImageId"));
+    query.bindValue(QStringLiteral(":fbImageId"), imageIds);
+    if (!query.execBatch()) {
+        qWarning() << Q_FUNC_INFO << "Failed to clear evicted files:" << query.lastError().text();
+        return false;
     }
+    query.finish();
 
+    QMutexLocker locker(&mutex);
+    Q_FOREACH (const QVariant &imageId, imageIds) {
+        evictedImages.append(imageId.toString());
+    }
+    return true;
+}
+
+QString FacebookImagesQueries::images(bool forUser, bool forAlbum, bool after, bool limited)
+{
     QString queryString = QLatin1String("SELECT images.fbImageId, images.fbAlbumId, "\
                                         "images.fbUserId, images.createdTime, "\
                                         "images.updatedTime, images.imageName, images.width, "\
@@ -422,18 +574,77 @@ QList<FacebookImage::ConstPtr> FacebookImagesDatabasePrivate::queryImages(const
                                         "FROM images "\
                                         "INNER JOIN accounts "\
                                         "ON accounts.fbUserId = images.fbUserId%1 "\
-                                        "ORDER BY images.updatedTime %2");
+                                        "ORDER BY images.updatedTime %2, images.fbImageId %2%3");
 
-    if (!fbUserId.isEmpty()) {
-        queryString = queryString.arg(QLatin1String(" WHERE images.fbUserId = :fbUserId"),
-                                      QLatin1String("DESC"));
-    } else if (!fbAlbumId.isEmpty()){
-        queryString = queryString.arg(QLatin1String(" WHERE images.fbAlbumId = :fbAlbumId"),
-                                      QString());
-    } else {
-        queryString = queryString.arg(QString(), QLatin1String("DESC"));
+    // Album images are sorted from the oldest, the others from the newest
+    const bool ascending = forAlbum;
+
+    QStringList conditions;
+    if (forUser) {
+        conditions.append(QLatin1String("images.fbUserId = :fbUserId"));
+    } else if (forAlbum) {
+        conditions.append(QLatin1String("images.fbAlbumId = :fbAlbumId"));
+    }
+    if (after && ascending) {
+        conditions.append(QLatin1String(
+                    "images.updatedTime >= :updatedTime AND "
+                    "(images.updatedTime > :sameUpdatedTime OR images.fbImageId > :fbImageId)"));
+    } else if (after) {
+        conditions.append(QLatin1String(
+                    "images.updatedTime <= :updatedTime AND "
+                    "(images.updatedTime < :sameUpdatedTime OR images.fbImageId < :fbImageId)"));
+    }
+
+    return queryString.arg(
+                conditions.isEmpty()
+                        ? QString()
+                        : QString(QLatin1String(" WHERE ") + conditions.join(QLatin1String(" AND "))),
+                ascending ? QLatin1String("ASC") : QLatin1String("DESC"),
+                limited ? QLatin1String(" LIMIT :limit") : QLatin1String(""));
+}
+
+QString FacebookImagesQueries::userFiles()
+{
+    return QStringLiteral(
+                "SELECT thumbnailFile, imageFile "
+                "FROM images "
+                "WHERE fbUserId = :fbUserId");
+}
+
+QString FacebookImagesQueries::albumFiles()
+{
+    return QStringLiteral(
+                "SELECT thumbnailFile, imageFile "
+                "FROM images "
+                "WHERE fbAlbumId = :fbAlbumId");
+}
+
+QString FacebookImagesQueries::imageFiles()
+{
+    return QStringLiteral(
+                "SELECT thumbnailFile, imageFile "
+                "FROM images "
+                "WHERE fbImageId = :fbImageId");
+}
+
+QList<FacebookImage::ConstPtr> FacebookImagesDatabasePrivate::queryImages(const QString &fbUserId,
+                                                                          const QString &fbAlbumId,
+                                                                          int limit, bool after,
+                                                                          qint64 updatedTime,
+                                                                          const QString &fbImageId)
+{
+    Q_Q(FacebookImagesDatabase);
+
+    QList<FacebookImage::ConstPtr> data;
+
+    if (!fbUserId.isEmpty() && !fbAlbumId.isEmpty()) {
+        qWarning() << Q_FUNC_INFO << "Cannot select images in both an album and for an user";
+        return data;
     }
 
+    const QString queryString = FacebookImagesQueries::images(
+                !fbUserId.isEmpty(), !fbAlbumId.isEmpty(), after, limit >= 0);
+
     QSqlQuery query = q->prepare(queryString);
     if (!fbUserId.isEmpty()) {
         query.bindValue(":fbUserId", fbUserId);
@@ -441,6 +652,14 @@ QList<FacebookImage::ConstPtr> FacebookImagesDatabasePrivate::queryImages(const
     if (!fbAlbumId.isEmpty()) {
         query.bindValue(":fbAlbumId", fbAlbumId);
     }
+    if (after) {
+        query.bindValue(":updatedTime", updatedTime);
+        query.bindValue(":sameUpdatedTime", updatedTime);
+        query.bindValue(":fbImageId", fbImageId);
+    }
+    if (limit >= 0) {
+        query.bindValue(":limit", limit);
+    }
 
     if (!query.exec()) {
         qWarning() << Q_FUNC_INFO << "Failed to query all albums:" << query.lastError().text();
@@ -487,6 +706,7 @@ bool operator==(const FacebookImage::ConstPtr &image1, const FacebookImage::Cons
 FacebookImagesDatabase::FacebookImagesDatabase()
     : AbstractSocialCacheDatabase(*(new FacebookImagesDatabasePrivate(this)))
 {
+    setTuningProfile(TuningProfile::preset(ReadMostlyTuning));
 }
 
 FacebookImagesDatabase::~FacebookImagesDatabase()
@@ -566,12 +786,9 @@ QList<FacebookUser::ConstPtr> FacebookImagesDatabasePrivate::queryUsers() const
     QList<FacebookUser::ConstPtr> data;
 
     QSqlQuery query = q_func()->prepare(QStringLiteral(
-                "SELECT users.fbUserId, users.updatedTime, users.userName, "
-                "COUNT(fbImageId) as count "
+                "SELECT fbUserId, updatedTime, userName, imageCount "
                 "FROM users "
-                "LEFT JOIN images ON images.fbUserId = users.fbUserId "
-                "GROUP BY users.fbUserId "
-                "ORDER BY users.fbUserId"));
+                "ORDER BY fbUserId"));
     if (!query.exec()) {
         qWarning() << Q_FUNC_INFO << "Failed to query all users:" << query.lastError().text();
         return data;
@@ -586,6 +803,30 @@ QList<FacebookUser::ConstPtr> FacebookImagesDatabasePrivate::queryUsers() const
     return data;
 }
 
+int FacebookImagesDatabase::imageCount(bool *ok) const
+{
+    if (ok) {
+        *ok = false;
+    }
+
+    QSqlQuery query = prepare(QStringLiteral(
+                "SELECT COALESCE(SUM(imageCount), 0) "
+                "FROM users"));
+    if (!query.exec() || !query.next()) {
+        qWarning() << Q_FUNC_INFO << "Unable to count images" << query.lastError().text();
+        return 0;
+    }
+
+    int count = query.value(0).toInt();
+    query.finish();
+
+    if (ok) {
+        *ok = true;
+    }
+
+    return count;
+}
+
 QStringList FacebookImagesDatabase::allAlbumIds(bool *ok) const
 {
     if (ok) {
@@ -813,6 +1054,35 @@ FacebookImage::ConstPtr FacebookImagesDatabase::image(const QString &fbImageId)
                                  query.value(10).toString(), query.value(11).toString());
 }
 
+QFuture<FacebookUser::ConstPtr> FacebookImagesDatabase::userAsync(const QString &fbUserId) const
+{
+    Q_D(const FacebookImagesDatabase);
+
+    return d->startQuery<FacebookUser::ConstPtr>(this, &FacebookImagesDatabase::user, fbUserId);
+}
+
+QFuture<FacebookAlbum::ConstPtr> FacebookImagesDatabase::albumAsync(const QString &fbAlbumId) const
+{
+    Q_D(const FacebookImagesDatabase);
+
+    return d->startQuery<FacebookAlbum::ConstPtr>(this, &FacebookImagesDatabase::album, fbAlbumId);
+}
+
+QFuture<FacebookImage::ConstPtr> FacebookImagesDatabase::imageAsync(const QString &fbImageId) const
+{
+    Q_D(const FacebookImagesDatabase);
+
+    return d->startQuery<FacebookImage::ConstPtr>(this, &FacebookImagesDatabase::image, fbImageId);
+}
+
+QFuture<QStringList> FacebookImagesDatabase::allImageIdsAsync() const
+{
+    Q_D(const FacebookImagesDatabase);
+
+    return d->startQuery<QStringList>(
+                this, &FacebookImagesDatabase::allImageIds, static_cast<bool *>(0));
+}
+
 void FacebookImagesDatabase::removeImage(const QString &fbImageId)
 {
     Q_D(FacebookImagesDatabase);
@@ -873,6 +1143,11 @@ QList<FacebookUser::ConstPtr> FacebookImagesDatabase::users() const
     return d_func()->result.users;
 }
 
+int FacebookImagesDatabase::totalImageCount() const
+{
+    return d_func()->result.totalImageCount;
+}
+
 QList<FacebookImage::ConstPtr> FacebookImagesDatabase::images() const
 {
     return d_func()->result.images;
@@ -883,6 +1158,82 @@ QList<FacebookAlbum::ConstPtr> FacebookImagesDatabase::albums() const
     return d_func()->result.albums;
 }
 
+qint64 FacebookImagesDatabase::diskBudget() const
+{
+    Q_D(const FacebookImagesDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    return d->diskBudget;
+}
+
+void FacebookImagesDatabase::setDiskBudget(qint64 bytes)
+{
+    Q_D(FacebookImagesDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    if (d->diskBudget != qMax<qint64>(0, bytes)) {
+        d->diskBudget = qMax<qint64>(0, bytes);
+        d->evictionNeeded = true;
+    }
+}
+
+void FacebookImagesDatabase::recordAccess(const QString &fbImageId)
+{
+    Q_D(FacebookImagesDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->queue.accessedImages.insert(fbImageId, QDateTime::currentMSecsSinceEpoch());
+}
+
+bool FacebookImagesDatabase::imagesAppended() const
+{
+    return d_func()->result.appended;
+}
+
+int FacebookImagesDatabase::pageSize() const
+{
+    return d_func()->pageSize;
+}
+
+void FacebookImagesDatabase::setPageSize(int pageSize)
+{
+    Q_D(FacebookImagesDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->pageSize = qMax(0, pageSize);
+}
+
+bool FacebookImagesDatabase::canFetchMore() const
+{
+    Q_D(const FacebookImagesDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    return d->result.hasMore && !d->result.images.isEmpty();
+}
+
+void FacebookImagesDatabase::fetchMore()
+{
+    Q_D(FacebookImagesDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    // A read in progress would replace the images
+    if (!d->result.hasMore || d->result.images.isEmpty() || d->readStatus == Executing) {
+        return;
+    }
+
+    const FacebookImage::ConstPtr &last = d->result.images.last();
+    d->query.type = d->result.type;
+    d->query.id = d->result.id;
+    d->query.limit = d->pageSize;
+    d->query.append = true;
+    d->query.updatedTime = last->updatedTime().toTime_t();
+    d->query.fbImageId = last->fbImageId();
+
+    locker.unlock();
+
+    executeRead();
+}
+
 void FacebookImagesDatabase::queryUsers()
 {
     Q_D(FacebookImagesDatabase);
@@ -909,8 +1260,7 @@ void FacebookImagesDatabase::queryUserImages(const QString &userId)
     Q_D(FacebookImagesDatabase);
     {
         QMutexLocker locker(&d->mutex);
-        d->query.type = FacebookImagesDatabasePrivate::UserImages;
-        d->query.id = userId;
+        d->setImageWindow(FacebookImagesDatabasePrivate::UserImages, userId);
     }
     executeRead();
 }
@@ -920,8 +1270,7 @@ void FacebookImagesDatabase::queryAlbumImages(const QString &albumId)
     Q_D(FacebookImagesDatabase);
     {
         QMutexLocker locker(&d->mutex);
-        d->query.type = FacebookImagesDatabasePrivate::AlbumImages;
-        d->query.id = albumId;
+        d->setImageWindow(FacebookImagesDatabasePrivate::AlbumImages, albumId);
     }
     executeRead();
 }
@@ -931,12 +1280,19 @@ bool FacebookImagesDatabase::read()
     Q_D(FacebookImagesDatabase);
     QMutexLocker locker(&d->mutex);
 
+    d->query.readType = d->query.type;
+    d->query.readId = d->query.id;
+    d->query.appended = false;
+    d->query.hasMore = false;
+
     switch (d->query.type) {
     case FacebookImagesDatabasePrivate::Users: {
         locker.unlock();
         QList<FacebookUser::ConstPtr> users = d->queryUsers();
+        const int totalImageCount = imageCount();
         locker.relock();
         d->query.users = users;
+        d->query.totalImageCount = totalImageCount;
         return true;
     }
     case FacebookImagesDatabasePrivate::Albums: {
@@ -955,10 +1311,17 @@ bool FacebookImagesDatabase::read()
         const QString albumId = d->query.type == FacebookImagesDatabasePrivate::AlbumImages
                 ? d->query.id
                 : QString();
+        const int limit = d->query.limit;
+        const bool append = d->query.append;
+        const qint64 updatedTime = d->query.updatedTime;
+        const QString fbImageId = d->query.fbImageId;
         locker.unlock();
-        QList<FacebookImage::ConstPtr> images = d->queryImages(userId, albumId);
+        QList<FacebookImage::ConstPtr> images = d->queryImages(
+                    userId, albumId, limit, append, updatedTime, fbImageId);
         locker.relock();
         d->query.images = images;
+        d->query.appended = append;
+        d->query.hasMore = limit >= 0 && images.count() == limit;
         return true;
     }
     default:
@@ -972,9 +1335,18 @@ void FacebookImagesDatabase::readFinished()
     {
         QMutexLocker locker(&d->mutex);
 
+        d->result.type = d->query.readType;
+        d->result.id = d->query.readId;
         d->result.users = d->query.users;
+        d->result.totalImageCount = d->query.totalImageCount;
         d->result.albums = d->query.albums;
-        d->result.images = d->query.images;
+        if (d->query.appended) {
+            d->result.images += d->query.images;
+        } else {
+            d->result.images = d->query.images;
+        }
+        d->result.appended = d->query.appended;
+        d->result.hasMore = d->query.hasMore;
 
         d->query.users.clear();
         d->query.albums.clear();
@@ -983,6 +1355,68 @@ void FacebookImagesDatabase::readFinished()
     emit queryFinished();
 }
 
+void FacebookImagesDatabase::writeFinished()
+{
+    Q_D(FacebookImagesDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    const QStringList evictedImages = d->evictedImages;
+    d->evictedImages.clear();
+
+    locker.unlock();
+
+    if (!evictedImages.isEmpty()) {
+        emit imagesEvicted(evictedImages);
+    }
+}
+
+void FacebookImagesDatabase::writeCommitted()
+{
+    Q_D(FacebookImagesDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    if (d->diskBudget <= 0 || d->fileSizesKnown) {
+        return;
+    }
+
+    locker.unlock();
+
+    // Files cached before their size was stored are measured a batch at a
+    // time outside the database lock, and the sizes are stored by the next write
+    QSqlQuery query = prepare(QStringLiteral(
+                "SELECT fbImageId, thumbnailFile, imageFile, thumbnailSize, imageSize "
+                "FROM images "
+                "WHERE thumbnailSize < 0 OR imageSize < 0 "
+                "LIMIT :limit"));
+    query.bindValue(QStringLiteral(":limit"), FILE_SIZE_BATCH_SIZE);
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to select files of unknown size:"
+                   << query.lastError().text();
+        return;
+    }
+
+    QHash<QString, QPair<qint64, qint64> > fileSizes;
+    while (query.next()) {
+        const qint64 thumbnailSize = query.value(3).toLongLong();
+        const qint64 imageSize = query.value(4).toLongLong();
+        fileSizes.insert(query.value(0).toString(), qMakePair(
+                    thumbnailSize < 0 ? QFileInfo(query.value(1).toString()).size() : thumbnailSize,
+                    imageSize < 0 ? QFileInfo(query.value(2).toString()).size() : imageSize));
+    }
+    query.finish();
+
+    locker.relock();
+
+    for (QHash<QString, QPair<qint64, qint64> >::const_iterator it = fileSizes.begin();
+            it != fileSizes.end();
+            ++it) {
+        d->queue.fileSizes.insert(it.key(), it.value());
+    }
+    if (fileSizes.count() < FILE_SIZE_BATCH_SIZE) {
+        d->fileSizesKnown = true;
+    }
+}
+
 bool FacebookImagesDatabase::write()
 {
     Q_D(FacebookImagesDatabase);
@@ -1009,6 +1443,15 @@ bool FacebookImagesDatabase::write()
     const QMap<QString, QString> updateThumbnailFiles = d->queue.updateThumbnailFiles;
     const QMap<QString, QString> updateImageFiles = d->queue.updateImageFiles;
 
+    const QHash<QString, qint64> accessedImages = d->queue.accessedImages;
+    const QHash<QString, QPair<qint64, qint64> > fileSizes = d->queue.fileSizes;
+
+    const qint64 diskBudget = d->diskBudget;
+    const bool evictionNeeded = d->evictionNeeded
+            || !updateThumbnailFiles.isEmpty() || !updateImageFiles.isEmpty()
+            || !fileSizes.isEmpty();
+    d->evictionNeeded = false;
+
     d->queue.purgeAccounts.clear();
 
     d->queue.removeUsers.clear();
@@ -1024,6 +1467,9 @@ bool FacebookImagesDatabase::write()
     d->queue.updateThumbnailFiles.clear();
     d->queue.updateImageFiles.clear();
 
+    d->queue.accessedImages.clear();
+    d->queue.fileSizes.clear();
+
     locker.unlock();
 
     bool success = true;
@@ -1050,10 +1496,7 @@ bool FacebookImagesDatabase::write()
     if (!removeUsers.isEmpty()) {
         QVariantList userIds;
 
-        query = prepare(QStringLiteral(
-                    "SELECT thumbnailFile, imageFile "
-                    "FROM images "
-                    "WHERE fbUserId = :fbUserId"));
+        query = prepare(FacebookImagesQueries::userFiles());
         Q_FOREACH (const QString &userId, removeUsers) {
             userIds.append(userId);
 
@@ -1061,8 +1504,8 @@ bool FacebookImagesDatabase::write()
             if (!query.exec()) {
                 qWarning() << Q_FUNC_INFO << "Failed to exec cached images selection query:"
                            << query.lastError().text();
-            } else {
-                d->clearCachedImages(query);
+            } else if (!d->queueFileRemovals(query)) {
+                success = false;
             }
         }
 
@@ -1094,10 +1537,7 @@ bool FacebookImagesDatabase::write()
     if (!removeAlbums.isEmpty()) {
         QVariantList albumIds;
 
-        query = prepare(QStringLiteral(
-                    "SELECT thumbnailFile, imageFile "
-                    "FROM images "
-                    "WHERE fbAlbumId = :fbAlbumId"));
+        query = prepare(FacebookImagesQueries::albumFiles());
         Q_FOREACH (const QString &albumId, removeAlbums) {
             albumIds.append(albumId);
 
@@ -1105,8 +1545,8 @@ bool FacebookImagesDatabase::write()
             if (!query.exec()) {
                 qWarning() << Q_FUNC_INFO << "Failed to exec cached images selection query:"
                            << query.lastError().text();
-            } else {
-                d->clearCachedImages(query);
+            } else if (!d->queueFileRemovals(query)) {
+                success = false;
             }
         }
 
@@ -1126,10 +1566,7 @@ bool FacebookImagesDatabase::write()
     if (!removeImages.isEmpty()) {
         QVariantList imageIds;
 
-        query = prepare(QStringLiteral(
-                    "SELECT thumbnailFile, imageFile "
-                    "FROM images "
-                    "WHERE fbImageId = :fbImageId"));
+        query = prepare(FacebookImagesQueries::imageFiles());
         Q_FOREACH (const QString &imageId, removeImages) {
             imageIds.append(imageId);
 
@@ -1137,8 +1574,8 @@ bool FacebookImagesDatabase::write()
             if (!query.exec()) {
                 qWarning() << Q_FUNC_INFO << "Failed to exec cached images selection query:"
                            << query.lastError().text();
-            } else {
-                d->clearCachedImages(query);
+            } else if (!d->queueFileRemovals(query)) {
+                success = false;
             }
         }
 
@@ -1200,15 +1637,82 @@ bool FacebookImagesDatabase::write()
         executeBatchSocialCacheQuery(query);
     }
 
-    if (!insertImages.isEmpty()) {
+    // Images added again without a change keep their row, and with it the
+    // files downloaded for them
+    QHash<QString, QByteArray> contentHashes;
+    Q_FOREACH (const FacebookImage::ConstPtr &image, insertImages) {
+        contentHashes.insert(image->fbImageId(), AbstractSocialCacheDatabasePrivate::contentHash(
+                                 QVariantList() << image->fbAlbumId() << image->fbUserId()
+                                 << image->createdTime().toTime_t()
+                                 << image->updatedTime().toTime_t() << image->imageName()
+                                 << image->width() << image->height()
+                                 << image->thumbnailUrl() << image->imageUrl()));
+    }
+    const QSet<QString> unchangedImages = d->unchangedRows(
+                QStringLiteral("images"), QStringLiteral("fbImageId"), contentHashes);
+
+    if (insertImages.count() > unchangedImages.count()) {
         QVariantList imageIds, albumIds, userIds;
         QVariantList createdTimes, updatedTimes;
         QVariantList imageNames;
         QVariantList widths, heights;
         QVariantList thumbnailUrls, imageUrls;
         QVariantList thumbnailFiles, imageFiles;
+        QVariantList thumbnailSizes, imageSizes;
+        QVariantList accessTimes;
+        QVariantList hashes;
+        QVariantList removedFiles;
+        bool fileSizesUnknown = false;
+
+        // A changed image keeps the files of the urls that did not change, and
+        // the files of the other urls are removed
+        QSqlQuery filesQuery = prepare(QStringLiteral(
+                    "SELECT thumbnailUrl, imageUrl, thumbnailFile, imageFile,"
+                    " thumbnailSize, imageSize, lastAccess "
+                    "FROM images "
+                    "WHERE fbImageId = :fbImageId"));
 
         Q_FOREACH (const FacebookImage::ConstPtr &image, insertImages) {
+            if (unchangedImages.contains(image->fbImageId())) {
+                continue;
+            }
+
+            QString thumbnailFile = image->thumbnailFile();
+            QString imageFile = image->imageFile();
+            qint64 thumbnailSize = thumbnailFile.isEmpty() ? 0 : -1;
+            qint64 imageSize = imageFile.isEmpty() ? 0 : -1;
+            qint64 lastAccess = 0;
+
+            filesQuery.bindValue(QStringLiteral(":fbImageId"), image->fbImageId());
+            if (!filesQuery.exec()) {
+                qWarning() << Q_FUNC_INFO << "Failed to exec cached files selection query:"
+                           << filesQuery.lastError().text();
+                success = false;
+            } else if (filesQuery.next()) {
+                const QString oldThumbnailFile = filesQuery.value(2).toString();
+                const QString oldImageFile = filesQuery.value(3).toString();
+
+                if (thumbnailFile.isEmpty()
+                        && filesQuery.value(0).toString() == image->thumbnailUrl()) {
+                    thumbnailFile = oldThumbnailFile;
+                    thumbnailSize = filesQuery.value(4).toLongLong();
+                } else if (!oldThumbnailFile.isEmpty() && oldThumbnailFile != thumbnailFile) {
+                    removedFiles.append(oldThumbnailFile);
+                }
+
+                if (imageFile.isEmpty() && filesQuery.value(1).toString() == image->imageUrl()) {
+                    imageFile = oldImageFile;
+                    imageSize = filesQuery.value(5).toLongLong();
+                } else if (!oldImageFile.isEmpty() && oldImageFile != imageFile) {
+                    removedFiles.append(oldImageFile);
+                }
+
+                lastAccess = filesQuery.value(6).toLongLong();
+            }
+            filesQuery.finish();
+
+            fileSizesUnknown = fileSizesUnknown || thumbnailSize < 0 || imageSize < 0;
+
             imageIds.append(image->fbImageId());
             albumIds.append(image->fbAlbumId());
             userIds.append(image->fbUserId());
@@ -1219,17 +1723,27 @@ bool FacebookImagesDatabase::write()
             heights.append(image->height());
             thumbnailUrls.append(image->thumbnailUrl());
             imageUrls.append(image->imageUrl());
-            thumbnailFiles.append(image->thumbnailFile());
-            imageFiles.append(image->imageFile());
+            thumbnailFiles.append(thumbnailFile);
+            imageFiles.append(imageFile);
+            thumbnailSizes.append(thumbnailSize);
+            imageSizes.append(imageSize);
+            accessTimes.append(lastAccess);
+            hashes.append(contentHashes.value(image->fbImageId()));
+        }
+
+        if (!removedFiles.isEmpty() && !d->queueFileRemovals(removedFiles)) {
+            success = false;
         }
 
         query = prepare(QStringLiteral(
                     "INSERT OR REPLACE INTO images ("
                     " fbImageId, fbAlbumId, fbUserId, createdTime, updatedTime, imageName,"
-                    " width, height, thumbnailUrl, imageUrl, thumbnailFile, imageFile) "
+                    " width, height, thumbnailUrl, imageUrl, thumbnailFile, imageFile,"
+                    " thumbnailSize, imageSize, lastAccess, contentHash) "
                     "VALUES ("
                     " :fbImageId, :fbAlbumId, :fbUserId, :createdTime, :updatedTime, :imageName,"
-                    " :width, :height, :thumbnailUrl, :imageUrl, :thumbnailFile, :imageFile)"));
+                    " :width, :height, :thumbnailUrl, :imageUrl, :thumbnailFile, :imageFile,"
+                    " :thumbnailSize, :imageSize, :lastAccess, :contentHash)"));
         query.bindValue(QStringLiteral(":fbImageId"), imageIds);
         query.bindValue(QStringLiteral(":fbAlbumId"), albumIds);
         query.bindValue(QStringLiteral(":fbUserId"), userIds);
@@ -1242,7 +1756,17 @@ bool FacebookImagesDatabase::write()
         query.bindValue(QStringLiteral(":imageUrl"), imageUrls);
         query.bindValue(QStringLiteral(":thumbnailFile"), thumbnailFiles);
         query.bindValue(QStringLiteral(":imageFile"), imageFiles);
+        query.bindValue(QStringLiteral(":thumbnailSize"), thumbnailSizes);
+        query.bindValue(QStringLiteral(":imageSize"), imageSizes);
+        query.bindValue(QStringLiteral(":lastAccess"), accessTimes);
+        query.bindValue(QStringLiteral(":contentHash"), hashes);
         executeBatchSocialCacheQuery(query);
+
+        if (fileSizesUnknown) {
+            locker.relock();
+            d->fileSizesKnown = false;
+            locker.unlock();
+        }
     }
 
     if (!syncAccounts.isEmpty()) {
@@ -1266,47 +1790,69 @@ bool FacebookImagesDatabase::write()
         executeBatchSocialCacheQuery(query);
     }
 
-    if (!updateThumbnailFiles.isEmpty()) {
+    if (!updateThumbnailFiles.isEmpty()
+            && !d->updateFiles(QStringLiteral("thumbnailFile"), QStringLiteral("thumbnailSize"),
+                               updateThumbnailFiles)) {
+        success = false;
+    }
+
+    if (!updateImageFiles.isEmpty()
+            && !d->updateFiles(QStringLiteral("imageFile"), QStringLiteral("imageSize"),
+                               updateImageFiles)) {
+        success = false;
+    }
+
+    if (!accessedImages.isEmpty()) {
         QVariantList imageIds;
-        QVariantList thumbnailFiles;
+        QVariantList accessTimes;
 
-        for (QMap<QString, QString>::const_iterator it = updateThumbnailFiles.begin();
-                it != updateThumbnailFiles.end();
+        for (QHash<QString, qint64>::const_iterator it = accessedImages.begin();
+                it != accessedImages.end();
                 ++it) {
             imageIds.append(it.key());
-            thumbnailFiles.append(it.value());
+            accessTimes.append(it.value());
         }
 
         query = prepare(QStringLiteral(
                     "UPDATE images "
-                    "SET thumbnailFile = :thumbnailFile "
+                    "SET lastAccess = :lastAccess "
                     "WHERE fbImageId = :fbImageId"));
-        query.bindValue(QStringLiteral(":thumbnailFile"), thumbnailFiles);
+        query.bindValue(QStringLiteral(":lastAccess"), accessTimes);
         query.bindValue(QStringLiteral(":fbImageId"), imageIds);
         executeBatchSocialCacheQuery(query);
     }
 
-
-    if (!updateImageFiles.isEmpty()) {
+    if (!fileSizes.isEmpty()) {
         QVariantList imageIds;
-        QVariantList imageFiles;
+        QVariantList thumbnailSizes;
+        QVariantList imageSizes;
 
-        for (QMap<QString, QString>::const_iterator it = updateImageFiles.begin();
-                it != updateImageFiles.end();
+        for (QHash<QString, QPair<qint64, qint64> >::const_iterator it = fileSizes.begin();
+                it != fileSizes.end();
                 ++it) {
             imageIds.append(it.key());
-            imageFiles.append(it.value());
+            thumbnailSizes.append(it.value().first);
+            imageSizes.append(it.value().second);
         }
 
+        // Only the sizes still unknown are set, as the files may have been
+        // replaced or evicted since they were measured
         query = prepare(QStringLiteral(
                     "UPDATE images "
-                    "SET imageFile = :imageFile "
+                    "SET thumbnailSize = CASE WHEN thumbnailSize < 0"
+                    " THEN :thumbnailSize ELSE thumbnailSize END,"
+                    " imageSize = CASE WHEN imageSize < 0 THEN :imageSize ELSE imageSize END "
                     "WHERE fbImageId = :fbImageId"));
-        query.bindValue(QStringLiteral(":imageFile"), imageFiles);
+        query.bindValue(QStringLiteral(":thumbnailSize"), thumbnailSizes);
+        query.bindValue(QStringLiteral(":imageSize"), imageSizes);
         query.bindValue(QStringLiteral(":fbImageId"), imageIds);
         executeBatchSocialCacheQuery(query);
     }
 
+    if (success && diskBudget > 0 && evictionNeeded && !d->evictFiles(diskBudget)) {
+        success = false;
+    }
+
     return success;
 }
 
@@ -1365,9 +1911,152 @@ bool FacebookImagesDatabase::createTables(QSqlDatabase database) const
         return false;
     }
 
+    // The tables above are version 3 of the schema
+    for (int version = 3; version < VERSION; ++version) {
+        if (!upgradeTables(database, version)) {
+            return false;
+        }
+    }
+
     return true;
 }
 
+bool FacebookImagesDatabase::upgradeTables(QSqlDatabase database, int fromVersion) const
+{
+    QSqlQuery query(database);
+
+    switch (fromVersion) {
+    case 3:
+        if (!query.exec(QStringLiteral("ALTER TABLE images ADD COLUMN contentHash BLOB"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to add contentHash column:"
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    case 4:
+        // The number of images of each user is kept up to date by triggers.
+        // INSERT OR REPLACE does not run delete triggers for the replaced row,
+        // so the count of its user is decremented before the insert.
+        if (!query.exec(QStringLiteral(
+                    "ALTER TABLE users ADD COLUMN imageCount INTEGER NOT NULL DEFAULT 0"))
+                || !query.exec(QStringLiteral(
+                    "UPDATE users SET imageCount = ("
+                    " SELECT COUNT(*) FROM images WHERE images.fbUserId = users.fbUserId)"))
+                || !query.exec(QStringLiteral(
+                    "CREATE TRIGGER images_replace_count BEFORE INSERT ON images "
+                    "BEGIN"
+                    " UPDATE users SET imageCount = imageCount - 1"
+                    " WHERE fbUserId = (SELECT fbUserId FROM images WHERE fbImageId = NEW.fbImageId);"
+                    "END"))
+                || !query.exec(QStringLiteral(
+                    "CREATE TRIGGER images_insert_count AFTER INSERT ON images "
+                    "BEGIN"
+                    " UPDATE users SET imageCount = imageCount + 1 WHERE fbUserId = NEW.fbUserId;"
+                    "END"))
+                || !query.exec(QStringLiteral(
+                    "CREATE TRIGGER images_delete_count AFTER DELETE ON images "
+                    "BEGIN"
+                    " UPDATE users SET imageCount = imageCount - 1 WHERE fbUserId = OLD.fbUserId;"
+                    "END"))
+                || !query.exec(QStringLiteral(
+                    "CREATE TRIGGER images_update_count AFTER UPDATE OF fbUserId ON images "
+                    "WHEN OLD.fbUserId IS NOT NEW.fbUserId "
+                    "BEGIN"
+                    " UPDATE users SET imageCount = imageCount - 1 WHERE fbUserId = OLD.fbUserId;"
+                    " UPDATE users SET imageCount = imageCount + 1 WHERE fbUserId = NEW.fbUserId;"
+                    "END"))
+                || !query.exec(QStringLiteral(
+                    "CREATE TRIGGER users_insert_count AFTER INSERT ON users "
+                    "BEGIN"
+                    " UPDATE users SET imageCount = ("
+                    "  SELECT COUNT(*) FROM images WHERE fbUserId = NEW.fbUserId)"
+                    " WHERE fbUserId = NEW.fbUserId;"
+                    "END"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to add image counters:"
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    case 5:
+        // Images of a user or of an album, already sorted by updatedTime, and
+        // the accounts they are joined with
+        if (!query.exec(QStringLiteral(
+                    "CREATE INDEX IF NOT EXISTS images_fbUserId "
+                    "ON images (fbUserId, updatedTime)"))
+                || !query.exec(QStringLiteral(
+                    "CREATE INDEX IF NOT EXISTS images_fbAlbumId "
+                    "ON images (fbAlbumId, updatedTime)"))
+                || !query.exec(QStringLiteral(
+                    "CREATE INDEX IF NOT EXISTS accounts_fbUserId ON accounts (fbUserId)"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to create image indexes:"
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    case 6:
+        // Pages of the images of all the users, and the order of the images
+        // updated at the same time
+        if (!query.exec(QStringLiteral(
+                    "CREATE INDEX IF NOT EXISTS images_updatedTime "
+                    "ON images (updatedTime, fbImageId)"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to create image index:"
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    case 7:
+        return AbstractSocialCacheDatabasePrivate::createFileRemovalTable(database);
+    case 8: {
+        // The size of the cached files, and the time they were last accessed
+        // in milliseconds, to evict the least recently used ones
+        if (!query.exec(QStringLiteral(
+                    "ALTER TABLE images ADD COLUMN lastAccess INTEGER NOT NULL DEFAULT 0"))
+                || !query.exec(QStringLiteral(
+                    "ALTER TABLE images ADD COLUMN thumbnailSize INTEGER NOT NULL DEFAULT 0"))
+                || !query.exec(QStringLiteral(
+                    "ALTER TABLE images ADD COLUMN imageSize INTEGER NOT NULL DEFAULT 0"))
+                || !query.exec(QStringLiteral(
+                    "CREATE INDEX IF NOT EXISTS images_lastAccess ON images (lastAccess)"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to add cached file columns:"
+                       << query.lastError().text();
+            return false;
+        }
+
+        // The files already cached are measured after the upgrade, by
+        // writeCommitted(), rather than inside the upgrade transaction
+        if (!query.exec(QStringLiteral(
+                    "UPDATE images SET thumbnailSize = -1 WHERE thumbnailFile <> ''"))
+                || !query.exec(QStringLiteral(
+                    "UPDATE images SET imageSize = -1 WHERE imageFile <> ''"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to mark the size of cached files unknown:"
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    }
+    case 9:
+        // Pages are ordered by updatedTime and fbImageId, which the indexes
+        // of users and albums need to cover to avoid sorting each page
+        if (!query.exec(QStringLiteral("DROP INDEX IF EXISTS images_fbUserId"))
+                || !query.exec(QStringLiteral("DROP INDEX IF EXISTS images_fbAlbumId"))
+                || !query.exec(QStringLiteral(
+                    "CREATE INDEX images_fbUserId "
+                    "ON images (fbUserId, updatedTime, fbImageId)"))
+                || !query.exec(QStringLiteral(
+                    "CREATE INDEX images_fbAlbumId "
+                    "ON images (fbAlbumId, updatedTime, fbImageId)"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to create image indexes:"
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    case 10:
+        return AbstractSocialCacheDatabasePrivate::addFileRemovalTimes(database);
+    default:
+        return false;
+    }
+}
+
 bool FacebookImagesDatabase::dropTables(QSqlDatabase database) const
 {
     QSqlQuery query(database);
@@ -22,6 +22,7 @@
 
 #include "abstractsocialcachedatabase_p.h"
 #include <QtCore/QDateTime>
+#include <QtCore/QFuture>
 #include <QtCore/QStringList>
 
 class FacebookUserPrivate;
@@ -145,6 +146,8 @@ public:
     void addUser(const QString &fbUserId, const QDateTime &updatedTime,
                  const QString &userName);
     void removeUser(const QString &fbUserId);
+    // Number of images cached for all the users, from the counter of each user
+    int imageCount(bool *ok = 0) const;
 
     // Album cache manipulation
     QStringList allAlbumIds(bool *ok = 0) const;
@@ -165,12 +168,31 @@ public:
                   const QString & imageUrl);
     void updateImageThumbnail(const QString &fbImageId, const QString &thumbnailFile);
     void updateImageFile(const QString &fbImageId, const QString &imageFile);
+
+    // Once the cached files of all images take more than the budget, in
+    // bytes, the files of the least recently accessed images are removed and
+    // their file columns cleared, so that they are downloaded again when
+    // needed. Setting a file counts as an access. Accesses are written with
+    // the next commit. A budget of 0 keeps all files. imagesEvicted() is
+    // emitted with the images whose files were removed by a write.
+    qint64 diskBudget() const;
+    void setDiskBudget(qint64 bytes);
+    void recordAccess(const QString &fbImageId);
+
     void removeImage(const QString &fbImageId);
     void removeImages(const QStringList &fbImageIds);
 
     void commit();
 
+    // Asynchronous variants, reading from a worker thread
+    QFuture<FacebookUser::ConstPtr> userAsync(const QString &fbUserId) const;
+    QFuture<FacebookAlbum::ConstPtr> albumAsync(const QString &fbAlbumId) const;
+    QFuture<FacebookImage::ConstPtr> imageAsync(const QString &fbImageId) const;
+    QFuture<QStringList> allImageIdsAsync() const;
+
     QList<FacebookUser::ConstPtr> users() const;
+    // Number of images of all the users, read by queryUsers() along with users()
+    int totalImageCount() const;
     QList<FacebookImage::ConstPtr> images() const;
     QList<FacebookAlbum::ConstPtr> albums() const;
 
@@ -179,17 +201,32 @@ public:
     void queryUserImages(const QString &userId = QString());
     void queryAlbumImages(const QString &albumId);
 
+    // With a page size, the image queries read the first pageSize images, or
+    // as many images as the previous read of the same query if that is more,
+    // and fetchMore() appends the next pageSize images to images(). Pages
+    // start after the last image read, so images are never read twice. A
+    // page size of 0 reads all images.
+    int pageSize() const;
+    void setPageSize(int pageSize);
+    bool canFetchMore() const;
+    void fetchMore();
+    // True if the last query appended images to images() instead of replacing them
+    bool imagesAppended() const;
+
 Q_SIGNALS:
     void queryFinished();
+    void imagesEvicted(const QStringList &fbImageIds);
 
 protected:
     bool read();
     void readFinished();
 
     bool write();
+    void writeFinished();
+    void writeCommitted();
     bool createTables(QSqlDatabase database) const;
     bool dropTables(QSqlDatabase database) const;
-
+    bool upgradeTables(QSqlDatabase database, int fromVersion) const;
 
 private:
     Q_DECLARE_PRIVATE(FacebookImagesDatabase)
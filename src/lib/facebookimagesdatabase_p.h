@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ * Contact: Lucien Xu <lucien.xu@jollamobile.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef FACEBOOKIMAGESDATABASE_P_H
+#define FACEBOOKIMAGESDATABASE_P_H
+
+#include <QtCore/QString>
+
+// Statements of FacebookImagesDatabase whose query plans depend on the
+// indexes, so that the tests explain the statements that actually run
+struct FacebookImagesQueries
+{
+    // Reads the images of an user, of an album or of all users, newest first
+    // except for albums. Binds :fbUserId or :fbAlbumId, :updatedTime,
+    // :sameUpdatedTime and :fbImageId if after, and :limit if limited.
+    static QString images(bool forUser, bool forAlbum, bool after, bool limited);
+
+    // Read the cached files of the images of an user, of an album or of an
+    // image before these are removed. Bind :fbUserId, :fbAlbumId and
+    // :fbImageId respectively.
+    static QString userFiles();
+    static QString albumFiles();
+    static QString imageFiles();
+};
+
+#endif // FACEBOOKIMAGESDATABASE_P_H
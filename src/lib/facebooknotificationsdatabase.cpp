@@ -25,7 +25,7 @@
 #include <QtCore/QtDebug>
 
 static const char *DB_NAME = "facebookNotifications.db";
-static const int VERSION = 1;
+static const int VERSION = 3;
 
 struct FacebookNotificationPrivate
 {
@@ -196,6 +196,7 @@ FacebookNotificationsDatabasePrivate::FacebookNotificationsDatabasePrivate(Faceb
 FacebookNotificationsDatabase::FacebookNotificationsDatabase()
     : AbstractSocialCacheDatabase(*(new FacebookNotificationsDatabasePrivate(this)))
 {
+    setTuningProfile(TuningProfile::preset(ReadMostlyTuning));
 }
 
 FacebookNotificationsDatabase::~FacebookNotificationsDatabase()
@@ -318,6 +319,36 @@ QList<FacebookNotification::ConstPtr> FacebookNotificationsDatabase::notificatio
     return data;
 }
 
+QFuture<QList<FacebookNotification::ConstPtr> > FacebookNotificationsDatabase::notificationsAsync()
+{
+    Q_D(FacebookNotificationsDatabase);
+
+    return d->startQuery<QList<FacebookNotification::ConstPtr> >(
+                this, &FacebookNotificationsDatabase::notifications);
+}
+
+bool FacebookNotificationsDatabase::searchAvailable() const
+{
+    Q_D(const FacebookNotificationsDatabase);
+    return d->hasTable(QStringLiteral("notifications_search"));
+}
+
+QList<AbstractSocialCacheDatabase::SearchResult> FacebookNotificationsDatabase::search(
+        const QString &text, int limit) const
+{
+    Q_D(const FacebookNotificationsDatabase);
+    return d->search(QStringLiteral("notifications_search"), text, limit);
+}
+
+QFuture<QList<AbstractSocialCacheDatabase::SearchResult> > FacebookNotificationsDatabase::searchAsync(
+        const QString &text, int limit) const
+{
+    Q_D(const FacebookNotificationsDatabase);
+
+    return d->startQuery<QList<SearchResult> >(
+                this, &FacebookNotificationsDatabase::search, text, limit);
+}
+
 void FacebookNotificationsDatabase::readFinished()
 {
     emit notificationsChanged();
@@ -342,6 +373,9 @@ bool FacebookNotificationsDatabase::write()
     bool success = true;
     QSqlQuery query;
 
+    // The search rows share the rowid of their notification
+    const bool searchIndex = d->hasTable(QStringLiteral("notifications_search"));
+
     if (!removeNotificationsFromAccounts.isEmpty()) {
         QVariantList accountIds;
 
@@ -349,6 +383,14 @@ bool FacebookNotificationsDatabase::write()
             accountIds.append(accountId);
         }
 
+        if (searchIndex) {
+            query = prepare(QStringLiteral(
+                        "DELETE FROM notifications_search WHERE rowid IN ("
+                        "SELECT rowid FROM notifications WHERE accountId = :accountId)"));
+            query.bindValue(QStringLiteral(":accountId"), accountIds);
+            executeBatchSocialCacheQuery(query);
+        }
+
         query = prepare(QStringLiteral("DELETE FROM notifications WHERE accountId = :accountId"));
         query.bindValue(QStringLiteral(":accountId"), accountIds);
         executeBatchSocialCacheQuery(query);
@@ -361,12 +403,37 @@ bool FacebookNotificationsDatabase::write()
             notifIds.append(notifId);
         }
 
+        if (searchIndex) {
+            query = prepare(QStringLiteral(
+                        "DELETE FROM notifications_search WHERE rowid IN ("
+                        "SELECT rowid FROM notifications WHERE facebookId = :facebookId)"));
+            query.bindValue(QStringLiteral(":facebookId"), notifIds);
+            executeBatchSocialCacheQuery(query);
+        }
+
         query = prepare(QStringLiteral("DELETE FROM notifications WHERE facebookId = :facebookId"));
         query.bindValue(QStringLiteral(":facebookId"), notifIds);
         executeBatchSocialCacheQuery(query);
     }
 
-    if (!insertNotifications.isEmpty()) {
+    // Notifications added again without a change are not written
+    QHash<QString, QByteArray> contentHashes;
+    Q_FOREACH (const QList<FacebookNotification::ConstPtr> &notifications, insertNotifications) {
+        Q_FOREACH (const FacebookNotification::ConstPtr &notification, notifications) {
+            contentHashes.insert(notification->facebookId(), AbstractSocialCacheDatabasePrivate::contentHash(
+                                     QVariantList() << notification->accountId()
+                                     << notification->from() << notification->to()
+                                     << notification->createdTime().toTime_t()
+                                     << notification->updatedTime().toTime_t()
+                                     << notification->title() << notification->link()
+                                     << notification->application() << notification->object()
+                                     << notification->unread() << notification->clientId()));
+        }
+    }
+    const QSet<QString> unchangedNotifications = d->unchangedRows(
+                QStringLiteral("notifications"), QStringLiteral("facebookId"), contentHashes);
+
+    if (contentHashes.count() > unchangedNotifications.count()) {
         QVariantList facebookIds;
         QVariantList accountIds;
         QVariantList fromStrings;
@@ -379,9 +446,13 @@ bool FacebookNotificationsDatabase::write()
         QVariantList unreads;
         QVariantList objects;
         QVariantList clientIds;
+        QVariantList hashes;
 
         Q_FOREACH (const QList<FacebookNotification::ConstPtr> &notifications, insertNotifications) {
             Q_FOREACH (const FacebookNotification::ConstPtr &notification, notifications) {
+                if (unchangedNotifications.contains(notification->facebookId())) {
+                    continue;
+                }
                 facebookIds.append(notification->facebookId());
                 accountIds.append(notification->accountId());
                 fromStrings.append(notification->from());
@@ -394,14 +465,23 @@ bool FacebookNotificationsDatabase::write()
                 objects.append(notification->object());
                 unreads.append((notification->unread()));
                 clientIds.append(notification->clientId());
+                hashes.append(contentHashes.value(notification->facebookId()));
             }
         }
 
+        if (searchIndex) {
+            query = prepare(QStringLiteral(
+                        "DELETE FROM notifications_search WHERE rowid IN ("
+                        "SELECT rowid FROM notifications WHERE facebookId = :facebookId)"));
+            query.bindValue(QStringLiteral(":facebookId"), facebookIds);
+            executeBatchSocialCacheQuery(query);
+        }
+
         query = prepare(QStringLiteral(
                     "INSERT OR REPLACE INTO notifications ("
-                    " facebookId, accountId, fromStr, toStr, createdTime, updatedTime, title, link, application, objectStr, unread, clientId) "
+                    " facebookId, accountId, fromStr, toStr, createdTime, updatedTime, title, link, application, objectStr, unread, clientId, contentHash) "
                     "VALUES("
-                    " :facebookId, :accountId, :fromStr, :toStr, :createdTime, :updatedTime, :title, :link, :application, :objectStr, :unread, :clientId)"));
+                    " :facebookId, :accountId, :fromStr, :toStr, :createdTime, :updatedTime, :title, :link, :application, :objectStr, :unread, :clientId, :contentHash)"));
         query.bindValue(QStringLiteral(":facebookId"), facebookIds);
         query.bindValue(QStringLiteral(":accountId"), accountIds);
         query.bindValue(QStringLiteral(":fromStr"), fromStrings);
@@ -414,8 +494,18 @@ bool FacebookNotificationsDatabase::write()
         query.bindValue(QStringLiteral(":objectStr"), objects);
         query.bindValue(QStringLiteral(":unread"), unreads);
         query.bindValue(QStringLiteral(":clientId"), clientIds);
+        query.bindValue(QStringLiteral(":contentHash"), hashes);
 
         executeBatchSocialCacheQuery(query);
+
+        if (searchIndex) {
+            query = prepare(QStringLiteral(
+                        "INSERT INTO notifications_search (rowid, identifier, title) "
+                        "SELECT rowid, facebookId, title FROM notifications "
+                        "WHERE facebookId = :facebookId"));
+            query.bindValue(QStringLiteral(":facebookId"), facebookIds);
+            executeBatchSocialCacheQuery(query);
+        }
     }
 
     if (d->purgeTimeLimit > 0) {
@@ -423,6 +513,13 @@ bool FacebookNotificationsDatabase::write()
         // purge notifications older than expirationTime in days
         const quint32 limit = QDateTime::currentDateTime().toTime_t() - d->purgeTimeLimit * 24 * 60 * 60;
         limits.append(limit);
+        if (searchIndex) {
+            query = prepare(QStringLiteral(
+                        "DELETE FROM notifications_search WHERE rowid IN ("
+                        "SELECT rowid FROM notifications WHERE updatedTime < :timeLimit)"));
+            query.bindValue(QStringLiteral(":timeLimit"), limits);
+            executeBatchSocialCacheQuery(query);
+        }
         query = prepare(QStringLiteral("DELETE FROM notifications WHERE updatedTime < :timeLimit"));
         query.bindValue(QStringLiteral(":timeLimit"), limits);
         executeBatchSocialCacheQuery(query);
@@ -456,9 +553,45 @@ bool FacebookNotificationsDatabase::createTables(QSqlDatabase database) const
         return false;
     }
 
+    for (int version = 1; version < VERSION; ++version) {
+        if (!upgradeTables(database, version)) {
+            return false;
+        }
+    }
+
     return true;
 }
 
+bool FacebookNotificationsDatabase::upgradeTables(QSqlDatabase database, int fromVersion) const
+{
+    QSqlQuery query(database);
+
+    switch (fromVersion) {
+    case 1:
+        // Full text search of the titles, when FTS5 is available
+        if (AbstractSocialCacheDatabasePrivate::createSearchTable(
+                    database, QStringLiteral("notifications_search"),
+                    QStringLiteral("identifier UNINDEXED, title"))
+                && !query.exec(QStringLiteral(
+                    "INSERT INTO notifications_search (rowid, identifier, title) "
+                    "SELECT rowid, facebookId, title FROM notifications"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to index notifications for search: "
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    case 2:
+        if (!query.exec(QStringLiteral("ALTER TABLE notifications ADD COLUMN contentHash BLOB"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to add contentHash column: "
+                       << query.lastError().text();
+            return false;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
 bool FacebookNotificationsDatabase::dropTables(QSqlDatabase database) const
 {
     QSqlQuery query(database);
@@ -468,5 +601,10 @@ bool FacebookNotificationsDatabase::dropTables(QSqlDatabase database) const
         return false;
     }
 
+    if (!query.exec(QStringLiteral("DROP TABLE IF EXISTS notifications_search"))) {
+        qWarning() << Q_FUNC_INFO << "Unable to delete notifications_search table: " << query.lastError().text();
+        return false;
+    }
+
     return true;
 }
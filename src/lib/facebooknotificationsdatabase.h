@@ -23,6 +23,7 @@
 #include "abstractsocialcachedatabase.h"
 
 #include <QtCore/QSharedPointer>
+#include <QtCore/QFuture>
 #include <QStringList>
 #include <QDateTime>
 
@@ -83,6 +84,14 @@ public:
     void purgeOldNotifications(int limitInDays);
     void sync();
     QList<FacebookNotification::ConstPtr> notifications();
+    // Reads the notifications from a worker thread
+    QFuture<QList<FacebookNotification::ConstPtr> > notificationsAsync();
+
+    // Searches the notification titles, best matches first. Returns no
+    // results when the FTS5 module of SQLite is not available.
+    bool searchAvailable() const;
+    QList<SearchResult> search(const QString &text, int limit = 20) const;
+    QFuture<QList<SearchResult> > searchAsync(const QString &text, int limit = 20) const;
 
 signals:
     void notificationsChanged();
@@ -92,6 +101,7 @@ protected:
     bool write();
     bool createTables(QSqlDatabase database) const;
     bool dropTables(QSqlDatabase database) const;
+    bool upgradeTables(QSqlDatabase database, int fromVersion) const;
 
 private:
     void removeNotificationFromQueues(const QString &notificationId);
@@ -30,6 +30,19 @@
 static const char *DB_NAME = "google.db";
 static const int VERSION = 1;
 
+static QString findGcalEventId(const QList<GoogleEvent::ConstPtr> &events, int accountId,
+                               const QString &localCalendarId, const QString &localEventId)
+{
+    Q_FOREACH(const GoogleEvent::ConstPtr &evt, events) {
+        if (evt->accountId() == accountId
+                && evt->localCalendarId() == localCalendarId
+                && evt->localEventId() == localEventId) {
+            return evt->gcalEventId();
+        }
+    }
+    return QString();
+}
+
 struct GoogleEventPrivate
 {
     explicit GoogleEventPrivate(int accountId,
@@ -171,24 +184,44 @@ QString GoogleCalendarDatabase::gcalEventId(int accountId, const QString &localC
     Q_D(const GoogleCalendarDatabase);
 
     // check pre-commit data
-    Q_FOREACH(const GoogleEvent::ConstPtr &evt, d->insertEvents[accountId]) {
-        if (evt->accountId() == accountId
-                && evt->localCalendarId() == localCalendarId
-                && evt->localEventId() == localEventId) {
-            return evt->gcalEventId();
-        }
+    const QString eventId = findGcalEventId(d->insertEvents.value(accountId), accountId,
+                                            localCalendarId, localEventId);
+    if (!eventId.isEmpty()) {
+        return eventId;
     }
 
     // check committed data
-    Q_FOREACH(const GoogleEvent::ConstPtr &evt, events(accountId, localCalendarId)) {
-        if (evt->accountId() == accountId
-                && evt->localCalendarId() == localCalendarId
-                && evt->localEventId() == localEventId) {
-            return evt->gcalEventId();
-        }
+    return committedGcalEventId(accountId, localCalendarId, localEventId);
+}
+
+QString GoogleCalendarDatabase::committedGcalEventId(int accountId, const QString &localCalendarId,
+                                                     const QString &localEventId)
+{
+    return findGcalEventId(events(accountId, localCalendarId), accountId, localCalendarId, localEventId);
+}
+
+QFuture<QList<GoogleEvent::ConstPtr> > GoogleCalendarDatabase::eventsAsync(int accountId, const QString &localCalendarId)
+{
+    Q_D(GoogleCalendarDatabase);
+
+    return d->startQuery<QList<GoogleEvent::ConstPtr> >(
+                this, &GoogleCalendarDatabase::events, accountId, localCalendarId);
+}
+
+QFuture<QString> GoogleCalendarDatabase::gcalEventIdAsync(int accountId, const QString &localCalendarId,
+                                                          const QString &localEventId)
+{
+    Q_D(GoogleCalendarDatabase);
+
+    // pre-commit data is only used from the calling thread
+    const QString eventId = findGcalEventId(d->insertEvents.value(accountId), accountId,
+                                            localCalendarId, localEventId);
+    if (!eventId.isEmpty()) {
+        return AbstractSocialCacheDatabasePrivate::finishedQuery(eventId);
     }
 
-    return QString();
+    return d->startQuery<QString>(this, &GoogleCalendarDatabase::committedGcalEventId,
+                                  accountId, localCalendarId, localEventId);
 }
 
 void GoogleCalendarDatabase::insertEvent(int accountId,
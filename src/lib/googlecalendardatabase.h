@@ -24,6 +24,7 @@
 #include <QtCore/QSharedPointer>
 #include <QtCore/QString>
 #include <QtCore/QList>
+#include <QtCore/QFuture>
 
 class GoogleEventPrivate;
 class GoogleEvent
@@ -59,6 +60,10 @@ public:
     QList<GoogleEvent::ConstPtr> events(int accountId, const QString &localCalendarId = QString());
     QString gcalEventId(int accountId, const QString &localCalendarId, const QString &localEventId);
 
+    // Asynchronous variants, reading from a worker thread
+    QFuture<QList<GoogleEvent::ConstPtr> > eventsAsync(int accountId, const QString &localCalendarId = QString());
+    QFuture<QString> gcalEventIdAsync(int accountId, const QString &localCalendarId, const QString &localEventId);
+
     // the following three won't be committed to the db until sync()+wait() is called.
     void insertEvent(int accountId, const QString &gcalEventId, const QString &localCalendarId, const QString &localEventId);
     void removeEvent(int accountId, const QString &gcalEventId, const QString &localCalendarId = QString(), const QString &localEventId = QString());
@@ -72,6 +77,8 @@ protected:
     bool dropTables(QSqlDatabase database) const;
 
 private:
+    QString committedGcalEventId(int accountId, const QString &localCalendarId, const QString &localEventId);
+
     Q_DECLARE_PRIVATE(GoogleCalendarDatabase)
 };
 
@@ -23,6 +23,7 @@ HEADERS = \
     socialnetworksyncdatabase.h \
     googlecalendardatabase.h \
     facebookimagesdatabase.h \
+    facebookimagesdatabase_p.h \
     facebookcalendardatabase.h \
     facebookcontactsdatabase.h \
     facebooknotificationsdatabase.h \
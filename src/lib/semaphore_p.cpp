@@ -33,144 +33,185 @@
 #include "semaphore_p.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
-#include <sys/sem.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/ipc.h>
 
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
 #include <QtDebug>
 
-namespace {
+static const quint32 SHARED_MUTEX_MAGIC = 0x534d5458; // "SMTX"
 
-// Defined as required for ::semun
-union semun {
-    int              val;
-    struct semid_ds *buf;
-    unsigned short  *array;
-    struct seminfo  *__buf;
+struct ProcessMutex::SharedMutex
+{
+    quint32 magic;
+    pthread_mutex_t mutex;
 };
 
-}
-
-Semaphore::Semaphore(const char *id, int initial)
-    : m_identifier(id)
-    , m_initialValue(-1)
-    , m_id(-1)
+ProcessMutex::ProcessMutex(const QString &path)
+    : m_path(path + QLatin1String(".lock"))
+    , m_shared(0)
+    , m_fd(-1)
+    , m_lastWaitTime(0)
+    , m_contentionTime(0)
+    , m_contentionCount(0)
 {
-    key_t key = ::ftok(m_identifier, 0);
+    QDir dir = QFileInfo(m_path).dir();
+    if (!dir.exists()) {
+        dir.mkpath(".");
+    }
+
+    m_fd = ::open(QFile::encodeName(m_path).constData(), O_RDWR | O_CREAT | O_CLOEXEC,
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (m_fd == -1) {
+        error("Unable to open lock file", errno);
+        return;
+    }
 
-    m_id = ::semget(key, 1, 0);
-    if (m_id == -1) {
-        if (errno != ENOENT) {
-            error("Unable to get semaphore", errno);
+    // The first process to map the file initializes the mutex, while the
+    // other ones wait on the file lock.
+    if (::flock(m_fd, LOCK_EX) == -1) {
+        error("Unable to lock lock file", errno);
+        return;
+    }
+
+    struct stat fileStat;
+    if (::fstat(m_fd, &fileStat) == -1) {
+        error("Unable to read lock file", errno);
+    } else if (fileStat.st_size < static_cast<off_t>(sizeof(SharedMutex))
+               && ::ftruncate(m_fd, sizeof(SharedMutex)) == -1) {
+        error("Unable to resize lock file", errno);
+    } else {
+        void *address = ::mmap(0, sizeof(SharedMutex), PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (address == MAP_FAILED) {
+            error("Unable to map lock file", errno);
         } else {
-            // The semaphore does not currently exist
-            m_id = ::semget(key, 1, IPC_CREAT | IPC_EXCL | S_IRWXU);
-            if (m_id == -1) {
-                if (errno == EEXIST) {
-                    // Someone else won the race to create the semaphore - retry get 
-                    m_id = ::semget(key, 1, 0);
-                }
-
-                if (m_id == -1) {
-                    error("Unable to create semaphore", errno);
-                }
-            } else {
-                // Set the initial value
-                union semun arg = { 0 };
-                arg.val = initial;
-
-                int status = ::semctl(m_id, 0, SETVAL, arg);
-                if (status == -1) {
-                    m_id = -1;
-                    error("Unable to initialize semaphore", errno);
-                } else {
-                    m_initialValue = initial;
-                }
-            }
+            m_shared = static_cast<SharedMutex *>(address);
+        }
+    }
+
+    if (m_shared && m_shared->magic != SHARED_MUTEX_MAGIC) {
+        pthread_mutexattr_t attributes;
+        ::pthread_mutexattr_init(&attributes);
+        ::pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_ERRORCHECK);
+        ::pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        ::pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+
+        const int result = ::pthread_mutex_init(&m_shared->mutex, &attributes);
+        ::pthread_mutexattr_destroy(&attributes);
+
+        if (result != 0) {
+            error("Unable to initialize mutex", result);
+            ::munmap(m_shared, sizeof(SharedMutex));
+            m_shared = 0;
+        } else {
+            m_shared->magic = SHARED_MUTEX_MAGIC;
         }
     }
+
+    ::flock(m_fd, LOCK_UN);
 }
 
-Semaphore::~Semaphore()
+ProcessMutex::~ProcessMutex()
 {
+    if (m_shared) {
+        ::munmap(m_shared, sizeof(SharedMutex));
+    }
+    if (m_fd != -1) {
+        ::close(m_fd);
+    }
 }
 
-bool Semaphore::decrement()
+bool ProcessMutex::lock(int timeout)
 {
-    if (m_id == -1)
+    if (!m_shared) {
         return false;
+    }
 
-    struct sembuf op;
-    op.sem_num = 0;
-    op.sem_op = -1;
-    op.sem_flg = SEM_UNDO;
+    m_lastWaitTime = 0;
 
-    if (::semop(m_id, &op, 1) == 0)
-        return true;
+    // When the mutex is free this is an atomic operation in user space
+    int result = ::pthread_mutex_trylock(&m_shared->mutex);
 
-    error("Unable to decrement semaphore", errno);
-    return false;
-}
+    if (result == EBUSY) {
+        QElapsedTimer timer;
+        timer.start();
 
-bool Semaphore::increment()
-{
-    if (m_id == -1)
-        return false;
+        if (timeout < 0) {
+            result = ::pthread_mutex_lock(&m_shared->mutex);
+        } else {
+            struct timespec deadline;
+            ::clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += timeout / 1000;
+            deadline.tv_nsec += (timeout % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            result = ::pthread_mutex_timedlock(&m_shared->mutex, &deadline);
+        }
 
-    struct sembuf op;
-    op.sem_num = 0;
-    op.sem_op = 1;
-    op.sem_flg = SEM_UNDO;
+        m_lastWaitTime = timer.nsecsElapsed() / 1000;
+        m_contentionTime += m_lastWaitTime;
+        ++m_contentionCount;
+    }
 
-    if (::semop(m_id, &op, 1) == 0)
-        return true;
+    if (result == EOWNERDEAD) {
+        // The owner died while holding the lock. SQLite rolls back whatever
+        // it left unfinished, so the lock can simply be taken over.
+        qWarning() << "Recovering lock" << m_path << "from a dead owner";
+        result = ::pthread_mutex_consistent(&m_shared->mutex);
+    }
 
-    error("Unable to increment semaphore", errno);
-    return false;
+    if (result != 0) {
+        error(result == ETIMEDOUT ? "Timed out waiting for lock" : "Unable to lock", result);
+        return false;
+    }
+
+    return true;
 }
 
-int Semaphore::value() const
+bool ProcessMutex::unlock()
 {
-    if (m_id == -1)
-        return -1;
+    if (!m_shared) {
+        return false;
+    }
+
+    const int result = ::pthread_mutex_unlock(&m_shared->mutex);
+    if (result != 0) {
+        error("Unable to unlock", result);
+        return false;
+    }
 
-    return ::semctl(m_id, 0, GETVAL, 0);
+    return true;
 }
 
-void Semaphore::error(const char *msg, int error)
+qint64 ProcessMutex::lastWaitTime() const
 {
-    qWarning() << QString("%1 %2: %3 (%4)").arg(msg).arg(m_identifier).arg(::strerror(error)).arg(error);
+    return m_lastWaitTime;
 }
 
-ProcessMutex::ProcessMutex(const QString &path)
-    : m_semaphore(path.toLatin1(), 1)
+qint64 ProcessMutex::contentionTime() const
 {
+    return m_contentionTime;
 }
 
-bool ProcessMutex::lock()
+int ProcessMutex::contentionCount() const
 {
-    if (!m_semaphore.decrement()) {
-        return false;
-    }
-
-    if (m_mutex.tryLock(40)) {
-        return true;
-    }
-
-    return false;
+    return m_contentionCount;
 }
 
-bool ProcessMutex::unlock()
+void ProcessMutex::error(const char *msg, int error) const
 {
-    m_mutex.unlock();
-    bool couldRelease = m_semaphore.increment();
-    if (!couldRelease) {
-        return false;
-    }
-
-    return true;
+    qWarning() << QString("%1 %2: %3 (%4)").arg(msg).arg(m_path).arg(::strerror(error)).arg(error);
 }
-
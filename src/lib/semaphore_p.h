@@ -34,36 +34,39 @@
 #define SEMAPHORE_P_H
 
 #include <QString>
-#include <QMutex>
 
-class Semaphore
+// Lock shared by all threads and processes using the same database file.
+//
+// The lock is a robust process-shared pthread mutex living in a small file
+// mapped next to the database. Taking it when it is free does not need a
+// system call, and a process dying while holding it does not leave it locked.
+class ProcessMutex
 {
 public:
-    Semaphore(const char *identifier, int initial);
-    ~Semaphore();
+    explicit ProcessMutex(const QString &path);
+    ~ProcessMutex();
 
-    bool decrement();
-    bool increment();
+    // Waits at most timeout milliseconds for the lock, or without limit if
+    // the timeout is negative.
+    bool lock(int timeout = -1);
+    bool unlock();
 
-    int value() const;
+    // Time spent waiting for the lock, in microseconds
+    qint64 lastWaitTime() const;
+    qint64 contentionTime() const;
+    int contentionCount() const;
 
 private:
-    void error(const char *msg, int error);
-
-    const char *m_identifier;
-    int m_initialValue;
-    int m_id;
-};
+    struct SharedMutex;
 
-class ProcessMutex
-{
-    Semaphore m_semaphore;
-    QMutex m_mutex;
+    void error(const char *msg, int error) const;
 
-public:
-    ProcessMutex(const QString &path);
-    bool lock();
-    bool unlock();
+    const QString m_path;
+    SharedMutex *m_shared;
+    int m_fd;
+    qint64 m_lastWaitTime;
+    qint64 m_contentionTime;
+    int m_contentionCount;
 };
 
 
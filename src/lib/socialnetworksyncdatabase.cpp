@@ -67,6 +67,7 @@ SocialNetworkSyncDatabasePrivate::~SocialNetworkSyncDatabasePrivate()
 SocialNetworkSyncDatabase::SocialNetworkSyncDatabase()
     : AbstractSocialCacheDatabase(*(new SocialNetworkSyncDatabasePrivate(this)))
 {
+    setTuningProfile(TuningProfile::preset(SmallTuning));
 }
 
 SocialNetworkSyncDatabase::~SocialNetworkSyncDatabase()
@@ -123,6 +124,16 @@ QDateTime SocialNetworkSyncDatabase::lastSyncTimestamp(const QString &serviceNam
     return dateTime;
 }
 
+QFuture<QDateTime> SocialNetworkSyncDatabase::lastSyncTimestampAsync(const QString &serviceName,
+                                                                     const QString &dataType,
+                                                                     int accountId) const
+{
+    Q_D(const SocialNetworkSyncDatabase);
+
+    return d->startQuery<QDateTime>(this, &SocialNetworkSyncDatabase::lastSyncTimestamp,
+                                    serviceName, dataType, accountId);
+}
+
 void SocialNetworkSyncDatabase::addSyncTimestamp(const QString &serviceName,
                                                  const QString &dataType, int accountId,
                                                  const QDateTime &timestamp)
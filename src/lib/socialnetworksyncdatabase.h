@@ -22,6 +22,7 @@
 
 #include "abstractsocialcachedatabase.h"
 #include <QtCore/QDateTime>
+#include <QtCore/QFuture>
 
 class SocialNetworkSyncDatabasePrivate;
 class SocialNetworkSyncDatabase: public AbstractSocialCacheDatabase
@@ -34,6 +35,9 @@ public:
     QList<int> syncedAccounts(const QString &serviceName, const QString &dataType) const;
     QDateTime lastSyncTimestamp(const QString &serviceName, const QString &dataType,
                                 int accountId) const;
+    // Reads the timestamp from a worker thread
+    QFuture<QDateTime> lastSyncTimestampAsync(const QString &serviceName, const QString &dataType,
+                                              int accountId) const;
     void addSyncTimestamp(const QString &serviceName, const QString &dataType,
                           int accountId, const QDateTime &timestamp);
     void commit();
@@ -173,6 +173,34 @@ void AbstractSocialCacheModel::updateData(const SocialCacheModelData &data)
     emit modelUpdated();
 }
 
+void AbstractSocialCacheModel::insertData(int row, const SocialCacheModelData &data)
+{
+    Q_D(AbstractSocialCacheModel);
+
+    if (data.isEmpty()) {
+        return;
+    }
+
+    d->insertRange(row, data.count(), data, 0);
+    emit countChanged();
+}
+
+void AbstractSocialCacheModel::removeData(const QVariantList &identifiers)
+{
+    Q_D(AbstractSocialCacheModel);
+
+    const int count = d->m_data.count();
+    for (int i = d->m_data.count() - 1; i >= 0; --i) {
+        if (identifiers.contains(d->m_data.at(i).value(0))) {
+            d->removeRange(i, 1);
+        }
+    }
+
+    if (d->m_data.count() != count) {
+        emit countChanged();
+    }
+}
+
 void AbstractSocialCacheModel::updateRow(int row, const SocialCacheModelRow &data)
 {
     Q_D(AbstractSocialCacheModel);
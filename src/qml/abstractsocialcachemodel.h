@@ -60,6 +60,11 @@ protected:
     void updateData(const SocialCacheModelData &data);
     void updateRow(int row, const SocialCacheModelRow &data);
 
+    // Methods used to apply changes without comparing all the rows. Rows
+    // are identified by their first role, like in updateData().
+    void insertData(int row, const SocialCacheModelData &data);
+    void removeData(const QVariantList &identifiers);
+
     explicit AbstractSocialCacheModel(AbstractSocialCacheModelPrivate &dd, QObject *parent = 0);
     QScopedPointer<AbstractSocialCacheModelPrivate> d_ptr;
 
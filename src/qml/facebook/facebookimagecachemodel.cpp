@@ -24,7 +24,10 @@
 #include "facebookimagedownloader_p.h"
 #include "facebookimagedownloaderconstants_p.h"
 
+#include <QtCore/QBasicTimer>
+#include <QtCore/QSet>
 #include <QtCore/QThread>
+#include <QtCore/QTimerEvent>
 #include <QtCore/QStandardPaths>
 
 #include <QtDebug>
@@ -36,6 +39,9 @@
 // - user-USER_ID: query all photos for the given user
 // - album-ALBUM_ID: query all photos for the given album
 
+static const int IMAGES_PAGE_SIZE = 60;
+static const int ACCESS_COMMIT_DELAY = 5000;
+
 static const char *PHOTO_USER_PREFIX = "user-";
 static const char *PHOTO_ALBUM_PREFIX = "album-";
 
@@ -59,6 +65,8 @@ public:
     FacebookImageDownloader *downloader;
     FacebookImagesDatabase database;
     FacebookImageCacheModel::ModelDataType type;
+    QBasicTimer accessTimer;
+    QSet<QString> evictedThumbnails;
 };
 
 FacebookImageCacheModelPrivate::FacebookImageCacheModelPrivate(FacebookImageCacheModel *q)
@@ -88,7 +96,10 @@ void FacebookImageCacheModelPrivate::queue(
 FacebookImageCacheModel::FacebookImageCacheModel(QObject *parent)
     : AbstractSocialCacheModel(*(new FacebookImageCacheModelPrivate(this)), parent)
 {
-    Q_D(const FacebookImageCacheModel);
+    Q_D(FacebookImageCacheModel);
+
+    d->database.setPageSize(IMAGES_PAGE_SIZE);
+
     connect(&d->database, &FacebookImagesDatabase::queryFinished,
             this, &FacebookImageCacheModel::queryFinished);
 }
@@ -99,6 +110,11 @@ FacebookImageCacheModel::~FacebookImageCacheModel()
     if (d->downloader) {
         d->downloader->removeModelFromHash(this);
     }
+    if (d->accessTimer.isActive()) {
+        d->accessTimer.stop();
+        d->database.commit();
+        d->database.wait();
+    }
 }
 
 QHash<int, QByteArray> FacebookImageCacheModel::roleNames() const
@@ -176,9 +192,38 @@ QVariant FacebookImageCacheModel::data(const QModelIndex &index, int role) const
         }
     }
 
+    if (role == FacebookImageCacheModel::Thumbnail && !d->evictedThumbnails.isEmpty()) {
+        const QString fbImageId = d->m_data.at(row).value(FacebookId).toString();
+        if (d->evictedThumbnails.contains(fbImageId) && d->database.images().size() > row) {
+            // evicted from the cache while the model was showing it.  Download it again.
+            FacebookImage::ConstPtr imageData = d->database.images().at(row);
+            FacebookImageCacheModelPrivate *nonconstD = const_cast<FacebookImageCacheModelPrivate*>(d);
+            nonconstD->evictedThumbnails.remove(fbImageId);
+            nonconstD->queue(row, FacebookImageDownloader::ThumbnailImage,
+                             imageData->fbImageId(),
+                             imageData->thumbnailUrl());
+        }
+    }
+
     return d->m_data.at(row).value(role);
 }
 
+bool FacebookImageCacheModel::canFetchMore(const QModelIndex &parent) const
+{
+    Q_D(const FacebookImageCacheModel);
+
+    return !parent.isValid() && d->type == Images && d->database.canFetchMore();
+}
+
+void FacebookImageCacheModel::fetchMore(const QModelIndex &parent)
+{
+    Q_D(FacebookImageCacheModel);
+
+    if (!parent.isValid() && d->type == Images) {
+        d->database.fetchMore();
+    }
+}
+
 void FacebookImageCacheModel::loadImages()
 {
     refresh();
@@ -241,12 +286,47 @@ void FacebookImageCacheModel::imageDownloaded(
     emit dataChanged(index(row), index(row));
 }
 
+// Called by FacebookImageDownloader when the files of images were removed
+// from the cache. The thumbnails are downloaded again once they are shown.
+void FacebookImageCacheModel::imagesEvicted(const QStringList &fbImageIds)
+{
+    Q_D(FacebookImageCacheModel);
+
+    if (d->type != Images) {
+        return;
+    }
+
+    const QSet<QString> evictedImages = fbImageIds.toSet();
+    for (int row = 0; row < d->m_data.count(); ++row) {
+        const QString fbImageId = d->m_data.at(row).value(FacebookId).toString();
+        if (evictedImages.contains(fbImageId)) {
+            d->m_data[row].insert(Thumbnail, QString());
+            d->m_data[row].insert(Image, QString());
+            d->evictedThumbnails.insert(fbImageId);
+            emit dataChanged(index(row), index(row));
+        }
+    }
+}
+
+void FacebookImageCacheModel::timerEvent(QTimerEvent *event)
+{
+    Q_D(FacebookImageCacheModel);
+
+    if (event->timerId() == d->accessTimer.timerId()) {
+        d->accessTimer.stop();
+        d->database.commit();
+    } else {
+        AbstractSocialCacheModel::timerEvent(event);
+    }
+}
+
 void FacebookImageCacheModel::queryFinished()
 {
     Q_D(FacebookImageCacheModel);
 
     QList<QVariantMap> thumbQueue;
     SocialCacheModelData data;
+    bool append = false;
     switch (d->type) {
     case Users: {
         QList<FacebookUser::ConstPtr> usersData = d->database.users();
@@ -261,17 +341,12 @@ void FacebookImageCacheModel::queryFinished()
 
         if (data.count() > 1) {
             QMap<int, QVariant> userMap;
-            int count = 0;
-            Q_FOREACH (const FacebookUser::ConstPtr &userData, usersData) {
-                count += userData->count();
-            }
-
             userMap.insert(FacebookImageCacheModel::FacebookId, QString());
             userMap.insert(FacebookImageCacheModel::Thumbnail, QString());
             //: Label for the "show all users from all Facebook accounts" option
             //% "All"
             userMap.insert(FacebookImageCacheModel::Title, qtTrId("nemo_socialcache_facebook_images_model-all-users"));
-            userMap.insert(FacebookImageCacheModel::Count, count);
+            userMap.insert(FacebookImageCacheModel::Count, d->database.totalImageCount());
             data.prepend(userMap);
         }
         break;
@@ -311,10 +386,26 @@ void FacebookImageCacheModel::queryFinished()
     case Images: {
         QList<FacebookImage::ConstPtr> imagesData = d->database.images();
 
-        for (int i = 0; i < imagesData.count(); i ++) {
+        // Only the rows of the images fetched as the view scrolls are created
+        append = d->database.imagesAppended() && d->m_data.count() <= imagesData.count();
+        if (!append) {
+            d->evictedThumbnails.clear();
+        }
+        for (int i = append ? d->m_data.count() : 0; i < imagesData.count(); i ++) {
             const FacebookImage::ConstPtr & imageData = imagesData.at(i);
             QMap<int, QVariant> imageMap;
             imageMap.insert(FacebookImageCacheModel::FacebookId, imageData->fbImageId());
+
+            // The rows are created as the view scrolls to them, which keeps
+            // their files from being evicted first. The access times are
+            // written together a moment later.
+            if (!imageData->thumbnailFile().isEmpty() || !imageData->imageFile().isEmpty()) {
+                d->database.recordAccess(imageData->fbImageId());
+                if (!d->accessTimer.isActive()) {
+                    d->accessTimer.start(ACCESS_COMMIT_DELAY, this);
+                }
+            }
+
             if (imageData->thumbnailFile().isEmpty()) {
                 QVariantMap thumbQueueData;
                 thumbQueueData.insert("row", QVariant::fromValue<int>(i));
@@ -341,7 +432,12 @@ void FacebookImageCacheModel::queryFinished()
         return;
     }
 
-    updateData(data);
+    if (append) {
+        insertData(d->m_data.count(), data);
+        emit modelUpdated();
+    } else {
+        updateData(data);
+    }
 
     // now download the queued thumbnails.
     foreach (const QVariantMap &thumbQueueData, thumbQueue) {
@@ -71,6 +71,8 @@ public:
 
     // from AbstractListModel
     QVariant data(const QModelIndex &index, int role) const;
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
 
 public Q_SLOTS:
     void loadImages();
@@ -80,9 +82,13 @@ Q_SIGNALS:
     void typeChanged();
     void downloaderChanged();
 
+protected:
+    void timerEvent(QTimerEvent *event);
+
 private Q_SLOTS:
     void queryFinished();
     void imageDownloaded(const QString &url, const QString &path, const QVariantMap &imageData);
+    void imagesEvicted(const QStringList &fbImageIds);
 
 private:
     Q_DECLARE_PRIVATE(FacebookImageCacheModel)
@@ -30,6 +30,9 @@
 
 static const char *MODEL_KEY = "model";
 
+// Cached image files beyond this size are evicted, least recently used first
+static const qint64 IMAGE_CACHE_DISK_BUDGET = 100 * 1024 * 1024;
+
 FacebookImageDownloaderPrivate::FacebookImageDownloaderPrivate(FacebookImageDownloader *q)
     : AbstractImageDownloaderPrivate(q)
 {
@@ -42,6 +45,11 @@ FacebookImageDownloaderPrivate::~FacebookImageDownloaderPrivate()
 FacebookImageDownloader::FacebookImageDownloader(QObject *parent) :
     AbstractImageDownloader(*new FacebookImageDownloaderPrivate(this), parent)
 {
+    Q_D(FacebookImageDownloader);
+
+    d->database.setDiskBudget(IMAGE_CACHE_DISK_BUDGET);
+    connect(&d->database, &FacebookImagesDatabase::imagesEvicted,
+            this, &FacebookImageDownloader::invokeModelEvictionCallbacks);
     connect(this, &AbstractImageDownloader::imageDownloaded,
             this, &FacebookImageDownloader::invokeSpecificModelCallback);
 }
@@ -81,6 +89,16 @@ void FacebookImageDownloader::invokeSpecificModelCallback(const QString &url, co
     }
 }
 
+// The models show the paths of the files removed from the cache until they
+// are told about it.
+void FacebookImageDownloader::invokeModelEvictionCallbacks(const QStringList &fbImageIds)
+{
+    Q_D(FacebookImageDownloader);
+    Q_FOREACH (FacebookImageCacheModel *model, d->m_connectedModels) {
+        model->imagesEvicted(fbImageIds);
+    }
+}
+
 QString FacebookImageDownloader::outputFile(const QString &url,
                                                         const QVariantMap &data) const
 {
@@ -51,6 +51,7 @@ protected:
 
 private Q_SLOTS:
     void invokeSpecificModelCallback(const QString &url, const QString &path, const QVariantMap &metadata);
+    void invokeModelEvictionCallbacks(const QStringList &fbImageIds);
 
 private:
     Q_DECLARE_PRIVATE(FacebookImageDownloader)
@@ -21,12 +21,15 @@
 #include "abstractsocialcachemodel_p.h"
 #include "facebooknotificationsdatabase.h"
 
+#include <QtCore/QFutureWatcher>
+
 class FacebookNotificationsModelPrivate : public AbstractSocialCacheModelPrivate
 {
 public:
     explicit FacebookNotificationsModelPrivate(FacebookNotificationsModel *q);
 
     FacebookNotificationsDatabase database;
+    QFutureWatcher<QList<FacebookNotification::ConstPtr> > watcher;
 
 private:
     Q_DECLARE_PUBLIC(FacebookNotificationsModel)
@@ -43,6 +46,7 @@ FacebookNotificationsModel::FacebookNotificationsModel(QObject *parent)
     Q_D(FacebookNotificationsModel);
 
     connect(&d->database, SIGNAL(notificationsChanged()), this, SLOT(notificationsChanged()));
+    connect(&d->watcher, SIGNAL(finished()), this, SLOT(notificationsLoaded()));
 }
 
 QHash<int, QByteArray> FacebookNotificationsModel::roleNames() const
@@ -72,8 +76,20 @@ void FacebookNotificationsModel::notificationsChanged()
 {
     Q_D(FacebookNotificationsModel);
 
+    // Setting a new future drops the result of a load still in progress
+    d->watcher.setFuture(d->database.notificationsAsync());
+}
+
+void FacebookNotificationsModel::notificationsLoaded()
+{
+    Q_D(FacebookNotificationsModel);
+
+    if (d->watcher.isCanceled() || d->watcher.future().resultCount() == 0) {
+        return;
+    }
+
     SocialCacheModelData data;
-    QList<FacebookNotification::ConstPtr> notificationsData = d->database.notifications();
+    QList<FacebookNotification::ConstPtr> notificationsData = d->watcher.result();
     Q_FOREACH (const FacebookNotification::ConstPtr &notification, notificationsData) {
         QMap<int, QVariant> eventMap;
 
@@ -49,6 +49,7 @@ public:
 
 private Q_SLOTS:
     void notificationsChanged();
+    void notificationsLoaded();
 
 private:
     Q_DECLARE_PRIVATE(FacebookNotificationsModel)
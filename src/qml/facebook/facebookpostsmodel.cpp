@@ -23,11 +23,16 @@
 #include <QtCore/QDebug>
 #include "postimagehelper_p.h"
 
+// Posts read when the model is refreshed, and each time the view needs more
+static const int POSTS_PAGE_SIZE = 50;
+
 class FacebookPostsModelPrivate: public AbstractSocialCacheModelPrivate
 {
 public:
     explicit FacebookPostsModelPrivate(FacebookPostsModel *q);
 
+    SocialCacheModelRow createRow(const SocialPost::ConstPtr &post) const;
+
     FacebookPostsDatabase database;
 
 private:
@@ -39,11 +44,47 @@ FacebookPostsModelPrivate::FacebookPostsModelPrivate(FacebookPostsModel *q)
 {
 }
 
+SocialCacheModelRow FacebookPostsModelPrivate::createRow(const SocialPost::ConstPtr &post) const
+{
+    QMap<int, QVariant> eventMap;
+    eventMap.insert(FacebookPostsModel::FacebookId, post->identifier());
+    eventMap.insert(FacebookPostsModel::Name, post->name());
+    eventMap.insert(FacebookPostsModel::Body, post->body());
+    eventMap.insert(FacebookPostsModel::Timestamp, post->timestamp());
+    eventMap.insert(FacebookPostsModel::Icon, post->icon());
+
+    QVariantList images;
+    Q_FOREACH (const SocialPost::Image &image, post->imageList()) {
+        if (image.position > 0) {
+            images.append(createImageData(image));
+        }
+    }
+    eventMap.insert(FacebookPostsModel::Images, images);
+
+    eventMap.insert(FacebookPostsModel::AttachmentName, database.attachmentName(post));
+    eventMap.insert(FacebookPostsModel::AttachmentCaption, database.attachmentCaption(post));
+    eventMap.insert(FacebookPostsModel::AttachmentDescription,
+                    database.attachmentDescription(post));
+    eventMap.insert(FacebookPostsModel::AttachmentUrl, database.attachmentUrl(post));
+    eventMap.insert(FacebookPostsModel::AllowLike, database.allowLike(post));
+    eventMap.insert(FacebookPostsModel::AllowComment, database.allowComment(post));
+    eventMap.insert(FacebookPostsModel::ClientId, database.clientId(post));
+
+    QVariantList accountsVariant;
+    Q_FOREACH (int account, post->accounts()) {
+        accountsVariant.append(account);
+    }
+    eventMap.insert(FacebookPostsModel::Accounts, accountsVariant);
+    return eventMap;
+}
+
 FacebookPostsModel::FacebookPostsModel(QObject *parent)
     : AbstractSocialCacheModel(*(new FacebookPostsModelPrivate(this)), parent)
 {
     Q_D(FacebookPostsModel);
 
+    d->database.setPageSize(POSTS_PAGE_SIZE);
+
     connect(&d->database, &AbstractSocialPostCacheDatabase::postsChanged,
             this, &FacebookPostsModel::postsChanged);
 }
@@ -72,45 +113,52 @@ void FacebookPostsModel::refresh()
 {
     Q_D(FacebookPostsModel);
 
-    d->database.refresh();
+    // Only the changes are read once the posts have been read
+    d->database.refreshChanges(d->database.changeToken());
+}
+
+bool FacebookPostsModel::canFetchMore(const QModelIndex &parent) const
+{
+    Q_D(const FacebookPostsModel);
+
+    return !parent.isValid() && d->database.canFetchMore();
+}
+
+void FacebookPostsModel::fetchMore(const QModelIndex &parent)
+{
+    Q_D(FacebookPostsModel);
+
+    if (!parent.isValid()) {
+        d->database.fetchMore();
+    }
 }
 
 void FacebookPostsModel::postsChanged()
 {
     Q_D(FacebookPostsModel);
 
+    if (d->database.incrementalRefresh()) {
+        QVariantList removedPosts;
+        Q_FOREACH (const QString &identifier, d->database.removedPosts()) {
+            removedPosts.append(identifier);
+        }
+        removeData(removedPosts);
+
+        // Changed posts are in the same order as in posts()
+        const QList<SocialPost::ConstPtr> postsData = d->database.posts();
+        Q_FOREACH (const SocialPost::ConstPtr &post, d->database.changedPosts()) {
+            insertData(postsData.indexOf(post), SocialCacheModelData() << d->createRow(post));
+        }
+
+        emit modelUpdated();
+        return;
+    }
+
     SocialCacheModelData data;
     QList<SocialPost::ConstPtr> postsData = d->database.posts();
 
     Q_FOREACH (const SocialPost::ConstPtr &post, postsData) {
-        QMap<int, QVariant> eventMap;
-        eventMap.insert(FacebookPostsModel::FacebookId, post->identifier());
-        eventMap.insert(FacebookPostsModel::Name, post->name());
-        eventMap.insert(FacebookPostsModel::Body, post->body());
-        eventMap.insert(FacebookPostsModel::Timestamp, post->timestamp());
-        eventMap.insert(FacebookPostsModel::Icon, post->icon());
-
-        QVariantList images;
-        Q_FOREACH (const SocialPostImage::ConstPtr &image, post->images()) {
-            images.append(createImageData(image));
-        }
-        eventMap.insert(FacebookPostsModel::Images, images);
-
-        eventMap.insert(FacebookPostsModel::AttachmentName, d->database.attachmentName(post));
-        eventMap.insert(FacebookPostsModel::AttachmentCaption, d->database.attachmentCaption(post));
-        eventMap.insert(FacebookPostsModel::AttachmentDescription,
-                        d->database.attachmentDescription(post));
-        eventMap.insert(FacebookPostsModel::AttachmentUrl, d->database.attachmentUrl(post));
-        eventMap.insert(FacebookPostsModel::AllowLike, d->database.allowLike(post));
-        eventMap.insert(FacebookPostsModel::AllowComment, d->database.allowComment(post));
-        eventMap.insert(FacebookPostsModel::ClientId, d->database.clientId(post));
-
-        QVariantList accountsVariant;
-        Q_FOREACH (int account, post->accounts()) {
-            accountsVariant.append(account);
-        }
-        eventMap.insert(FacebookPostsModel::Accounts, accountsVariant);
-        data.append(eventMap);
+        data.append(d->createRow(post));
     }
 
     updateData(data);
@@ -48,6 +48,9 @@ public:
 
     void refresh();
 
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
+
 private Q_SLOTS:
     void postsChanged();
 
@@ -27,11 +27,11 @@ static const char *TYPE_KEY = "type";
 static const char *TYPE_PHOTO = "photo";
 static const char *TYPE_VIDEO = "video";
 
-inline static QVariantMap createImageData(const SocialPostImage::ConstPtr &image)
+inline static QVariantMap createImageData(const SocialPost::Image &image)
 {
     QVariantMap imageData;
-    imageData.insert(QLatin1String(URL_KEY), image->url());
-    switch (image->type()) {
+    imageData.insert(QLatin1String(URL_KEY), image.url);
+    switch (image.type) {
     case SocialPostImage::Video:
         imageData.insert(QLatin1String(TYPE_KEY), QLatin1String(TYPE_VIDEO));
         break;
@@ -23,11 +23,16 @@
 #include <QtCore/QDebug>
 #include "postimagehelper_p.h"
 
+// Posts read when the model is refreshed, and each time the view needs more
+static const int POSTS_PAGE_SIZE = 50;
+
 class TwitterPostsModelPrivate: public AbstractSocialCacheModelPrivate
 {
 public:
     explicit TwitterPostsModelPrivate(TwitterPostsModel *q);
 
+    SocialCacheModelRow createRow(const SocialPost::ConstPtr &post) const;
+
     TwitterPostsDatabase database;
 
 private:
@@ -39,11 +44,43 @@ TwitterPostsModelPrivate::TwitterPostsModelPrivate(TwitterPostsModel *q)
 {
 }
 
+SocialCacheModelRow TwitterPostsModelPrivate::createRow(const SocialPost::ConstPtr &post) const
+{
+    QMap<int, QVariant> eventMap;
+    eventMap.insert(TwitterPostsModel::TwitterId, post->identifier());
+    eventMap.insert(TwitterPostsModel::Name, post->name());
+    eventMap.insert(TwitterPostsModel::Body, post->body());
+    eventMap.insert(TwitterPostsModel::Timestamp, post->timestamp());
+    eventMap.insert(TwitterPostsModel::Icon, post->icon());
+
+    QVariantList images;
+    Q_FOREACH (const SocialPost::Image &image, post->imageList()) {
+        if (image.position > 0) {
+            images.append(createImageData(image));
+        }
+    }
+    eventMap.insert(TwitterPostsModel::Images, images);
+
+    eventMap.insert(TwitterPostsModel::ScreenName, database.screenName(post));
+    eventMap.insert(TwitterPostsModel::Retweeter, database.retweeter(post));
+    eventMap.insert(TwitterPostsModel::ConsumerKey, database.consumerKey(post));
+    eventMap.insert(TwitterPostsModel::ConsumerSecret, database.consumerSecret(post));
+
+    QVariantList accountsVariant;
+    Q_FOREACH (int account, post->accounts()) {
+        accountsVariant.append(account);
+    }
+    eventMap.insert(TwitterPostsModel::Accounts, accountsVariant);
+    return eventMap;
+}
+
 TwitterPostsModel::TwitterPostsModel(QObject *parent)
     : AbstractSocialCacheModel(*(new TwitterPostsModelPrivate(this)), parent)
 {
     Q_D(TwitterPostsModel);
 
+    d->database.setPageSize(POSTS_PAGE_SIZE);
+
      connect(&d->database, &AbstractSocialPostCacheDatabase::postsChanged,
              this, &TwitterPostsModel::postsChanged);
 }
@@ -69,40 +106,51 @@ void TwitterPostsModel::refresh()
 {
     Q_D(TwitterPostsModel);
 
-    d->database.refresh();
+    // Only the changes are read once the posts have been read
+    d->database.refreshChanges(d->database.changeToken());
+}
+
+bool TwitterPostsModel::canFetchMore(const QModelIndex &parent) const
+{
+    Q_D(const TwitterPostsModel);
+
+    return !parent.isValid() && d->database.canFetchMore();
+}
+
+void TwitterPostsModel::fetchMore(const QModelIndex &parent)
+{
+    Q_D(TwitterPostsModel);
+
+    if (!parent.isValid()) {
+        d->database.fetchMore();
+    }
 }
 
 void TwitterPostsModel::postsChanged()
 {
     Q_D(TwitterPostsModel);
 
-    SocialCacheModelData data;
-    QList<SocialPost::ConstPtr> postsData = d->database.posts();
-    Q_FOREACH (const SocialPost::ConstPtr &post, postsData) {
-        QMap<int, QVariant> eventMap;
-        eventMap.insert(TwitterPostsModel::TwitterId, post->identifier());
-        eventMap.insert(TwitterPostsModel::Name, post->name());
-        eventMap.insert(TwitterPostsModel::Body, post->body());
-        eventMap.insert(TwitterPostsModel::Timestamp, post->timestamp());
-        eventMap.insert(TwitterPostsModel::Icon, post->icon());
-
-        QVariantList images;
-        Q_FOREACH (const SocialPostImage::ConstPtr &image, post->images()) {
-            images.append(createImageData(image));
+    if (d->database.incrementalRefresh()) {
+        QVariantList removedPosts;
+        Q_FOREACH (const QString &identifier, d->database.removedPosts()) {
+            removedPosts.append(identifier);
         }
-        eventMap.insert(TwitterPostsModel::Images, images);
-
-        eventMap.insert(TwitterPostsModel::ScreenName, d->database.screenName(post));
-        eventMap.insert(TwitterPostsModel::Retweeter, d->database.retweeter(post));
-        eventMap.insert(TwitterPostsModel::ConsumerKey, d->database.consumerKey(post));
-        eventMap.insert(TwitterPostsModel::ConsumerSecret, d->database.consumerSecret(post));
+        removeData(removedPosts);
 
-        QVariantList accountsVariant;
-        Q_FOREACH (int account, post->accounts()) {
-            accountsVariant.append(account);
+        // Changed posts are in the same order as in posts()
+        const QList<SocialPost::ConstPtr> postsData = d->database.posts();
+        Q_FOREACH (const SocialPost::ConstPtr &post, d->database.changedPosts()) {
+            insertData(postsData.indexOf(post), SocialCacheModelData() << d->createRow(post));
         }
-        eventMap.insert(TwitterPostsModel::Accounts, accountsVariant);
-        data.append(eventMap);
+
+        emit modelUpdated();
+        return;
+    }
+
+    SocialCacheModelData data;
+    QList<SocialPost::ConstPtr> postsData = d->database.posts();
+    Q_FOREACH (const SocialPost::ConstPtr &post, postsData) {
+        data.append(d->createRow(post));
     }
 
     updateData(data);
@@ -45,6 +45,9 @@ public:
 
     void refresh();
 
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
+
 private slots:
     void postsChanged();
 
@@ -35,6 +35,7 @@
 #include <QtCore/QStandardPaths>
 #include <QtCore/QDebug>
 #include <QtCore/QDir>
+#include <QtCore/QFile>
 #include <QtSql/QSqlError>
 #include <QtSql/QSqlQuery>
 
@@ -47,6 +48,7 @@ public:
         Update,
         Delete,
         Clean,
+        PrepareDistinct,
         BenchmarkInsertBatch,
         BenchmarkInsertNaive,
         BenchmarkPrepareDeletion,
@@ -55,19 +57,49 @@ public:
     };
 
 
-    explicit DummyDatabase()
+    explicit DummyDatabase(const QString &databaseFile = QLatin1String("test.db"), int version = 1)
         : AbstractSocialCacheDatabase(*(new AbstractSocialCacheDatabasePrivate(
-                this, QLatin1String("Test"), QLatin1String("Test"), QLatin1String("test.db"), 1)))
+                this, QLatin1String("Test"), QLatin1String("Test"), databaseFile, version)))
         , currentTest(None)
+        , version(version)
     {
     }
 
+    // Counts rows from the calling thread
+    int rowCount() const
+    {
+        QSqlQuery query = prepare(QStringLiteral("SELECT COUNT(*) FROM tests"));
+        if (!query.exec() || !query.next()) {
+            return -1;
+        }
+        const int count = query.value(0).toInt();
+        query.finish();
+        return count;
+    }
+
+    // Reads a column of a statement from the calling thread
+    QVariantList values(const QString &statement, int column = 0) const
+    {
+        QVariantList result;
+        QSqlQuery query = prepare(statement);
+        if (query.exec()) {
+            while (query.next()) {
+                result.append(query.value(column));
+            }
+        }
+        query.finish();
+        return result;
+    }
+
     using AbstractSocialCacheDatabase::executeRead;
     using AbstractSocialCacheDatabase::executeWrite;
+    using AbstractSocialCacheDatabase::setTuningProfile;
 
     Test currentTest;
 
 private:
+    const int version;
+
 
     bool testInsert() {
 
@@ -196,6 +228,17 @@ private:
         query.exec();
     }
 
+    bool prepareDistinct() {
+        for (int i = 0; i < 10; i ++) {
+            QSqlQuery query = prepare(QString(QStringLiteral("SELECT value FROM tests WHERE id = %1")).arg(i));
+            if (!query.exec()) {
+                return false;
+            }
+            query.finish();
+        }
+        return true;
+    }
+
     void benchmarkInsertBatch() {
         QVariantList ids;
         QVariantList values;
@@ -281,6 +324,8 @@ protected:
         case Clean:
             clean();
             return true;
+        case PrepareDistinct:
+            return prepareDistinct();
         case BenchmarkInsertBatch:
             benchmarkInsertBatch();
             return true;
@@ -344,6 +389,10 @@ protected:
             return false;
         }
 
+        if (version >= 2 && !upgradeTables(database, 1)) {
+            return false;
+        }
+
         query.prepare( "CREATE TABLE IF NOT EXISTS albums ("
                        "id INTEGER UNIQUE PRIMARY KEY AUTOINCREMENT,"
                        "value TEXT)");
@@ -362,6 +411,16 @@ protected:
         return true;
     }
 
+    bool upgradeTables(QSqlDatabase database, int fromVersion) const
+    {
+        if (fromVersion != 1) {
+            return false;
+        }
+
+        QSqlQuery query(database);
+        return query.exec(QStringLiteral("ALTER TABLE tests ADD COLUMN comment TEXT"));
+    }
+
     bool dropTables(QSqlDatabase database) const
     {
         QSqlQuery query(database);
@@ -392,6 +451,14 @@ class AbstractSocialCacheDatabaseTest: public QObject
     Q_OBJECT
 private:
     DummyDatabase *db;
+    // Database files created by the current test, removed once it finishes
+    QStringList temporaryFiles;
+
+    QString temporaryDatabase(const QString &databaseFile)
+    {
+        temporaryFiles.append(databaseFile);
+        return databaseFile;
+    }
 
 private slots:
     // Perform some cleanups
@@ -407,6 +474,18 @@ private slots:
         db = new DummyDatabase;
     }
 
+    void cleanup()
+    {
+        Q_FOREACH (const QString &databaseFile, temporaryFiles) {
+            const QString path = QString(QLatin1String("%1/Test/%2")).arg(
+                        QLatin1String(PRIVILEGED_DATA_DIR), databaseFile);
+            QFile::remove(path);
+            QFile::remove(path + QLatin1String("-wal"));
+            QFile::remove(path + QLatin1String("-shm"));
+        }
+        temporaryFiles.clear();
+    }
+
     void testCommits()
     {
         db->currentTest = DummyDatabase::Insert;
@@ -434,6 +513,223 @@ private slots:
         QCOMPARE(db->readStatus(), AbstractSocialCacheDatabase::Finished);
     }
 
+    void testDedicatedThreads()
+    {
+        db->setExecutionMode(AbstractSocialCacheDatabase::DedicatedThreads);
+        QCOMPARE(db->executionMode(), AbstractSocialCacheDatabase::DedicatedThreads);
+
+        db->setReaderThreadCount(3);
+        QCOMPARE(db->readerThreadCount(), 3);
+
+        const int reads = db->readerStatistics().reads;
+
+        clean();
+        testCommits();
+
+        const AbstractSocialCacheDatabase::ReaderStatistics statistics = db->readerStatistics();
+        QCOMPARE(statistics.reads - reads, 3);
+        QCOMPARE(statistics.activeReads, 0);
+        QVERIFY(statistics.connections >= 1);
+        QVERIFY(statistics.connections <= db->readerThreadCount());
+
+        // A thread keeps a read-only and a writable connection to the file,
+        // whichever database opened one of them first
+        DummyDatabase other;
+        QCOMPARE(db->values(QStringLiteral("PRAGMA query_only")).value(0).toInt(), 1);
+        QCOMPARE(other.values(QStringLiteral("PRAGMA query_only")).value(0).toInt(), 0);
+
+        db->setExecutionMode(AbstractSocialCacheDatabase::GlobalThreadPool);
+    }
+
+    void testGroupCommit()
+    {
+        DummyDatabase other;
+
+        db->setExecutionMode(AbstractSocialCacheDatabase::DedicatedThreads);
+        other.setExecutionMode(AbstractSocialCacheDatabase::DedicatedThreads);
+        db->setGroupCommit(100, 8);
+        QCOMPARE(other.groupCommitLatency(), 100);
+        QCOMPARE(other.groupCommitBatchSize(), 8);
+
+        clean();
+        db->resetTransactionStatistics();
+        other.resetTransactionStatistics();
+
+        // Both writes share a transaction, and the conflicting one fails alone
+        db->currentTest = DummyDatabase::Insert;
+        other.currentTest = DummyDatabase::Insert;
+        db->executeWrite();
+        other.executeWrite();
+        db->wait();
+        other.wait();
+        QCOMPARE(db->writeStatus(), AbstractSocialCacheDatabase::Finished);
+        QCOMPARE(other.writeStatus(), AbstractSocialCacheDatabase::Error);
+        QCOMPARE(db->transactionStatistics().groupedWrites, 1);
+        QCOMPARE(other.transactionStatistics().groupedWrites, 1);
+
+        db->executeRead();
+        db->wait();
+        QCOMPARE(db->readStatus(), AbstractSocialCacheDatabase::Finished);
+
+        db->setGroupCommit(0, 1);
+        db->setExecutionMode(AbstractSocialCacheDatabase::GlobalThreadPool);
+    }
+
+    void testTransactionStatistics()
+    {
+        clean();
+        db->resetTransactionStatistics();
+
+        db->currentTest = DummyDatabase::Insert;
+        db->executeWrite();
+        db->wait();
+        QCOMPARE(db->writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        const AbstractSocialCacheDatabase::TransactionStatistics statistics = db->transactionStatistics();
+        QCOMPARE(statistics.lockWait.count, 1);
+        QCOMPARE(statistics.transaction.count, 1);
+        QCOMPARE(statistics.commit.count, 1);
+        QCOMPARE(statistics.queueDelay.count, 1);
+
+        int samples = 0;
+        Q_FOREACH (int count, statistics.commit.histogram) {
+            samples += count;
+        }
+        QCOMPARE(samples, 1);
+        QVERIFY(statistics.commit.maximum <= statistics.commit.total);
+
+        db->dumpStatistics();
+    }
+
+    void testMigration()
+    {
+        const QString databaseFile = temporaryDatabase(QLatin1String("migration.db"));
+
+        DummyDatabase oldDatabase(databaseFile, 1);
+        oldDatabase.currentTest = DummyDatabase::Insert;
+        oldDatabase.executeWrite();
+        oldDatabase.wait();
+        QCOMPARE(oldDatabase.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        // Connections are opened per thread, so this thread runs the upgrade
+        DummyDatabase newDatabase(databaseFile, 2);
+        QVERIFY(newDatabase.isValid());
+        QCOMPARE(newDatabase.rowCount(), 3);
+        QCOMPARE(newDatabase.values(QStringLiteral("PRAGMA user_version")).value(0).toInt(), 2);
+        QVERIFY(newDatabase.values(QStringLiteral("PRAGMA table_info(tests)"), 1)
+                .contains(QLatin1String("comment")));
+    }
+
+    void testPreparedQueryCache()
+    {
+        const int cacheSize = db->preparedQueryCacheSize();
+        db->setPreparedQueryCacheSize(4);
+
+        const AbstractSocialCacheDatabase::PreparedQueryStatistics before = db->preparedQueryStatistics();
+
+        db->currentTest = DummyDatabase::PrepareDistinct;
+        db->executeRead();
+        db->wait();
+        QCOMPARE(db->readStatus(), AbstractSocialCacheDatabase::Finished);
+
+        const AbstractSocialCacheDatabase::PreparedQueryStatistics after = db->preparedQueryStatistics();
+        QCOMPARE(after.misses - before.misses, 10);
+        QVERIFY(after.evictions - before.evictions >= 6);
+
+        db->currentTest = DummyDatabase::Insert;
+        db->executeRead();
+        db->wait();
+        db->executeRead();
+        db->wait();
+        QVERIFY(db->preparedQueryStatistics().hits > after.hits);
+
+        db->setPreparedQueryCacheSize(cacheSize);
+    }
+
+    void testTuningProfile()
+    {
+        DummyDatabase tuned(temporaryDatabase(QLatin1String("tuning.db")));
+        tuned.setTuningProfile(AbstractSocialCacheDatabase::TuningProfile::preset(
+                    AbstractSocialCacheDatabase::SmallTuning));
+        QCOMPARE(tuned.tuningProfile().pageSize, 1024);
+        QVERIFY(tuned.isValid());
+
+        // Negative cache sizes are in KiB, and NORMAL is 1
+        QCOMPARE(tuned.values(QStringLiteral("PRAGMA page_size")).value(0).toInt(), 1024);
+        QCOMPARE(tuned.values(QStringLiteral("PRAGMA cache_size")).value(0).toInt(), -256);
+        QCOMPARE(tuned.values(QStringLiteral("PRAGMA synchronous")).value(0).toInt(), 1);
+
+        tuned.currentTest = DummyDatabase::Insert;
+        tuned.executeWrite();
+        tuned.wait();
+        QCOMPARE(tuned.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        QCOMPARE(tuned.rowCount(), 3);
+    }
+
+    void testMaintenance()
+    {
+        DummyDatabase maintained(temporaryDatabase(QLatin1String("maintenance.db")));
+        maintained.setTuningProfile(AbstractSocialCacheDatabase::TuningProfile::preset(
+                    AbstractSocialCacheDatabase::SmallTuning));
+        maintained.setMaintenance(0, 100000);
+
+        maintained.currentTest = DummyDatabase::BenchmarkInsertBatch;
+        for (int i = 0; i < 50; ++i) {
+            maintained.executeWrite();
+            maintained.wait();
+        }
+        maintained.currentTest = DummyDatabase::Clean;
+        maintained.executeWrite();
+        maintained.wait();
+        QCOMPARE(maintained.rowCount(), 0);
+
+        maintained.runMaintenance();
+        maintained.wait();
+
+        const AbstractSocialCacheDatabase::MaintenanceStatistics statistics
+                = maintained.maintenanceStatistics();
+        QCOMPARE(statistics.runs, 1);
+        QVERIFY(statistics.pagesReclaimed > 0);
+        QVERIFY(statistics.checkpointedFrames > 0);
+
+        // Scheduled once no write has finished for the interval
+        maintained.setMaintenance(50, 16);
+        maintained.currentTest = DummyDatabase::Insert;
+        maintained.executeWrite();
+        maintained.wait();
+        QCOMPARE(maintained.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        QTRY_COMPARE(maintained.maintenanceStatistics().runs, 2);
+    }
+
+    void tuningBenchmark_data()
+    {
+        QTest::addColumn<int>("preset");
+
+        QTest::newRow("default") << int(AbstractSocialCacheDatabase::DefaultTuning);
+        QTest::newRow("small") << int(AbstractSocialCacheDatabase::SmallTuning);
+        QTest::newRow("read-mostly") << int(AbstractSocialCacheDatabase::ReadMostlyTuning);
+    }
+
+    // Many small commits, where the synchronous setting matters the most
+    void tuningBenchmark()
+    {
+        QFETCH(int, preset);
+
+        DummyDatabase tuned(temporaryDatabase(QString(QLatin1String("tuning-%1.db")).arg(preset)));
+        tuned.setTuningProfile(AbstractSocialCacheDatabase::TuningProfile::preset(
+                    AbstractSocialCacheDatabase::TuningPreset(preset)));
+
+        QBENCHMARK {
+            tuned.currentTest = DummyDatabase::Insert;
+            tuned.executeWrite();
+            tuned.wait();
+            tuned.currentTest = DummyDatabase::Clean;
+            tuned.executeWrite();
+            tuned.wait();
+        }
+        QCOMPARE(tuned.writeStatus(), AbstractSocialCacheDatabase::Finished);
+    }
+
 //private:
 
     void insertionBenchmarkBatch()
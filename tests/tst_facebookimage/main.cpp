@@ -31,18 +31,77 @@
 
 #include <QtTest/QTest>
 #include "facebookimagesdatabase.h"
+#include "facebookimagesdatabase_p.h"
 #include "socialsyncinterface.h"
 #include "facebook/facebookimagecachemodel.h"
+#include "facebook/facebookimagedownloader.h"
 #include <QtCore/QDebug>
 #include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QRegExp>
+#include <QtCore/QSet>
 #include <QtCore/QStandardPaths>
+#include <QtCore/QUrl>
+#include <QtGui/QImage>
 #include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlQuery>
+#include <QtTest/QSignalSpy>
 
 class FacebookImageTest: public QObject
 {
     Q_OBJECT
 private:
+    static QString queryPlan(QSqlDatabase database, const QString &queryString)
+    {
+        QStringList details;
+        QSqlQuery query(database);
+        query.prepare(QLatin1String("EXPLAIN QUERY PLAN ") + queryString);
+
+        // The values do not change the plan, but all placeholders need one
+        QRegExp placeholder(QLatin1String(":\\w+"));
+        int index = 0;
+        while ((index = placeholder.indexIn(queryString, index)) >= 0) {
+            query.bindValue(placeholder.cap(0), 0);
+            index += placeholder.matchedLength();
+        }
+
+        if (query.exec()) {
+            while (query.next()) {
+                details.append(query.value(3).toString());
+            }
+        }
+        return details.join(QLatin1String("; "));
+    }
+
+    // Reads or sets the last access of an image, from a connection of its own
+    static qint64 lastAccess(const QString &fbImageId, qint64 setAccess = -1)
+    {
+        qint64 access = -1;
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(
+                        QLatin1String("QSQLITE"), QLatin1String("access"));
+            database.setDatabaseName(QString(QLatin1String("%1/%2/facebook.db")).arg(
+                        QLatin1String(PRIVILEGED_DATA_DIR),
+                        SocialSyncInterface::dataType(SocialSyncInterface::Images)));
+            if (database.open()) {
+                QSqlQuery query(database);
+                if (setAccess >= 0) {
+                    query.prepare(QLatin1String(
+                                "UPDATE images SET lastAccess = :lastAccess WHERE fbImageId = :fbImageId"));
+                    query.bindValue(QLatin1String(":lastAccess"), setAccess);
+                } else {
+                    query.prepare(QLatin1String(
+                                "SELECT lastAccess FROM images WHERE fbImageId = :fbImageId"));
+                }
+                query.bindValue(QLatin1String(":fbImageId"), fbImageId);
+                if (query.exec()) {
+                    access = query.next() ? query.value(0).toLongLong() : setAccess;
+                }
+            }
+        }
+        QSqlDatabase::removeDatabase(QLatin1String("access"));
+        return access;
+    }
 
 private slots:
     // Perform some cleanups
@@ -524,6 +583,600 @@ private slots:
         QCOMPARE(images.count(), 0);
     }
 
+    void unchangedImages()
+    {
+        const QDateTime time(QDate(2013, 1, 2), QTime(12, 34, 56));
+        const QString user = QLatin1String("unchangedUser");
+        const QString album = QLatin1String("unchangedAlbum");
+        const QString image = QLatin1String("unchangedImage");
+
+        FacebookImagesDatabase database;
+        database.addUser(user, time, QLatin1String("joe"));
+        database.addAlbum(album, user, time, time, QLatin1String("holidays"), 1);
+        database.addImage(image, album, user, time, time, QLatin1String("1"), 640, 480,
+                          QLatin1String("file:///t1.jpg"), QLatin1String("file:///1.jpg"));
+        database.updateImageThumbnail(image, QLatin1String("/tmp/t1.jpg"));
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        const int unchangedRows = database.transactionStatistics().unchangedRows;
+
+        // The same image again keeps its downloaded thumbnail
+        database.addImage(image, album, user, time, time, QLatin1String("1"), 640, 480,
+                          QLatin1String("file:///t1.jpg"), QLatin1String("file:///1.jpg"));
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        QCOMPARE(database.transactionStatistics().unchangedRows, unchangedRows + 1);
+
+        database.queryAlbumImages(album);
+        database.wait();
+        QCOMPARE(database.images().count(), 1);
+        QCOMPARE(database.images().first()->thumbnailFile(), QString(QLatin1String("/tmp/t1.jpg")));
+
+        // A changed image is written again
+        database.addImage(image, album, user, time, time, QLatin1String("renamed"), 640, 480,
+                          QLatin1String("file:///t1.jpg"), QLatin1String("file:///1.jpg"));
+        database.commit();
+        database.wait();
+        QCOMPARE(database.transactionStatistics().unchangedRows, unchangedRows + 1);
+
+        database.queryAlbumImages(album);
+        database.wait();
+        QCOMPARE(database.images().first()->imageName(), QString(QLatin1String("renamed")));
+
+        database.removeUser(user);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+    }
+
+    void imageCounts()
+    {
+        const QDateTime time(QDate(2013, 1, 2), QTime(12, 34, 56));
+        const QString user1 = QLatin1String("countUser1");
+        const QString user2 = QLatin1String("countUser2");
+        const QString album = QLatin1String("countAlbum");
+
+        FacebookImagesDatabase database;
+        const int imageCount = database.imageCount();
+
+        // Images cached before their user are counted when the user is added
+        database.addImage(QLatin1String("count1"), album, user1, time, time, QLatin1String("1"),
+                          640, 480, QLatin1String("file:///t1.jpg"), QLatin1String("file:///1.jpg"));
+        database.addImage(QLatin1String("count2"), album, user1, time, time, QLatin1String("2"),
+                          640, 480, QLatin1String("file:///t2.jpg"), QLatin1String("file:///2.jpg"));
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        database.addUser(user1, time, QLatin1String("joe"));
+        database.addUser(user2, time, QLatin1String("jane"));
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        QCOMPARE(database.imageCount(), imageCount + 2);
+
+        // Replacing an image, or the user, keeps the count
+        database.addImage(QLatin1String("count1"), album, user1, time, time, QLatin1String("a"),
+                          640, 480, QLatin1String("file:///t1.jpg"), QLatin1String("file:///1.jpg"));
+        database.addUser(user1, time, QLatin1String("joseph"));
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        database.queryUsers();
+        database.wait();
+        QMap<QString, int> counts;
+        Q_FOREACH (const FacebookUser::ConstPtr &user, database.users()) {
+            counts.insert(user->fbUserId(), user->count());
+        }
+        QCOMPARE(counts.value(user1), 2);
+        QCOMPARE(counts.value(user2), 0);
+
+        // An image moved to another user is counted for that user
+        database.addImage(QLatin1String("count2"), album, user2, time, time, QLatin1String("2"),
+                          640, 480, QLatin1String("file:///t2.jpg"), QLatin1String("file:///2.jpg"));
+        database.addImage(QLatin1String("count3"), album, user2, time, time, QLatin1String("3"),
+                          640, 480, QLatin1String("file:///t3.jpg"), QLatin1String("file:///3.jpg"));
+        database.removeImage(QLatin1String("count1"));
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        database.queryUsers();
+        database.wait();
+        counts.clear();
+        Q_FOREACH (const FacebookUser::ConstPtr &user, database.users()) {
+            counts.insert(user->fbUserId(), user->count());
+        }
+        QCOMPARE(counts.value(user1), 0);
+        QCOMPARE(counts.value(user2), 2);
+        QCOMPARE(database.imageCount(), imageCount + 2);
+        QCOMPARE(database.totalImageCount(), imageCount + 2);
+
+        database.removeAlbum(album);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        QCOMPARE(database.imageCount(), imageCount);
+
+        database.removeUser(user1);
+        database.removeUser(user2);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+    }
+
+    void pagedImages()
+    {
+        const QDateTime time(QDate(2013, 1, 2), QTime(12, 34, 56));
+        const QString user = QLatin1String("pagedUser");
+        const QString album = QLatin1String("pagedAlbum");
+        const int imageCount = 130;
+
+        FacebookImagesDatabase database;
+        QVERIFY(database.syncAccount(5, user));
+        database.addUser(user, time, QLatin1String("joe"));
+        // The first two images are updated at the same time, and are sorted by id
+        for (int i = 0; i < imageCount; ++i) {
+            database.addImage(QString(QLatin1String("paged%1")).arg(i, 3, 10, QLatin1Char('0')),
+                              album, user, time, time.addSecs(qMax(0, i - 1)),
+                              QLatin1String("name"), 640, 480,
+                              QLatin1String("file:///t.jpg"), QLatin1String("file:///i.jpg"));
+        }
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        database.setPageSize(50);
+        database.queryUserImages(user);
+        database.wait();
+        QCOMPARE(database.images().count(), 50);
+        QCOMPARE(database.imagesAppended(), false);
+        QCOMPARE(database.images().first()->fbImageId(), QString(QLatin1String("paged129")));
+        QVERIFY(database.canFetchMore());
+
+        database.fetchMore();
+        database.wait();
+        QCOMPARE(database.imagesAppended(), true);
+        QCOMPARE(database.images().count(), 100);
+        database.fetchMore();
+        database.wait();
+        QCOMPARE(database.images().count(), imageCount);
+        QVERIFY(!database.canFetchMore());
+
+        QStringList imageIds;
+        Q_FOREACH (const FacebookImage::ConstPtr &image, database.images()) {
+            imageIds.append(image->fbImageId());
+        }
+        QCOMPARE(imageIds.count(), imageIds.toSet().count());
+        QCOMPARE(imageIds.last(), QString(QLatin1String("paged000")));
+
+        // Refreshing keeps the images already read
+        database.queryUserImages(user);
+        database.wait();
+        QCOMPARE(database.images().count(), imageCount);
+        QCOMPARE(database.imagesAppended(), false);
+
+        // Album images are paged from the oldest
+        database.queryAlbumImages(album);
+        database.wait();
+        QCOMPARE(database.images().count(), 50);
+        QCOMPARE(database.images().first()->fbImageId(), QString(QLatin1String("paged000")));
+        QCOMPARE(database.images().at(1)->fbImageId(), QString(QLatin1String("paged001")));
+
+        FacebookImageCacheModel model;
+        model.setType(FacebookImageCacheModel::Images);
+        model.setNodeIdentifier(QLatin1String("user-") + user);
+        model.refresh();
+        QTRY_VERIFY(model.count() > 0);
+        QVERIFY(model.canFetchMore(QModelIndex()));
+        while (model.canFetchMore(QModelIndex())) {
+            const int count = model.count();
+            model.fetchMore(QModelIndex());
+            QTRY_VERIFY(model.count() > count);
+        }
+        QCOMPARE(model.count(), imageCount);
+
+        database.purgeAccount(5);
+        database.removeUser(user);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+    }
+
+    void fileRemovals()
+    {
+        const QDateTime time(QDate(2013, 1, 2), QTime(12, 34, 56));
+        const QString user = QLatin1String("removalUser");
+        const QString album = QLatin1String("removalAlbum");
+        const QString directory = QString(QLatin1String("%1/removals")).arg(
+                    QLatin1String(PRIVILEGED_DATA_DIR));
+        QVERIFY(QDir().mkpath(directory));
+
+        QStringList files;
+        for (int i = 0; i < 4; ++i) {
+            QFile file(QString(QLatin1String("%1/%2.jpg")).arg(directory).arg(i));
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.write(QByteArray(100, 'x'));
+            files.append(file.fileName());
+        }
+
+        FacebookImagesDatabase database;
+        database.addUser(user, time, QLatin1String("joe"));
+        for (int i = 0; i < 2; ++i) {
+            const QString image = QString(QLatin1String("removal%1")).arg(i);
+            database.addImage(image, album, user, time, time, QLatin1String("name"), 640, 480,
+                              QLatin1String("file:///t.jpg"), QLatin1String("file:///i.jpg"));
+            database.updateImageThumbnail(image, files.at(2 * i));
+            database.updateImageFile(image, files.at(2 * i + 1));
+        }
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        const AbstractSocialCacheDatabase::FileRemovalStatistics statistics
+                = database.fileRemovalStatistics();
+
+        // The files are removed after the write, before it is reported finished
+        database.removeAlbum(album);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        Q_FOREACH (const QString &file, files) {
+            QVERIFY(!QFile::exists(file));
+        }
+        QCOMPARE(database.fileRemovalStatistics().removedFiles, statistics.removedFiles + 4);
+        QCOMPARE(database.fileRemovalStatistics().reclaimedBytes, statistics.reclaimedBytes + 400);
+
+        // Files left queued by a process that crashed are removed by the next write
+        QFile file(files.first());
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write(QByteArray(100, 'x'));
+        file.close();
+
+        {
+            QSqlDatabase connection = QSqlDatabase::addDatabase(
+                        QLatin1String("QSQLITE"), QLatin1String("removals"));
+            connection.setDatabaseName(QString(QLatin1String("%1/%2/facebook.db")).arg(
+                        QLatin1String(PRIVILEGED_DATA_DIR),
+                        SocialSyncInterface::dataType(SocialSyncInterface::Images)));
+            QVERIFY(connection.open());
+
+            QSqlQuery query(connection);
+            query.prepare(QLatin1String("INSERT INTO pending_file_removals (path) VALUES (:path)"));
+            query.bindValue(QLatin1String(":path"), files.first());
+            QVERIFY(query.exec());
+        }
+        QSqlDatabase::removeDatabase(QLatin1String("removals"));
+
+        FacebookImagesDatabase otherDatabase;
+        otherDatabase.removeUser(user);
+        otherDatabase.commit();
+        otherDatabase.wait();
+        QCOMPARE(otherDatabase.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        QVERIFY(!QFile::exists(files.first()));
+        QCOMPARE(otherDatabase.fileRemovalStatistics().removedFiles, 1);
+
+        // Files written after they were queued, like downloads that are not
+        // committed yet, and files still used by an image are kept
+        otherDatabase.addUser(user, time, QLatin1String("joe"));
+        otherDatabase.addImage(QLatin1String("removal0"), album, user, time, time,
+                               QLatin1String("name"), 640, 480,
+                               QLatin1String("file:///t.jpg"), QLatin1String("file:///i.jpg"));
+        otherDatabase.updateImageThumbnail(QLatin1String("removal0"), files.at(2));
+        otherDatabase.commit();
+        otherDatabase.wait();
+        QCOMPARE(otherDatabase.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        for (int i = 1; i <= 2; ++i) {
+            QFile file(files.at(i));
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.write(QByteArray(100, 'x'));
+        }
+
+        {
+            QSqlDatabase connection = QSqlDatabase::addDatabase(
+                        QLatin1String("QSQLITE"), QLatin1String("removals"));
+            connection.setDatabaseName(QString(QLatin1String("%1/%2/facebook.db")).arg(
+                        QLatin1String(PRIVILEGED_DATA_DIR),
+                        SocialSyncInterface::dataType(SocialSyncInterface::Images)));
+            QVERIFY(connection.open());
+
+            QSqlQuery query(connection);
+            query.prepare(QLatin1String(
+                        "INSERT INTO pending_file_removals (path, queued) VALUES (:path, :queued)"));
+            query.bindValue(QLatin1String(":path"), files.at(1));
+            query.bindValue(QLatin1String(":queued"), 1);
+            QVERIFY(query.exec());
+            query.bindValue(QLatin1String(":path"), files.at(2));
+            query.bindValue(QLatin1String(":queued"), QVariant());
+            QVERIFY(query.exec());
+        }
+        QSqlDatabase::removeDatabase(QLatin1String("removals"));
+
+        FacebookImagesDatabase thirdDatabase;
+        thirdDatabase.removeImage(QLatin1String("missing"));
+        thirdDatabase.commit();
+        thirdDatabase.wait();
+        QCOMPARE(thirdDatabase.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        QVERIFY(QFile::exists(files.at(1)));
+        QVERIFY(QFile::exists(files.at(2)));
+        QCOMPARE(thirdDatabase.fileRemovalStatistics().removedFiles, 0);
+
+        // The unreferenced file written again stays queued as of its write
+        {
+            QSqlDatabase connection = QSqlDatabase::addDatabase(
+                        QLatin1String("QSQLITE"), QLatin1String("removals"));
+            connection.setDatabaseName(QString(QLatin1String("%1/%2/facebook.db")).arg(
+                        QLatin1String(PRIVILEGED_DATA_DIR),
+                        SocialSyncInterface::dataType(SocialSyncInterface::Images)));
+            QVERIFY(connection.open());
+
+            QSqlQuery query(connection);
+            query.prepare(QLatin1String(
+                        "SELECT path, queued FROM pending_file_removals ORDER BY path"));
+            QVERIFY(query.exec());
+            QVERIFY(query.next());
+            QCOMPARE(query.value(0).toString(), files.at(1));
+            QVERIFY(query.value(1).toLongLong() > 1);
+            QVERIFY(!query.next());
+        }
+        QSqlDatabase::removeDatabase(QLatin1String("removals"));
+
+        // and is removed with the next files if nothing took it
+        thirdDatabase.removeUser(user);
+        thirdDatabase.commit();
+        thirdDatabase.wait();
+        QCOMPARE(thirdDatabase.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        QVERIFY(!QFile::exists(files.at(1)));
+        QVERIFY(!QFile::exists(files.at(2)));
+    }
+
+    void diskBudget()
+    {
+        const QDateTime time(QDate(2013, 1, 2), QTime(12, 34, 56));
+        const QString user = QLatin1String("budgetUser");
+        const QString album = QLatin1String("budgetAlbum");
+        const QString directory = QString(QLatin1String("%1/budget")).arg(
+                    QLatin1String(PRIVILEGED_DATA_DIR));
+        QVERIFY(QDir().mkpath(directory));
+
+        FacebookImagesDatabase database;
+        database.addUser(user, time, QLatin1String("joe"));
+
+        QStringList images;
+        QStringList files;
+        for (int i = 0; i < 4; ++i) {
+            const QString image = QString(QLatin1String("budget%1")).arg(i);
+            database.addImage(image, album, user, time, time, QLatin1String("name"), 640, 480,
+                              QLatin1String("file:///t.jpg"), QLatin1String("file:///i.jpg"));
+            for (int j = 0; j < 2; ++j) {
+                QFile file(QString(QLatin1String("%1/%2-%3.jpg")).arg(directory, image).arg(j));
+                QVERIFY(file.open(QIODevice::WriteOnly));
+                file.write(QByteArray(100, 'x'));
+                files.append(file.fileName());
+            }
+            database.updateImageThumbnail(image, files.at(2 * i));
+            database.updateImageFile(image, files.at(2 * i + 1));
+            images.append(image);
+        }
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        // Makes the first images the least recently accessed ones
+        {
+            QSqlDatabase connection = QSqlDatabase::addDatabase(
+                        QLatin1String("QSQLITE"), QLatin1String("budget"));
+            connection.setDatabaseName(QString(QLatin1String("%1/%2/facebook.db")).arg(
+                        QLatin1String(PRIVILEGED_DATA_DIR),
+                        SocialSyncInterface::dataType(SocialSyncInterface::Images)));
+            QVERIFY(connection.open());
+
+            QSqlQuery query(connection);
+            query.prepare(QLatin1String("UPDATE images SET lastAccess = :lastAccess WHERE fbImageId = :fbImageId"));
+            for (int i = 0; i < images.count(); ++i) {
+                query.bindValue(QLatin1String(":lastAccess"), i + 1);
+                query.bindValue(QLatin1String(":fbImageId"), images.at(i));
+                QVERIFY(query.exec());
+            }
+        }
+        QSqlDatabase::removeDatabase(QLatin1String("budget"));
+
+        // Each image takes 200 bytes, so two of them have to be evicted
+        QSignalSpy evictedSpy(&database, SIGNAL(imagesEvicted(QStringList)));
+        database.setDiskBudget(450);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        QTRY_COMPARE(evictedSpy.count(), 1);
+        QStringList evictedImages = evictedSpy.first().first().toStringList();
+        evictedImages.sort();
+        QCOMPARE(evictedImages, images.mid(0, 2));
+
+        for (int i = 0; i < files.count(); ++i) {
+            QCOMPARE(QFile::exists(files.at(i)), i >= 4);
+        }
+
+        database.queryAlbumImages(album);
+        database.wait();
+        QCOMPARE(database.images().count(), 4);
+        Q_FOREACH (const FacebookImage::ConstPtr &image, database.images()) {
+            const bool evicted = image->fbImageId() == images.at(0) || image->fbImageId() == images.at(1);
+            QCOMPARE(image->thumbnailFile().isEmpty(), evicted);
+            QCOMPARE(image->imageFile().isEmpty(), evicted);
+        }
+
+        // An access keeps the third image, and evicts the last one instead
+        database.recordAccess(images.at(2));
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        database.setDiskBudget(250);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        QVERIFY(QFile::exists(files.at(4)));
+        QVERIFY(QFile::exists(files.at(5)));
+        QVERIFY(!QFile::exists(files.at(6)));
+        QVERIFY(!QFile::exists(files.at(7)));
+
+        // A changed image keeps the file of the url that did not change
+        database.addImage(images.at(2), album, user, time, time, QLatin1String("renamed"), 640, 480,
+                          QLatin1String("file:///t2.jpg"), QLatin1String("file:///i.jpg"));
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        QVERIFY(!QFile::exists(files.at(4)));
+        QVERIFY(QFile::exists(files.at(5)));
+
+        database.queryAlbumImages(album);
+        database.wait();
+        Q_FOREACH (const FacebookImage::ConstPtr &image, database.images()) {
+            if (image->fbImageId() == images.at(2)) {
+                QCOMPARE(image->imageName(), QLatin1String("renamed"));
+                QCOMPARE(image->thumbnailFile(), QString());
+                QCOMPARE(image->imageFile(), files.at(5));
+            }
+        }
+
+        database.setDiskBudget(0);
+        database.removeUser(user);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        QVERIFY(!QFile::exists(files.at(5)));
+    }
+
+    void modelEviction()
+    {
+        const QDateTime time(QDate(2013, 1, 2), QTime(12, 34, 56));
+        const QString user = QLatin1String("evictionUser");
+        const QString album = QLatin1String("evictionAlbum");
+        const QString directory = QString(QLatin1String("%1/eviction")).arg(
+                    QLatin1String(PRIVILEGED_DATA_DIR));
+        QVERIFY(QDir().mkpath(directory));
+
+        FacebookImagesDatabase database;
+        database.addUser(user, time, QLatin1String("joe"));
+
+        QStringList images;
+        QStringList files;
+        for (int i = 0; i < 2; ++i) {
+            const QString image = QString(QLatin1String("evicted%1")).arg(i);
+            const QString source = QString(QLatin1String("%1/source%2.png")).arg(directory).arg(i);
+            const QString file = QString(QLatin1String("%1/cached%2.png")).arg(directory).arg(i);
+
+            QImage thumbnail(4, 4, QImage::Format_RGB32);
+            thumbnail.fill(Qt::red);
+            QVERIFY(thumbnail.save(source, "PNG"));
+            QVERIFY(thumbnail.save(file, "PNG"));
+
+            database.addImage(image, album, user, time.addSecs(i), time, QLatin1String("name"),
+                              4, 4, QUrl::fromLocalFile(source).toString(),
+                              QUrl::fromLocalFile(source).toString());
+            database.updateImageThumbnail(image, file);
+            images.append(image);
+            files.append(file);
+        }
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        Q_FOREACH (const QString &image, images) {
+            QCOMPARE(lastAccess(image, 1), qint64(1));
+        }
+
+        FacebookImageDownloader downloader;
+        FacebookImageCacheModel model;
+        model.setDownloader(&downloader);
+        model.setType(FacebookImageCacheModel::Images);
+        model.setNodeIdentifier(QLatin1String("album-") + album);
+        model.refresh();
+        QTRY_COMPARE(model.count(), 2);
+
+        // The images shown are accessed, and written a few seconds later
+        QCOMPARE(lastAccess(images.at(0)), qint64(1));
+        QTRY_VERIFY_WITH_TIMEOUT(lastAccess(images.at(0)) > 1, 10000);
+        QVERIFY(lastAccess(images.at(1)) > 1);
+
+        int evictedRow = -1;
+        for (int row = 0; row < model.count(); ++row) {
+            const QModelIndex index = model.index(row);
+            if (model.data(index, FacebookImageCacheModel::FacebookId).toString() == images.at(0)) {
+                evictedRow = row;
+            }
+            QVERIFY(!model.data(index, FacebookImageCacheModel::Thumbnail).toString().isEmpty());
+        }
+        QVERIFY(evictedRow >= 0);
+        const QModelIndex evictedIndex = model.index(evictedRow);
+        const QModelIndex keptIndex = model.index(1 - evictedRow);
+
+        // An evicted thumbnail is cleared, and downloaded again once shown
+        QSignalSpy downloadedSpy(&downloader, SIGNAL(imageDownloaded(QString,QString,QVariantMap)));
+        QVERIFY(QMetaObject::invokeMethod(&downloader, "invokeModelEvictionCallbacks",
+                                          Q_ARG(QStringList, QStringList() << images.at(0))));
+        QCOMPARE(model.data(evictedIndex, FacebookImageCacheModel::Thumbnail).toString(), QString());
+        QCOMPARE(model.data(keptIndex, FacebookImageCacheModel::Thumbnail).toString(), files.at(1));
+
+        QTRY_COMPARE(downloadedSpy.count(), 1);
+        QVERIFY(!downloadedSpy.first().at(1).toString().isEmpty());
+        QTRY_VERIFY(!model.data(evictedIndex, FacebookImageCacheModel::Thumbnail).toString().isEmpty());
+
+        database.removeUser(user);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+    }
+
+    void queryPlans()
+    {
+        // Makes sure the database file exists
+        {
+            FacebookImagesDatabase database;
+            database.queryUsers();
+            database.wait();
+        }
+
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(
+                        QLatin1String("QSQLITE"), QLatin1String("plans"));
+            database.setDatabaseName(QString(QLatin1String("%1/%2/facebook.db")).arg(
+                        QLatin1String(PRIVILEGED_DATA_DIR),
+                        SocialSyncInterface::dataType(SocialSyncInterface::Images)));
+            QVERIFY(database.open());
+
+            // Only images updated at the same time may need to be sorted
+            QString plan = queryPlan(database, FacebookImagesQueries::images(true, false, true, true));
+            QVERIFY2(plan.contains(QLatin1String("images_fbUserId")), qPrintable(plan));
+            QVERIFY2(plan.contains(QLatin1String("accounts_fbUserId")), qPrintable(plan));
+            QVERIFY2(!plan.contains(QLatin1String("TEMP B-TREE")), qPrintable(plan));
+
+            plan = queryPlan(database, FacebookImagesQueries::images(false, true, true, true));
+            QVERIFY2(plan.contains(QLatin1String("images_fbAlbumId")), qPrintable(plan));
+            QVERIFY2(plan.contains(QLatin1String("accounts_fbUserId")), qPrintable(plan));
+            QVERIFY2(!plan.contains(QLatin1String("TEMP B-TREE")), qPrintable(plan));
+
+            plan = queryPlan(database, FacebookImagesQueries::images(false, false, true, true));
+            QVERIFY2(plan.contains(QLatin1String("images_updatedTime")), qPrintable(plan));
+            QVERIFY2(!plan.contains(QLatin1String("TEMP B-TREE")), qPrintable(plan));
+
+            plan = queryPlan(database, FacebookImagesQueries::userFiles());
+            QVERIFY2(plan.contains(QLatin1String("images_fbUserId")), qPrintable(plan));
+
+            plan = queryPlan(database, FacebookImagesQueries::albumFiles());
+            QVERIFY2(plan.contains(QLatin1String("images_fbAlbumId")), qPrintable(plan));
+        }
+        QSqlDatabase::removeDatabase(QLatin1String("plans"));
+    }
+
     // TODO: more tests
 
 
@@ -14,6 +14,7 @@ HEADERS +=  ../../src/lib/semaphore_p.h \
             ../../src/lib/abstractsocialcachedatabase.h \
             ../../src/lib/abstractsocialcachedatabase_p.h \
             ../../src/lib/facebookimagesdatabase.h \
+            ../../src/lib/facebookimagesdatabase_p.h \
             ../../src/lib/abstractimagedownloader.h \
             ../../src/lib/abstractimagedownloader_p.h \
             ../../src/qml/abstractsocialcachemodel.h \
@@ -118,6 +118,10 @@ private slots:
         notifications = database.notifications();
         QCOMPARE(notifications.count(), 3);
 
+        QFuture<QList<FacebookNotification::ConstPtr> > future = database.notificationsAsync();
+        future.waitForFinished();
+        QCOMPARE(future.result().count(), 3);
+
         FacebookNotification::ConstPtr notification;
         do {
             notification = notifications.takeFirst();
@@ -274,6 +278,86 @@ private slots:
         QCOMPARE(notification->facebookId(), id1);
     }
 
+    void unchangedNotifications()
+    {
+        const QDateTime time = QDateTime::currentDateTime();
+        const QString clientId = QLatin1String("clientId");
+
+        FacebookNotificationsDatabase database;
+        for (int i = 0; i < 2; ++i) {
+            database.addFacebookNotification(QLatin1String("unchanged"), QLatin1String("from"),
+                                             QLatin1String("to"), time, time, QLatin1String("title"),
+                                             QLatin1String("link"), QLatin1String("app"),
+                                             QLatin1String("object"), true, 1, clientId);
+            database.sync();
+            database.wait();
+            QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        }
+        QCOMPARE(database.transactionStatistics().unchangedRows, 1);
+
+        // Reading it changes the notification
+        database.addFacebookNotification(QLatin1String("unchanged"), QLatin1String("from"),
+                                         QLatin1String("to"), time, time, QLatin1String("title"),
+                                         QLatin1String("link"), QLatin1String("app"),
+                                         QLatin1String("object"), false, 1, clientId);
+        database.sync();
+        database.wait();
+        QCOMPARE(database.transactionStatistics().unchangedRows, 1);
+        QCOMPARE(database.notifications().count(), 1);
+        QCOMPARE(database.notifications().first()->unread(), false);
+
+        database.removeNotifications(1);
+        database.sync();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+    }
+
+    void search()
+    {
+        const QDateTime time = QDateTime::currentDateTime();
+        const QString clientId = QLatin1String("clientId");
+
+        FacebookNotificationsDatabase database;
+        if (!database.searchAvailable()) {
+            QSKIP("SQLite is built without FTS5");
+        }
+
+        database.addFacebookNotification(QLatin1String("search1"), QLatin1String("from"),
+                                         QLatin1String("to"), time, time,
+                                         QLatin1String("Alice commented on your photo"),
+                                         QLatin1String("link"), QLatin1String("app"),
+                                         QLatin1String("object"), true, 1, clientId);
+        database.addFacebookNotification(QLatin1String("search2"), QLatin1String("from"),
+                                         QLatin1String("to"), time, time,
+                                         QLatin1String("Bob likes your photo"),
+                                         QLatin1String("link"), QLatin1String("app"),
+                                         QLatin1String("object"), true, 2, clientId);
+        database.sync();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        QList<AbstractSocialCacheDatabase::SearchResult> results
+                = database.search(QLatin1String("photo"));
+        QCOMPARE(results.count(), 2);
+
+        QFuture<QList<AbstractSocialCacheDatabase::SearchResult> > future
+                = database.searchAsync(QLatin1String("comment"));
+        future.waitForFinished();
+        QCOMPARE(future.result().count(), 1);
+        QCOMPARE(future.result().first().identifier, QLatin1String("search1"));
+        QVERIFY(future.result().first().snippet.contains(QLatin1String("<b>commented</b>")));
+
+        database.removeNotifications(1);
+        database.sync();
+        database.wait();
+        QCOMPARE(database.search(QLatin1String("photo")).count(), 1);
+
+        database.removeNotification(QLatin1String("search2"));
+        database.sync();
+        database.wait();
+        QCOMPARE(database.search(QLatin1String("photo")).count(), 0);
+    }
+
     void cleanupTestCase()
     {
         // Do the same cleanups
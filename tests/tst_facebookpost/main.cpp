@@ -32,16 +32,162 @@
 #include <QtTest/QTest>
 #include "facebookpostsdatabase.h"
 #include "socialsyncinterface.h"
+#include <QtCore/QDataStream>
 #include <QtCore/QDebug>
 #include <QtCore/QDir>
+#include <QtCore/QFile>
 #include <QtCore/QStandardPaths>
 #include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlQuery>
 
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Creates the tables of an older version of the schema, with the same steps
+// as the upgrades to the current version
+class OldPostsDatabase: public AbstractSocialPostCacheDatabase
+{
+public:
+    explicit OldPostsDatabase(const QString &serviceName, const QString &databaseFile, int version)
+        : AbstractSocialPostCacheDatabase(serviceName, databaseFile)
+        , version(version)
+    {
+    }
+
+    bool createOldTables(QSqlDatabase database) const
+    {
+        QSqlQuery query(database);
+        return createTables(database)
+                && query.exec(QString(QLatin1String("PRAGMA user_version=%1")).arg(version));
+    }
+
+protected:
+    bool upgradeTables(QSqlDatabase database, int fromVersion) const
+    {
+        return fromVersion >= version
+                || AbstractSocialPostCacheDatabase::upgradeTables(database, fromVersion);
+    }
+
+private:
+    int version;
+};
+
 class FacebookPostsTest: public QObject
 {
     Q_OBJECT
 private:
+    // Reads the posts with one query per post and child table
+    int readPostsPerPost()
+    {
+        QSqlDatabase database = QSqlDatabase::database(QLatin1String("benchmark"));
+
+        QSqlQuery postQuery(database);
+        QSqlQuery imageQuery(database);
+        QSqlQuery accountQuery(database);
+        postQuery.prepare(QLatin1String(
+                    "SELECT identifier, name, body, timestamp, extra FROM posts "
+                    "ORDER BY timestamp DESC"));
+        imageQuery.prepare(QLatin1String(
+                    "SELECT position, url, type FROM images WHERE postId = :postId ORDER BY position"));
+        accountQuery.prepare(QLatin1String(
+                    "SELECT account FROM link_post_account WHERE postId = :postId"));
+
+        QList<SocialPost::ConstPtr> posts;
+        postQuery.exec();
+        while (postQuery.next()) {
+            const QString identifier = postQuery.value(0).toString();
+            SocialPost::Ptr post = SocialPost::create(
+                        identifier, postQuery.value(1).toString(), postQuery.value(2).toString(),
+                        QDateTime::fromTime_t(postQuery.value(3).toInt()));
+
+            QMap<int, SocialPostImage::ConstPtr> images;
+            imageQuery.bindValue(QLatin1String(":postId"), identifier);
+            imageQuery.exec();
+            while (imageQuery.next()) {
+                images.insert(imageQuery.value(0).toInt(), SocialPostImage::create(
+                                  imageQuery.value(1).toString(), SocialPostImage::Photo));
+            }
+            post->setImages(images);
+
+            QVariantMap extra;
+            const QByteArray packedExtra = postQuery.value(4).toByteArray();
+            if (!packedExtra.isEmpty()) {
+                QDataStream stream(packedExtra);
+                stream.setVersion(QDataStream::Qt_5_0);
+                stream >> extra;
+            }
+            post->setExtra(extra);
+
+            QList<int> accounts;
+            accountQuery.bindValue(QLatin1String(":postId"), identifier);
+            accountQuery.exec();
+            while (accountQuery.next()) {
+                accounts.append(accountQuery.value(0).toInt());
+            }
+            post->setAccounts(accounts);
+
+            posts.append(post);
+        }
+        return posts.count();
+    }
+
+#ifdef __GLIBC__
+    // A post that keeps a map of shared image objects, the layout used
+    // before images were stored inline
+    struct ObjectPost
+    {
+        SocialPost::ConstPtr post;
+        QMap<int, SocialPostImage::ConstPtr> images;
+    };
+
+    // Bytes currently allocated on the heap
+    static qint64 heapInUse()
+    {
+#if __GLIBC_PREREQ(2, 33)
+        return mallinfo2().uordblks;
+#else
+        return mallinfo().uordblks;
+#endif
+    }
+
+    // Heap used by each of postCount posts with two images
+    int heapPerPost(bool inlineImages, int postCount)
+    {
+        const QString image = QLatin1String("http://example.com/image.jpg");
+        const QString icon = QLatin1String("/icon.jpg");
+
+        QVariantMap extra;
+        extra.insert(QLatin1String("attachmentName"), QLatin1String("attachment"));
+        extra.insert(QLatin1String("clientId"), QLatin1String("client"));
+
+        QList<SocialPost::ConstPtr> posts;
+        QList<ObjectPost> objectPosts;
+
+        const qint64 before = heapInUse();
+        for (int i = 0; i < postCount; ++i) {
+            SocialPost::Ptr post = SocialPost::create(
+                        QString(QLatin1String("post%1")).arg(i), QLatin1String("name"),
+                        QLatin1String("body"), QDateTime::currentDateTime(),
+                        QMap<int, SocialPostImage::ConstPtr>(), extra);
+            if (inlineImages) {
+                post->setImageList(QVector<SocialPost::Image>()
+                                   << SocialPost::Image(0, icon, SocialPostImage::Photo)
+                                   << SocialPost::Image(1, image, SocialPostImage::Photo));
+                posts.append(post);
+            } else {
+                ObjectPost objectPost;
+                objectPost.post = post;
+                objectPost.images.insert(0, SocialPostImage::create(icon, SocialPostImage::Photo));
+                objectPost.images.insert(1, SocialPostImage::create(image, SocialPostImage::Photo));
+                objectPosts.append(objectPost);
+            }
+        }
+        const qint64 after = heapInUse();
+
+        return int((after - before) / postCount);
+    }
+#endif
 
 private slots:
     // Perform some cleanups
@@ -56,6 +202,61 @@ private slots:
         dir.removeRecursively();
     }
 
+    void migrateExtraTable()
+    {
+        const QString serviceName = SocialSyncInterface::socialNetwork(SocialSyncInterface::Facebook);
+        const QString databaseFile = QLatin1String("migration.db");
+        const QString dataDir = QString(QLatin1String("%1/%2")).arg(
+                    QLatin1String(PRIVILEGED_DATA_DIR),
+                    SocialSyncInterface::dataType(SocialSyncInterface::Posts));
+        const QString filePath = dataDir + QLatin1Char('/') + databaseFile;
+        QVERIFY(QDir().mkpath(dataDir));
+        QFile::remove(filePath);
+
+        {
+            QSqlDatabase connection = QSqlDatabase::addDatabase(
+                        QLatin1String("QSQLITE"), QLatin1String("migration"));
+            connection.setDatabaseName(filePath);
+            QVERIFY(connection.open());
+
+            // Version 3 of the schema, with the extra fields in their own table
+            OldPostsDatabase oldDatabase(serviceName, databaseFile, 3);
+            QVERIFY(oldDatabase.createOldTables(connection));
+
+            QSqlQuery query(connection);
+            QVERIFY(query.exec(QLatin1String(
+                        "INSERT INTO posts (identifier, name, body, timestamp, sequence) "
+                        "VALUES ('migrated', 'name', 'body', 1000, 1)")));
+            QVERIFY(query.exec(QLatin1String(
+                        "INSERT INTO link_post_account (postId, account) VALUES ('migrated', 1)")));
+            QVERIFY(query.exec(QLatin1String(
+                        "INSERT INTO extra (postId, key, value) "
+                        "VALUES ('migrated', 'post_attachment_name', 'attachment')")));
+            QVERIFY(query.exec(QLatin1String(
+                        "INSERT INTO extra (postId, key, value) "
+                        "VALUES ('migrated', 'allow_like', 'true')")));
+            connection.close();
+        }
+        QSqlDatabase::removeDatabase(QLatin1String("migration"));
+
+        {
+            AbstractSocialPostCacheDatabase database(serviceName, databaseFile);
+            database.refresh();
+            database.wait();
+            QCOMPARE(database.readStatus(), AbstractSocialCacheDatabase::Finished);
+            QCOMPARE(database.posts().count(), 1);
+
+            SocialPost::ConstPtr post = database.posts().first();
+            QCOMPARE(FacebookPostsDatabase::attachmentName(post), QLatin1String("attachment"));
+            QCOMPARE(FacebookPostsDatabase::allowLike(post), true);
+            QCOMPARE(FacebookPostsDatabase::allowComment(post), false);
+        }
+
+        QFile::remove(filePath);
+        QFile::remove(filePath + QLatin1String("-wal"));
+        QFile::remove(filePath + QLatin1String("-shm"));
+    }
+
     void posts()
     {
         QDateTime time1(QDate(2013, 1, 2), QTime(12, 34, 56));
@@ -165,6 +366,611 @@ private slots:
         QCOMPARE(posts.count(), 0);
     }
 
+    void pagedPosts()
+    {
+        const QDateTime time(QDate(2013, 1, 2), QTime(12, 34, 56));
+
+        FacebookPostsDatabase database;
+        database.setPageSize(2);
+
+        // Two posts share each timestamp, so pages have to split them by identifier
+        for (int i = 0; i < 5; ++i) {
+            database.addFacebookPost(
+                        QString(QLatin1String("paged%1")).arg(i), QLatin1String("name"),
+                        QLatin1String("body"), time.addSecs(-(i / 2)), QLatin1String("/icon.jpg"),
+                        QList<QPair<QString, SocialPostImage::ImageType> >()
+                                << qMakePair(QString(QLatin1String("http://example.com/image.jpg")),
+                                             SocialPostImage::Photo),
+                        QString(), QString(), QString(), QString(),
+                        true, true, QLatin1String("client"), 1);
+        }
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        QVERIFY(!database.canFetchMore());
+        database.refresh();
+        database.wait();
+        QCOMPARE(database.posts().count(), 2);
+        QVERIFY(database.canFetchMore());
+
+        database.fetchMore();
+        database.wait();
+        QCOMPARE(database.posts().count(), 4);
+        QVERIFY(database.canFetchMore());
+
+        database.fetchMore();
+        database.wait();
+        QCOMPARE(database.posts().count(), 5);
+        QVERIFY(!database.canFetchMore());
+
+        QStringList identifiers;
+        Q_FOREACH (const SocialPost::ConstPtr &post, database.posts()) {
+            QCOMPARE(post->images().count(), 1);
+            identifiers.append(post->identifier());
+        }
+        QCOMPARE(identifiers, QStringList() << QLatin1String("paged1") << QLatin1String("paged0")
+                                            << QLatin1String("paged3") << QLatin1String("paged2")
+                                            << QLatin1String("paged4"));
+
+        // A refresh keeps the posts that were already read
+        database.refresh();
+        database.wait();
+        QCOMPARE(database.posts().count(), 5);
+
+        database.removePosts(1);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+    }
+
+    void incrementalRefresh()
+    {
+        const QDateTime time(QDate(2013, 1, 2), QTime(12, 34, 56));
+        const QList<QPair<QString, SocialPostImage::ImageType> > images;
+
+        FacebookPostsDatabase database;
+
+        for (int i = 0; i < 3; ++i) {
+            database.addFacebookPost(
+                        QString(QLatin1String("changed%1")).arg(i), QLatin1String("name"),
+                        QLatin1String("body"), time.addSecs(i), QLatin1String("/icon.jpg"), images,
+                        QString(), QString(), QString(), QString(),
+                        true, true, QLatin1String("client"), 1);
+        }
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        QCOMPARE(database.changeToken(), qint64(-1));
+        database.refreshChanges(database.changeToken());
+        database.wait();
+        QVERIFY(!database.incrementalRefresh());
+        QCOMPARE(database.posts().count(), 3);
+
+        const qint64 token = database.changeToken();
+        QVERIFY(token > 0);
+
+        // One new post and one updated post
+        database.addFacebookPost(
+                    QLatin1String("changed3"), QLatin1String("name"), QLatin1String("body"),
+                    time.addSecs(3), QLatin1String("/icon.jpg"), images,
+                    QString(), QString(), QString(), QString(),
+                    true, true, QLatin1String("client"), 1);
+        for (int account = 1; account <= 2; ++account) {
+            database.addFacebookPost(
+                        QLatin1String("changed0"), QLatin1String("name"), QLatin1String("updated"),
+                        time, QLatin1String("/icon.jpg"), images,
+                        QString(), QString(), QString(), QString(),
+                        true, true, QLatin1String("client"), account);
+        }
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        database.refreshChanges(token);
+        database.wait();
+        QCOMPARE(database.readStatus(), AbstractSocialCacheDatabase::Finished);
+        QVERIFY(database.incrementalRefresh());
+        QVERIFY(database.changeToken() > token);
+        QCOMPARE(database.changedPosts().count(), 2);
+        QCOMPARE(database.removedPosts(), QStringList() << QLatin1String("changed0"));
+        QCOMPARE(database.posts().count(), 4);
+        QCOMPARE(database.posts().first()->identifier(), QLatin1String("changed3"));
+        QCOMPARE(database.posts().last()->body(), QLatin1String("updated"));
+
+        // changed0 keeps its second account
+        database.removePosts(1);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        database.refreshChanges(database.changeToken());
+        database.wait();
+        QVERIFY(database.incrementalRefresh());
+        QCOMPARE(database.removedPosts().count(), 4);
+        QCOMPARE(database.changedPosts().count(), 1);
+        QCOMPARE(database.posts().count(), 1);
+        QCOMPARE(database.posts().first()->accounts(), QList<int>() << 2);
+
+        database.removePosts(2);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        database.refreshChanges(database.changeToken());
+        database.wait();
+        QVERIFY(database.incrementalRefresh());
+        QCOMPARE(database.posts().count(), 0);
+    }
+
+    void unchangedPosts()
+    {
+        const QDateTime time(QDate(2013, 1, 2), QTime(12, 34, 56));
+        const QList<QPair<QString, SocialPostImage::ImageType> > images
+                = QList<QPair<QString, SocialPostImage::ImageType> >()
+                << qMakePair(QString(QLatin1String("http://example.com/image.jpg")),
+                             SocialPostImage::Photo);
+
+        FacebookPostsDatabase database;
+
+        for (int i = 0; i < 2; ++i) {
+            database.addFacebookPost(
+                        QLatin1String("unchanged"), QLatin1String("name"), QLatin1String("body"),
+                        time, QLatin1String("/icon.jpg"), images,
+                        QLatin1String("attachment"), QString(), QString(), QString(),
+                        true, true, QLatin1String("client"), 1);
+            database.commit();
+            database.wait();
+            QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+            if (i == 0) {
+                database.refreshChanges(database.changeToken());
+                database.wait();
+            }
+        }
+        QCOMPARE(database.transactionStatistics().unchangedRows, 1);
+
+        // Nothing was written, so there are no changes to read
+        const qint64 token = database.changeToken();
+        database.refreshChanges(token);
+        database.wait();
+        QVERIFY(database.incrementalRefresh());
+        QCOMPARE(database.changeToken(), token);
+        QCOMPARE(database.changedPosts().count(), 0);
+
+        // A new account is a change
+        database.addFacebookPost(
+                    QLatin1String("unchanged"), QLatin1String("name"), QLatin1String("body"),
+                    time, QLatin1String("/icon.jpg"), images,
+                    QLatin1String("attachment"), QString(), QString(), QString(),
+                    true, true, QLatin1String("client"), 2);
+        database.addFacebookPost(
+                    QLatin1String("unchanged"), QLatin1String("name"), QLatin1String("body"),
+                    time, QLatin1String("/icon.jpg"), images,
+                    QLatin1String("attachment"), QString(), QString(), QString(),
+                    true, true, QLatin1String("client"), 1);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.transactionStatistics().unchangedRows, 2);
+
+        database.refreshChanges(token);
+        database.wait();
+        QCOMPARE(database.changedPosts().count(), 1);
+        QCOMPARE(database.changedPosts().first()->accounts().count(), 2);
+
+        // The accounts of a shared post are synced one at a time
+        const qint64 sharedToken = database.changeToken();
+        for (int account = 1; account <= 2; ++account) {
+            database.addFacebookPost(
+                        QLatin1String("unchanged"), QLatin1String("name"), QLatin1String("body"),
+                        time, QLatin1String("/icon.jpg"), images,
+                        QLatin1String("attachment"), QString(), QString(), QString(),
+                        true, true, QLatin1String("client"), account);
+            database.commit();
+            database.wait();
+            QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        }
+        QCOMPARE(database.transactionStatistics().unchangedRows, 4);
+
+        database.refreshChanges(sharedToken);
+        database.wait();
+        QCOMPARE(database.changeToken(), sharedToken);
+        QCOMPARE(database.changedPosts().count(), 0);
+
+        // A changed post keeps the accounts it was linked to
+        database.addFacebookPost(
+                    QLatin1String("unchanged"), QLatin1String("name"), QLatin1String("edited"),
+                    time, QLatin1String("/icon.jpg"), images,
+                    QLatin1String("attachment"), QString(), QString(), QString(),
+                    true, true, QLatin1String("client"), 1);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        database.refreshChanges(sharedToken);
+        database.wait();
+        QCOMPARE(database.changedPosts().count(), 1);
+        QCOMPARE(database.changedPosts().first()->accounts().count(), 2);
+
+        database.removePosts(1);
+        database.removePosts(2);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+    }
+
+    void search()
+    {
+        const QDateTime time(QDate(2013, 1, 2), QTime(12, 34, 56));
+        const QList<QPair<QString, SocialPostImage::ImageType> > images;
+
+        FacebookPostsDatabase database;
+        if (!database.searchAvailable()) {
+            QSKIP("SQLite is built without FTS5");
+        }
+
+        database.addFacebookPost(
+                    QLatin1String("search1"), QLatin1String("Alice"),
+                    QLatin1String("Sailing on the lake this weekend"), time,
+                    QLatin1String("/icon.jpg"), images, QString(), QString(), QString(), QString(),
+                    true, true, QLatin1String("client"), 1);
+        database.addFacebookPost(
+                    QLatin1String("search2"), QLatin1String("Bob"),
+                    QLatin1String("The lake was frozen, no sailing \"today\""), time.addSecs(1),
+                    QLatin1String("/icon.jpg"), images, QString(), QString(), QString(), QString(),
+                    true, true, QLatin1String("client"), 1);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        QList<AbstractSocialCacheDatabase::SearchResult> results = database.search(
+                    QLatin1String("sail lake"));
+        QCOMPARE(results.count(), 2);
+        QVERIFY(results.first().snippet.contains(QLatin1String("<b>")));
+
+        results = database.search(QLatin1String("alice"));
+        QCOMPARE(results.count(), 1);
+        QCOMPARE(results.first().identifier, QLatin1String("search1"));
+
+        // Query syntax in the text is searched for as is
+        QFuture<QList<AbstractSocialCacheDatabase::SearchResult> > future
+                = database.searchAsync(QLatin1String("\"today OR weekend"));
+        future.waitForFinished();
+        QCOMPARE(future.result().count(), 0);
+
+        // Updated posts are searched with their new body
+        database.addFacebookPost(
+                    QLatin1String("search1"), QLatin1String("Alice"),
+                    QLatin1String("Hiking instead"), time,
+                    QLatin1String("/icon.jpg"), images, QString(), QString(), QString(), QString(),
+                    true, true, QLatin1String("client"), 1);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.search(QLatin1String("sailing")).count(), 1);
+        QCOMPARE(database.search(QLatin1String("hiking")).count(), 1);
+
+        database.removePosts(1);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        QCOMPARE(database.search(QLatin1String("alice")).count(), 0);
+    }
+
+    void retentionPolicy()
+    {
+        const QDateTime time = QDateTime::currentDateTime();
+        const QList<QPair<QString, SocialPostImage::ImageType> > images
+                = QList<QPair<QString, SocialPostImage::ImageType> >()
+                << qMakePair(QString(QLatin1String("http://example.com/image.jpg")),
+                             SocialPostImage::Photo);
+
+        FacebookPostsDatabase database;
+
+        AbstractSocialPostCacheDatabase::RetentionPolicy policy;
+        policy.maximumAge = 10;
+        policy.maximumPostsPerAccount = 3;
+        database.setRetentionPolicy(policy);
+        QCOMPARE(database.retentionPolicy().maximumPostsPerAccount, 3);
+
+        // retained0 is shared, and only lost its link to account 1
+        for (int i = 0; i < 5; ++i) {
+            database.addFacebookPost(
+                        QString(QLatin1String("retained%1")).arg(i), QLatin1String("name"),
+                        QLatin1String("body"), time.addSecs(i), QLatin1String("/icon.jpg"), images,
+                        QString(), QString(), QString(), QString(),
+                        true, true, QLatin1String("client"), 1);
+        }
+        database.addFacebookPost(
+                    QLatin1String("retained0"), QLatin1String("name"), QLatin1String("body"),
+                    time, QLatin1String("/icon.jpg"), images,
+                    QString(), QString(), QString(), QString(),
+                    true, true, QLatin1String("client"), 2);
+        database.addFacebookPost(
+                    QLatin1String("expired"), QLatin1String("name"), QLatin1String("body"),
+                    time.addDays(-20), QLatin1String("/icon.jpg"), images,
+                    QString(), QString(), QString(), QString(),
+                    true, true, QLatin1String("client"), 2);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        database.refresh();
+        database.wait();
+
+        QStringList identifiers;
+        Q_FOREACH (const SocialPost::ConstPtr &post, database.posts()) {
+            identifiers.append(post->identifier());
+        }
+        QCOMPARE(identifiers, QStringList() << QLatin1String("retained4")
+                                            << QLatin1String("retained3")
+                                            << QLatin1String("retained2")
+                                            << QLatin1String("retained0"));
+        QCOMPARE(database.posts().last()->accounts(), QList<int>() << 2);
+
+        const AbstractSocialPostCacheDatabase::RetentionStatistics statistics
+                = database.retentionStatistics();
+        QCOMPARE(statistics.evictedPosts, 2);
+        QCOMPARE(statistics.evictedImages, 4);
+        QCOMPARE(statistics.evictedLinks, 3);
+
+        // The policy applies even when the posts added are unchanged
+        policy.maximumPostsPerAccount = 2;
+        database.setRetentionPolicy(policy);
+        database.addFacebookPost(
+                    QLatin1String("retained4"), QLatin1String("name"), QLatin1String("body"),
+                    time.addSecs(4), QLatin1String("/icon.jpg"), images,
+                    QString(), QString(), QString(), QString(),
+                    true, true, QLatin1String("client"), 1);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        QCOMPARE(database.retentionStatistics().evictedPosts, statistics.evictedPosts + 1);
+
+        // Nothing left to evict leaves the sequence as it is
+        database.refreshChanges(database.changeToken());
+        database.wait();
+        const qint64 retainedToken = database.changeToken();
+        database.addFacebookPost(
+                    QLatin1String("retained4"), QLatin1String("name"), QLatin1String("body"),
+                    time.addSecs(4), QLatin1String("/icon.jpg"), images,
+                    QString(), QString(), QString(), QString(),
+                    true, true, QLatin1String("client"), 1);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        database.refreshChanges(retainedToken);
+        database.wait();
+        QCOMPARE(database.changeToken(), retainedToken);
+        QCOMPARE(database.changedPosts().count(), 0);
+
+        database.setRetentionPolicy(AbstractSocialPostCacheDatabase::RetentionPolicy());
+        database.removePosts(1);
+        database.removePosts(2);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+    }
+
+    void readBenchmark_data()
+    {
+        QTest::addColumn<bool>("bulk");
+
+        QTest::newRow("bulk") << true;
+        QTest::newRow("per post") << false;
+    }
+
+    void readBenchmark()
+    {
+        QFETCH(bool, bulk);
+
+        const int postCount = 2000;
+        const QString image = QLatin1String("http://example.com/image.jpg");
+
+        FacebookPostsDatabase database;
+
+        database.refresh();
+        database.wait();
+        if (database.posts().count() != postCount) {
+            for (int i = 0; i < postCount; ++i) {
+                database.addFacebookPost(
+                            QString(QLatin1String("post%1")).arg(i), QLatin1String("name"),
+                            QLatin1String("body"), QDateTime::currentDateTime().addSecs(-i),
+                            QLatin1String("/icon.jpg"),
+                            QList<QPair<QString, SocialPostImage::ImageType> >()
+                                    << qMakePair(image, SocialPostImage::Photo),
+                            QLatin1String("attachment"), QLatin1String("caption"),
+                            QLatin1String("description"), QLatin1String("url"),
+                            true, true, QLatin1String("client"), 1);
+            }
+            database.commit();
+            database.wait();
+            QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        }
+
+        if (bulk) {
+            QBENCHMARK {
+                database.refresh();
+                database.wait();
+            }
+            QCOMPARE(database.posts().count(), postCount);
+        } else {
+            {
+                QSqlDatabase connection = QSqlDatabase::addDatabase(
+                            QLatin1String("QSQLITE"), QLatin1String("benchmark"));
+                connection.setDatabaseName(QString(QLatin1String("%1/%2/facebook.db")).arg(
+                            QLatin1String(PRIVILEGED_DATA_DIR),
+                            SocialSyncInterface::dataType(SocialSyncInterface::Posts)));
+                QVERIFY(connection.open());
+
+                int count = 0;
+                QBENCHMARK {
+                    count = readPostsPerPost();
+                }
+                QCOMPARE(count, postCount);
+            }
+            QSqlDatabase::removeDatabase(QLatin1String("benchmark"));
+        }
+    }
+
+    void writeBenchmark()
+    {
+        const int postCount = 500;
+        const QString image = QLatin1String("http://example.com/image.jpg");
+
+        FacebookPostsDatabase database;
+
+        int run = 0;
+        QBENCHMARK {
+            for (int i = 0; i < postCount; ++i) {
+                database.addFacebookPost(
+                            QString(QLatin1String("written%1-%2")).arg(run).arg(i),
+                            QLatin1String("name"), QLatin1String("body"),
+                            QDateTime::currentDateTime().addSecs(-i), QLatin1String("/icon.jpg"),
+                            QList<QPair<QString, SocialPostImage::ImageType> >()
+                                    << qMakePair(image, SocialPostImage::Photo),
+                            QLatin1String("attachment"), QLatin1String("caption"),
+                            QLatin1String("description"), QLatin1String("url"),
+                            true, true, QLatin1String("client"), 3);
+            }
+            database.commit();
+            database.wait();
+            ++run;
+        }
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+        database.removePosts(3);
+        database.commit();
+        database.wait();
+        QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+    }
+
+    void memoryBenchmark()
+    {
+#ifdef __GLIBC__
+        const int inlineBytes = heapPerPost(true, 5000);
+        const int objectBytes = heapPerPost(false, 5000);
+
+        QVERIFY2(inlineBytes < objectBytes, qPrintable(QString(QLatin1String("%1 >= %2")).arg(
+                                                           inlineBytes).arg(objectBytes)));
+        QTest::setBenchmarkResult(inlineBytes, QTest::BytesAllocated);
+#else
+        QSKIP("Heap usage is only measured with glibc");
+#endif
+    }
+
+    void largeCacheBenchmark_data()
+    {
+        QTest::addColumn<QString>("operation");
+
+        QTest::newRow("first page") << QString(QLatin1String("page"));
+        QTest::newRow("all posts") << QString(QLatin1String("read"));
+        QTest::newRow("remove small account") << QString(QLatin1String("removeSmall"));
+        QTest::newRow("remove account") << QString(QLatin1String("remove"));
+    }
+
+    void largeCacheBenchmark()
+    {
+        QFETCH(QString, operation);
+
+        const int postCount = 50000;
+        const int accountCount = 5;
+        const QString image = QLatin1String("http://example.com/image.jpg");
+
+        FacebookPostsDatabase database;
+
+        database.refresh();
+        database.wait();
+        if (database.posts().count() < postCount) {
+            for (int i = 0; i < postCount; ++i) {
+                database.addFacebookPost(
+                            QString(QLatin1String("large%1")).arg(i), QLatin1String("name"),
+                            QLatin1String("body"), QDateTime::currentDateTime().addSecs(-i),
+                            QLatin1String("/icon.jpg"),
+                            QList<QPair<QString, SocialPostImage::ImageType> >()
+                                    << qMakePair(image, SocialPostImage::Photo)
+                                    << qMakePair(image, SocialPostImage::Photo),
+                            QLatin1String("attachment"), QLatin1String("caption"),
+                            QLatin1String("description"), QLatin1String("url"),
+                            true, true, QLatin1String("client"), 10 + i % accountCount);
+            }
+            database.commit();
+            database.wait();
+            QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        }
+
+        if (operation == QLatin1String("page")) {
+            // Refreshing keeps as many posts as were read, so the page is read
+            // by a database that never read all of them
+            FacebookPostsDatabase pagedDatabase;
+            pagedDatabase.setPageSize(50);
+            QBENCHMARK {
+                pagedDatabase.refresh();
+                pagedDatabase.wait();
+            }
+            QCOMPARE(pagedDatabase.posts().count(), 50);
+        } else if (operation == QLatin1String("read")) {
+            QBENCHMARK {
+                database.refresh();
+                database.wait();
+            }
+            QVERIFY(database.posts().count() >= postCount);
+        } else if (operation == QLatin1String("removeSmall")) {
+            // A few posts of their own, and a few shared with a large account.
+            // The shared posts keep the large account they are linked to.
+            for (int i = 0; i < 20; ++i) {
+                database.addFacebookPost(
+                            QString(QLatin1String("small%1")).arg(i), QLatin1String("name"),
+                            QLatin1String("body"), QDateTime::currentDateTime(),
+                            QLatin1String("/icon.jpg"),
+                            QList<QPair<QString, SocialPostImage::ImageType> >()
+                                    << qMakePair(image, SocialPostImage::Photo),
+                            QString(), QString(), QString(), QString(),
+                            true, true, QLatin1String("client"), 20);
+            }
+            for (int i = 0; i < 20; ++i) {
+                const int post = i * accountCount + 1;
+                database.addFacebookPost(
+                            QString(QLatin1String("large%1")).arg(post),
+                            QLatin1String("name"), QLatin1String("body"),
+                            QDateTime::currentDateTime().addSecs(-post),
+                            QLatin1String("/icon.jpg"),
+                            QList<QPair<QString, SocialPostImage::ImageType> >()
+                                    << qMakePair(image, SocialPostImage::Photo),
+                            QString(), QString(), QString(), QString(),
+                            true, true, QLatin1String("client"), 20);
+            }
+            database.commit();
+            database.wait();
+            QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+            database.refresh();
+            database.wait();
+            const int count = database.posts().count();
+
+            QBENCHMARK_ONCE {
+                database.removePosts(20);
+                database.commit();
+                database.wait();
+            }
+            QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+
+            // Only the posts without another account are gone
+            database.refresh();
+            database.wait();
+            QCOMPARE(database.posts().count(), count - 20);
+        } else {
+            // Removal can only be measured once per seeded cache
+            QBENCHMARK_ONCE {
+                database.removePosts(10);
+                database.commit();
+                database.wait();
+            }
+            QCOMPARE(database.writeStatus(), AbstractSocialCacheDatabase::Finished);
+        }
+    }
+
     void cleanupTestCase()
     {
         // Do the same cleanups